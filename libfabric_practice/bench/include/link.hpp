@@ -0,0 +1,111 @@
+#ifndef LINK_HPP
+#define LINK_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_eq.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_cm.h>
+
+/* Sockets and socket-related libraries. */
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "buffer_pool.hpp"
+#include "progress.hpp"
+#include "fid_owner.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/* The command line options every benchmark shares, for 'getopt()'. */
+constexpr const char* LINK_OPTSTRING = "a:p:f:P";
+constexpr const char* LINK_USAGE =
+	"[-a DEST_ADDRESS] [-p PORT] [-f PROVIDER] [-P]";
+
+/* Knobs for the connection a benchmark runs over. */
+struct link_options {
+	std::string dest_addr = "127.0.0.1";
+	int dest_port = -1; /* Without one, wait for the peer to connect to us. */
+	std::string provider; /* Any provider if empty, 'tcp' for instance. */
+	bool poll = false; /* Busy-poll the completion queues instead of blocking. */
+};
+
+/* Take one of the 'LINK_OPTSTRING' options. Returns false if 'opt' isn't
+ * one of them. */
+bool parse_link_option(int opt, const char* arg, link_options& options);
+
+/* What the side that connected tells the side that listened before every
+ * run, and gets back once the listener is ready for it. */
+struct bench_control {
+	uint64_t size = 0;	/* Bytes per message. Zero ends the benchmark. */
+	uint64_t iterations = 0;	/* Messages to time. */
+	uint64_t warmup = 0;	/* Messages to send before timing any. */
+	uint64_t window = 1;	/* Messages in flight at once. */
+	uint64_t flags = 0;	/* Whatever else the benchmark needs. */
+	uint64_t cpu_ns = 0;	/* CPU time the listener spent on the run, for
+				 * benchmarks that have it report back. */
+};
+
+/* One connected endpoint, and everything that was opened for it. */
+struct bench_link {
+	/* Set on the side that connected, which drives the benchmark. */
+	bool active = false;
+
+	/* Declared so that they are destroyed in the order they have to be
+	 * closed in: the endpoints first, then the pool's memory regions, the
+	 * completion queues, the domain, the event queue and the fabric, and
+	 * the info they were all opened with last. */
+	InfoOwner info;
+	FidOwner<fid_fabric> fabric{"fabric"};
+	FidOwner<fid_eq> event_queue{"event_queue"};
+	FidOwner<fid_domain> domain{"domain"};
+	FidOwner<fid_cq> recv_queue{"recv_queue"};
+	FidOwner<fid_cq> transmit_queue{"transmit_queue"};
+	std::unique_ptr<BufferPool> pool;
+	FidOwner<fid_pep> passive_endpoint{"passive_endpoint"};
+	FidOwner<fid_ep> endpoint{"endpoint"};
+
+	buffer_slab* control_send_slab = nullptr;
+	buffer_slab* control_recv_slab = nullptr;
+
+	CompletionWaiter waiter;
+};
+
+/* Connect to the peer, or wait for it to connect if there is no port to
+ * connect to. On the listening side, the receive for the first control
+ * message is already posted by the time this returns. Exits on failure,
+ * like the rest of the setup code. */
+void open_link(bench_link& link, const link_options& options);
+
+/* Close everything the link opened. Slabs taken out of its pool must be
+ * given back first. */
+void close_link(bench_link& link);
+
+/* Wait for 'count' completions on one of the link's queues. Exits if an
+ * operation failed. */
+void wait_completions(bench_link& link, fid_cq* queue, size_t count);
+
+/* Post the receive the peer's next control message lands in. It has to be
+ * up before the peer could send it. */
+void post_control_recv(bench_link& link);
+
+/* Wait for the control message 'post_control_recv()' was posted for. */
+bench_control wait_control(bench_link& link);
+
+/* Send a control message, and wait until it is out. */
+void send_control(bench_link& link, const bench_control& control);
+
+/* Take a slab of at least 'size' bytes out of the link's pool. The size can
+ * come from the peer, so this exits if there is no slab that big. */
+buffer_slab* acquire_slab(bench_link& link, size_t size);
+
+/* Send 'len' bytes of 'slab' with 'fi_inject()' if the provider can take
+ * them in one go, or with 'fi_send()' otherwise. Returns true if a
+ * completion is coming for it. */
+bool post_send(bench_link& link, buffer_slab* slab, size_t len);
+
+#endif /* LINK_HPP */
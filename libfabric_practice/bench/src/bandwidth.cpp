@@ -0,0 +1,510 @@
+#include "link.hpp"
+#include "err.hpp"
+#include "async.hpp"
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+/* 'bench_control::flags': the listener streams back while it receives. */
+static constexpr uint64_t BIDIRECTIONAL = 1;
+
+/* 'bench_control::flags': both sides stream with coroutines. */
+static constexpr uint64_t COROUTINES = 2;
+
+/* How many completions are read off of a queue per pass. */
+static constexpr size_t COMPLETIONS_PER_READ = 16;
+
+/* Both the sizes and the windows are swept in steps of this. */
+static constexpr size_t SWEEP_STEP = 4;
+
+/* Which ways to stream in. */
+enum class direction {
+	UNI,
+	BI,
+	BOTH
+};
+
+/* Knobs for the bandwidth benchmark, filled in from the command line. Only
+ * the side that connects uses them, and tells the other side what to do. */
+struct bandwidth_options {
+	link_options link;
+	direction directions = direction::BOTH;
+	size_t max_size = 64 * 1024 * 1024;	/* The last size of the sweep. */
+	size_t max_window = 0;	/* The last window, 'tx_attr->size' if zero. */
+	uint64_t run_bytes = 256 * 1024 * 1024;	/* Bytes to move per run. */
+	uint64_t max_messages = 1000000;	/* Cap on messages per run. */
+	bool coroutines = false;	/* Stream with coroutines on a 'CqScheduler'. */
+	std::string csv_path;	/* Write the results here instead of stdout. */
+};
+
+/* One run's worth of messages, kept 'window' deep in each direction. Every
+ * send goes out of the same slab and every receive lands in the same one:
+ * what they hold doesn't matter, only how fast it moves. */
+struct stream_state {
+	bench_link* link;
+	buffer_slab* send_slab;
+	buffer_slab* recv_slab;
+	size_t size;
+	uint64_t window;
+
+	uint64_t sends;
+	uint64_t recvs;
+
+	/* In coroutine mode, what the window of sends and the window of receives
+	 * are each kept in flight by, one coroutine per message. */
+	CqScheduler* scheduler = nullptr;
+
+	uint64_t posted_sends = 0;
+	uint64_t done_sends = 0;
+	uint64_t posted_recvs = 0;
+	uint64_t done_recvs = 0;
+
+	/* Whether the receive for the next control message is up. It goes
+	 * right behind the last data receive, so the two can't mix. */
+	bool control_posted = false;
+};
+
+/* CPU time this process has used, in nanoseconds. */
+static uint64_t cpu_time() {
+	timespec now = {};
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000000 +
+		static_cast<uint64_t>(now.tv_nsec);
+}
+
+/* Top the receives up to the window, and once the last one is up, post the
+ * one for the next control message behind it. */
+static void post_recvs(stream_state& stream) {
+	while (stream.posted_recvs < stream.recvs &&
+			stream.posted_recvs - stream.done_recvs < stream.window) {
+		ssize_t ret = fi_recv(stream.link->endpoint, stream.recv_slab->data,
+				stream.size, stream.recv_slab->desc, 0, nullptr);
+		if (ret == -FI_EAGAIN)
+			return;
+		check_libfabric(static_cast<int>(ret), "fi_recv(), stream");
+		stream.posted_recvs++;
+	}
+
+	if (!stream.control_posted && stream.posted_recvs == stream.recvs) {
+		post_control_recv(*stream.link);
+		stream.control_posted = true;
+	}
+}
+
+/* Top the sends up to the window. Injected ones are done as soon as they
+ * are taken. */
+static void post_sends(stream_state& stream) {
+	bench_link& link = *stream.link;
+	bool inject = stream.size <= link.info->tx_attr->inject_size;
+
+	while (stream.posted_sends < stream.sends &&
+			stream.posted_sends - stream.done_sends < stream.window) {
+		ssize_t ret = inject ?
+			fi_inject(link.endpoint, stream.send_slab->data, stream.size, 0) :
+			fi_send(link.endpoint, stream.send_slab->data, stream.size,
+					stream.send_slab->desc, 0, nullptr);
+		if (ret == -FI_EAGAIN)
+			return;
+		check_libfabric(static_cast<int>(ret), "post_sends()");
+		stream.posted_sends++;
+		if (inject)
+			stream.done_sends++;
+	}
+}
+
+/* Read at most 'limit' completions off of 'queue', and count them in 'done'.
+ * Never reads past the run's own, so the next control message's completion
+ * stays on the queue for 'wait_control()'. With 'block' set, waits for at
+ * least one. Returns how many were read. */
+static size_t reap(bench_link& link, fid_cq* queue, uint64_t& done,
+		uint64_t limit, bool block) {
+	fi_cq_data_entry entries[COMPLETIONS_PER_READ];
+	size_t count = static_cast<size_t>(std::min<uint64_t>(limit,
+				COMPLETIONS_PER_READ));
+
+	ssize_t read = block ? link.waiter.wait(queue, entries, count) :
+		fi_cq_read(queue, entries, count);
+	if (read == -FI_EAGAIN)
+		return 0;
+	if (read == -FI_EAVAIL)
+		read = -check_cq_error(queue).err;
+	check_libfabric(read < 0 ? static_cast<int>(read) : 0, "reap()");
+
+	done += static_cast<uint64_t>(read);
+	return static_cast<size_t>(read);
+}
+
+/* Stream until every send and receive of the run has completed. */
+static void run_stream(stream_state& stream) {
+	bench_link& link = *stream.link;
+
+	for (;;) {
+		post_recvs(stream);
+		post_sends(stream);
+
+		bool sending = stream.done_sends < stream.sends;
+		bool receiving = stream.done_recvs < stream.recvs;
+		if (!sending && !receiving)
+			return;
+
+		/* With only one direction left, wait on it the waiter's way. It is
+		 * only safe to block if something is actually in flight. */
+		size_t found = 0;
+		if (sending)
+			found += reap(link, link.transmit_queue, stream.done_sends,
+					stream.posted_sends - stream.done_sends,
+					!receiving && stream.posted_sends > stream.done_sends);
+		if (receiving)
+			found += reap(link, link.recv_queue, stream.done_recvs,
+					stream.posted_recvs - stream.done_recvs,
+					!sending && stream.posted_recvs > stream.done_recvs);
+
+		if (sending && receiving) {
+			if (found)
+				link.waiter.reset();
+			else
+				link.waiter.idle();
+		}
+	}
+}
+
+/* The run's last receive, with the one for the next control message posted
+ * right behind it, so the peer's next control message can't land anywhere
+ * else. The scheduler never reads the control message's completion, it
+ * only counts its own receives, so it stays on the queue for
+ * 'wait_control()'. */
+class LastRecv : public AsyncOp {
+public:
+	LastRecv(CqScheduler& scheduler, bench_link& link, buffer_slab* slab,
+			size_t size) :
+		AsyncOp(scheduler, false, size),
+		link(link),
+		slab(slab) {}
+
+private:
+	ssize_t post() override {
+		if (!data_posted) {
+			ssize_t ret = fi_recv(link.endpoint, slab->data, length(),
+					slab->desc, 0, this);
+			if (ret < 0)
+				return ret;
+			data_posted = true;
+		}
+
+		/* If there is no room for the control receive yet, the scheduler
+		 * comes back for it, and the data receive isn't posted twice. */
+		buffer_slab* control = link.control_recv_slab;
+		return fi_recv(link.endpoint, control->data, sizeof(bench_control),
+				control->desc, 0, nullptr);
+	}
+
+	bench_link& link;
+	buffer_slab* slab;
+	bool data_posted = false;
+};
+
+/* One of the coroutines keeping the window of sends full: send, wait until
+ * the send is done, and send the next one, until the run has sent them
+ * all. Injected sends are done as soon as they are taken, so those go out
+ * back to back. */
+static Task send_messages(CqScheduler& scheduler, stream_state& stream) {
+	bench_link& link = *stream.link;
+	const bool inject = stream.size <= link.info->tx_attr->inject_size;
+
+	while (stream.posted_sends < stream.sends) {
+		stream.posted_sends++;
+		ssize_t ret = co_await AsyncSend(scheduler, link.endpoint,
+				stream.send_slab->data, stream.size, stream.send_slab->desc,
+				inject);
+		check_libfabric(ret < 0 ? static_cast<int>(ret) : 0,
+				"send_messages()");
+		stream.done_sends++;
+	}
+}
+
+/* One of the coroutines keeping the window of receives full. The scheduler
+ * posts receives in the order they are awaited in, so the last one is
+ * really posted last. */
+static Task receive_messages(CqScheduler& scheduler, stream_state& stream) {
+	bench_link& link = *stream.link;
+
+	while (stream.posted_recvs < stream.recvs) {
+		ssize_t ret = 0;
+		if (++stream.posted_recvs < stream.recvs)
+			ret = co_await AsyncRecv(scheduler, link.endpoint,
+					stream.recv_slab->data, stream.size,
+					stream.recv_slab->desc);
+		else
+			ret = co_await LastRecv(scheduler, link, stream.recv_slab,
+					stream.size);
+		check_libfabric(ret < 0 ? static_cast<int>(ret) : 0,
+				"receive_messages()");
+		stream.done_recvs++;
+	}
+}
+
+/* Put up the first window of receives, and behind the last one of the run,
+ * the one for the next control message. In coroutine mode, that is a
+ * coroutine per receive in the window. */
+static void start_recvs(stream_state& stream) {
+	if (!stream.scheduler) {
+		post_recvs(stream);
+		return;
+	}
+
+	const uint64_t coroutines = std::min(stream.window, stream.recvs);
+	for (uint64_t i = 0; i < coroutines; i++)
+		stream.scheduler->spawn(receive_messages(*stream.scheduler, stream));
+
+	/* With nothing to receive, it goes up right away. */
+	if (stream.recvs == 0)
+		post_control_recv(*stream.link);
+}
+
+/* Stream the run in coroutine mode: a coroutine per send in the window,
+ * next to the receives 'start_recvs()' started, until all of them are
+ * done. */
+static void run_stream_async(stream_state& stream) {
+	const uint64_t coroutines = std::min(stream.window, stream.sends);
+	for (uint64_t i = 0; i < coroutines; i++)
+		stream.scheduler->spawn(send_messages(*stream.scheduler, stream));
+
+	ssize_t ret = stream.scheduler->run();
+	check_libfabric(ret < 0 ? static_cast<int>(ret) : 0, "CqScheduler::run()");
+}
+
+/* How many messages a run of 'size' bytes sends each way. */
+static uint64_t run_messages(const bandwidth_options& options, size_t size) {
+	return std::clamp<uint64_t>(options.run_bytes / size, 1,
+			options.max_messages);
+}
+
+/* Stream one size at one window, and report it. */
+static void run_one(bench_link& link, const bench_control& control,
+		std::ostream& out) {
+	using clock = std::chrono::steady_clock;
+	bool bidirectional = control.flags & BIDIRECTIONAL;
+
+	std::unique_ptr<CqScheduler> scheduler;
+	if (control.flags & COROUTINES)
+		scheduler = std::make_unique<CqScheduler>(link.transmit_queue,
+				link.recv_queue, link.waiter);
+
+	stream_state stream = {
+		.link = &link,
+		.send_slab = acquire_slab(link, control.size),
+		.recv_slab = acquire_slab(link, control.size),
+		.size = control.size,
+		.window = control.window,
+		.sends = control.iterations,
+		.recvs = bidirectional ? control.iterations : 0,
+		.scheduler = scheduler.get()
+	};
+
+	/* The peer answers once its first receives are up, and may start
+	 * streaming back right after, so ours go up behind the one for its
+	 * answer. */
+	post_control_recv(link);
+	start_recvs(stream);
+	send_control(link, control);
+	wait_control(link);
+
+	/* The run is over once the peer says it has everything, not when the
+	 * last send completes here. */
+	clock::time_point start = clock::now();
+	uint64_t cpu_start = cpu_time();
+	if (scheduler)
+		run_stream_async(stream);
+	else
+		run_stream(stream);
+	bench_control report = wait_control(link);
+	uint64_t cpu_used = cpu_time() - cpu_start;
+	double seconds = std::chrono::duration<double>(
+			clock::now() - start).count();
+
+	link.pool->release(stream.send_slab);
+	link.pool->release(stream.recv_slab);
+
+	uint64_t messages = control.iterations * (bidirectional ? 2 : 1);
+	double bytes = static_cast<double>(messages) * control.size;
+	out << link.info->fabric_attr->prov_name << "," <<
+		(bidirectional ? "bi" : "uni") << "," << control.size << "," <<
+		control.window << "," << messages << "," << seconds << "," <<
+		bytes / seconds / 1e9 << "," << messages / seconds << "," <<
+		100.0 * cpu_used / 1e9 / seconds << "," <<
+		100.0 * report.cpu_ns / 1e9 / seconds << std::endl;
+}
+
+/* The side that connected: sweep through the directions, sizes and windows,
+ * and report each run. */
+static void run_active(bench_link& link, const bandwidth_options& options,
+		std::ostream& out) {
+	size_t largest = std::min(options.max_size,
+			link.info->ep_attr->max_msg_size);
+
+	/* Both sides keep a full window of sends and receives, so neither queue
+	 * can be deeper than it. */
+	uint64_t deepest = std::min<uint64_t>(link.info->tx_attr->size,
+			link.info->rx_attr->size);
+	if (options.max_window)
+		deepest = std::min<uint64_t>(deepest, options.max_window);
+
+	out << "provider,direction,size_bytes,window,messages,seconds,gb_per_s," <<
+		"messages_per_s,cpu_percent,peer_cpu_percent" << std::endl;
+
+	for (uint64_t flags : {uint64_t{0}, BIDIRECTIONAL}) {
+		if ((options.directions == direction::UNI && flags) ||
+				(options.directions == direction::BI && !flags))
+			continue;
+
+		for (size_t size = 1; size <= largest; size *= SWEEP_STEP) {
+			bench_control control;
+			control.size = size;
+			control.iterations = run_messages(options, size);
+			control.flags = flags | (options.coroutines ? COROUTINES : 0);
+
+			/* A window can't be deeper than the run is long. */
+			for (uint64_t window = 1;
+					window <= std::min(deepest, control.iterations);
+					window *= SWEEP_STEP) {
+				control.window = window;
+				run_one(link, control, out);
+			}
+		}
+	}
+
+	/* A size of zero tells the peer we are done. */
+	send_control(link, bench_control());
+}
+
+/* The side that listened: receive every run, streaming back if asked, and
+ * report the CPU time it took until told to stop. */
+static void run_passive(bench_link& link) {
+	for (bench_control control = wait_control(link); control.size != 0;
+			control = wait_control(link)) {
+		std::unique_ptr<CqScheduler> scheduler;
+		if (control.flags & COROUTINES)
+			scheduler = std::make_unique<CqScheduler>(link.transmit_queue,
+					link.recv_queue, link.waiter);
+
+		stream_state stream = {
+			.link = &link,
+			.send_slab = acquire_slab(link, control.size),
+			.recv_slab = acquire_slab(link, control.size),
+			.size = control.size,
+			.window = control.window,
+			.sends = control.flags & BIDIRECTIONAL ? control.iterations : 0,
+			.recvs = control.iterations,
+			.scheduler = scheduler.get()
+		};
+
+		/* The first window of receives has to be up before the peer hears
+		 * back. The receive for the next control message goes up behind
+		 * the run's last one. */
+		start_recvs(stream);
+		send_control(link, control);
+
+		uint64_t cpu_start = cpu_time();
+		if (scheduler)
+			run_stream_async(stream);
+		else
+			run_stream(stream);
+		control.cpu_ns = cpu_time() - cpu_start;
+		send_control(link, control);
+
+		link.pool->release(stream.send_slab);
+		link.pool->release(stream.recv_slab);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	bandwidth_options options;
+
+	/* Parse CLI arguments. */
+	std::string optstring = std::string(LINK_OPTSTRING) + "d:b:W:B:i:o:C";
+	int opt = -1;
+	while ((opt = getopt(argc, argv, optstring.c_str())) != -1) {
+		if (parse_link_option(opt, optarg, options.link))
+			continue;
+
+		switch (opt) {
+			case 'd':
+				if (std::strcmp(optarg, "uni") == 0) {
+					options.directions = direction::UNI;
+				} else if (std::strcmp(optarg, "bi") == 0) {
+					options.directions = direction::BI;
+				} else if (std::strcmp(optarg, "both") == 0) {
+					options.directions = direction::BOTH;
+				} else {
+					std::cerr << "[ERROR] '-d' takes 'uni', 'bi' or 'both'." <<
+						std::endl;
+					return EXIT_FAILURE;
+				}
+
+				break;
+			case 'b':
+				options.max_size = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'W':
+				options.max_window = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'B':
+				options.run_bytes = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'i':
+				options.max_messages = std::max<uint64_t>(1,
+						std::strtoull(optarg, nullptr, 10));
+
+				break;
+			case 'o':
+				options.csv_path = optarg;
+
+				break;
+			case 'C':
+				options.coroutines = true;
+
+				break;
+			default:
+				std::cerr << "Usage: " << argv[0] << " " << LINK_USAGE <<
+					" [-d uni|bi|both] [-b MAX_BYTES] [-W MAX_WINDOW]" <<
+					" [-B RUN_BYTES] [-i MAX_MESSAGES] [-o CSV_FILE] [-C]" <<
+					std::endl;
+
+				return EXIT_FAILURE;
+		}
+	}
+
+	std::ofstream file;
+	if (!options.csv_path.empty()) {
+		file.open(options.csv_path);
+		if (!file) {
+			std::cerr << "[ERROR] Can't write to " << options.csv_path << "." <<
+				std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	bench_link link;
+	open_link(link, options.link);
+
+	if (link.active) {
+		run_active(link, options, file.is_open() ? file : std::cout);
+	} else {
+		run_passive(link);
+	}
+
+	close_link(link);
+
+	return EXIT_SUCCESS;
+}
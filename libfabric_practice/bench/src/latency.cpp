@@ -0,0 +1,187 @@
+#include "link.hpp"
+#include "err.hpp"
+#include "histogram.hpp"
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/* Knobs for the latency benchmark, filled in from the command line. Only the
+ * side that connects uses them, and tells the other side what to do. */
+struct latency_options {
+	link_options link;
+	uint64_t iterations = 100000;	/* Round trips timed per size. */
+	uint64_t warmup = 1000;	/* Round trips per size before timing starts. */
+	size_t max_size = 64 * 1024;	/* The last size of the sweep. */
+	std::string csv_path;	/* Write the results here instead of stdout. */
+};
+
+/* Time round trips of one size: send a message, wait for the peer to send
+ * it back, and repeat. */
+static void ping(bench_link& link, const bench_control& control,
+		buffer_slab* send_slab, buffer_slab* recv_slab, Histogram& histogram) {
+	using clock = std::chrono::steady_clock;
+
+	for (uint64_t i = 0; i < control.warmup + control.iterations; i++) {
+		/* The receive goes up before the send, so the answer always has
+		 * somewhere to land. */
+		check_libfabric(fi_recv(link.endpoint, recv_slab->data, control.size,
+					recv_slab->desc, 0, nullptr), "fi_recv(), ping");
+
+		clock::time_point start = clock::now();
+		bool completes = post_send(link, send_slab, control.size);
+		wait_completions(link, link.recv_queue, 1);
+		clock::time_point stop = clock::now();
+
+		/* Small messages are injected and never complete. Everything else
+		 * has long since, since the answer is already in. */
+		if (completes)
+			wait_completions(link, link.transmit_queue, 1);
+
+		if (i >= control.warmup)
+			histogram.record(static_cast<uint64_t>(
+						std::chrono::duration_cast<std::chrono::nanoseconds>(
+							stop - start).count()));
+	}
+}
+
+/* Send every message of a run straight back. The receive for the next one
+ * goes up before the answer goes out, and after the last one, that is the
+ * receive for the next control message. */
+static void pong(bench_link& link, const bench_control& control,
+		buffer_slab* send_slab, buffer_slab* recv_slab) {
+	uint64_t total = control.warmup + control.iterations;
+	for (uint64_t i = 0; i < total; i++) {
+		wait_completions(link, link.recv_queue, 1);
+
+		if (i + 1 < total)
+			check_libfabric(fi_recv(link.endpoint, recv_slab->data,
+						control.size, recv_slab->desc, 0, nullptr),
+					"fi_recv(), pong");
+		else
+			post_control_recv(link);
+
+		if (post_send(link, send_slab, control.size))
+			wait_completions(link, link.transmit_queue, 1);
+	}
+}
+
+/* The side that connected: sweep through the sizes, and report each one. */
+static void run_active(bench_link& link, const latency_options& options,
+		std::ostream& out) {
+	size_t largest = std::min(options.max_size,
+			link.info->ep_attr->max_msg_size);
+
+	out << "size_bytes,iterations,min_ns,p50_ns,p99_ns,p99.9_ns,max_ns," <<
+		"mean_ns" << std::endl;
+
+	Histogram histogram;
+	for (size_t size = 1; size <= largest; size *= 2) {
+		bench_control control;
+		control.size = size;
+		control.iterations = options.iterations;
+		control.warmup = options.warmup;
+
+		/* The peer answers once its first receive is up. */
+		post_control_recv(link);
+		send_control(link, control);
+		wait_control(link);
+
+		buffer_slab* send_slab = acquire_slab(link, size);
+		buffer_slab* recv_slab = acquire_slab(link, size);
+		histogram.reset();
+		ping(link, control, send_slab, recv_slab, histogram);
+		link.pool->release(send_slab);
+		link.pool->release(recv_slab);
+
+		out << size << "," << histogram.count() << "," << histogram.min() <<
+			"," << histogram.percentile(50) << "," <<
+			histogram.percentile(99) << "," << histogram.percentile(99.9) <<
+			"," << histogram.max() << "," << histogram.mean() << std::endl;
+	}
+
+	/* A size of zero tells the peer we are done. */
+	send_control(link, bench_control());
+}
+
+/* The side that listened: answer every run until told to stop. */
+static void run_passive(bench_link& link) {
+	for (bench_control control = wait_control(link); control.size != 0;
+			control = wait_control(link)) {
+		buffer_slab* send_slab = acquire_slab(link, control.size);
+		buffer_slab* recv_slab = acquire_slab(link, control.size);
+
+		/* Our first receive has to be up before the peer hears back. */
+		check_libfabric(fi_recv(link.endpoint, recv_slab->data, control.size,
+					recv_slab->desc, 0, nullptr), "fi_recv(), pong");
+		send_control(link, control);
+		pong(link, control, send_slab, recv_slab);
+
+		link.pool->release(send_slab);
+		link.pool->release(recv_slab);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	latency_options options;
+
+	/* Parse CLI arguments. */
+	std::string optstring = std::string(LINK_OPTSTRING) + "i:w:b:o:";
+	int opt = -1;
+	while ((opt = getopt(argc, argv, optstring.c_str())) != -1) {
+		if (parse_link_option(opt, optarg, options.link))
+			continue;
+
+		switch (opt) {
+			case 'i':
+				options.iterations = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'w':
+				options.warmup = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'b':
+				options.max_size = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'o':
+				options.csv_path = optarg;
+
+				break;
+			default:
+				std::cerr << "Usage: " << argv[0] << " " << LINK_USAGE <<
+					" [-i ITERATIONS] [-w WARMUP] [-b MAX_BYTES] [-o CSV_FILE]" <<
+					std::endl;
+
+				return EXIT_FAILURE;
+		}
+	}
+
+	std::ofstream file;
+	if (!options.csv_path.empty()) {
+		file.open(options.csv_path);
+		if (!file) {
+			std::cerr << "[ERROR] Can't write to " << options.csv_path << "." <<
+				std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	bench_link link;
+	open_link(link, options.link);
+
+	if (link.active) {
+		run_active(link, options, file.is_open() ? file : std::cout);
+	} else {
+		run_passive(link);
+	}
+
+	close_link(link);
+
+	return EXIT_SUCCESS;
+}
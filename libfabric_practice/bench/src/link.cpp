@@ -0,0 +1,233 @@
+#include "link.hpp"
+#include "err.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+/* Slabs for the control messages. Message buffers come from the same pool,
+ * but are big enough to get arenas of their own. */
+static constexpr size_t LINK_SLAB_SIZE = 4096;
+static constexpr size_t LINK_SLAB_COUNT = 4;
+
+/* How many completions are read per call while waiting on them. */
+static constexpr size_t COMPLETIONS_PER_WAIT = 16;
+
+/* Take one of the options every benchmark shares. */
+bool parse_link_option(int opt, const char* arg, link_options& options) {
+	switch (opt) {
+		case 'a':
+			options.dest_addr = arg;
+
+			return true;
+		case 'p':
+			options.dest_port = std::atoi(arg);
+
+			return true;
+		case 'f':
+			options.provider = arg;
+
+			return true;
+		case 'P':
+			options.poll = true;
+
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Wait for one event of 'expected_type' on the link's event queue. */
+static void wait_event(bench_link& link, uint32_t expected_type,
+		fi_eq_cm_entry& entry) {
+	uint32_t event_type = 0;
+	do {
+		ssize_t return_code = fi_eq_sread(link.event_queue, &event_type,
+				&entry, sizeof(fi_eq_cm_entry), -1, 0);
+		if (return_code == -FI_EAVAIL) {
+			check_eq_error(link.event_queue);
+			std::exit(EXIT_FAILURE);
+		}
+		if (return_code < 0 && return_code != -FI_EAGAIN)
+			check_libfabric(static_cast<int>(return_code), "fi_eq_sread()");
+	} while (event_type != expected_type);
+}
+
+/* Open the domain, endpoint and completion queues on 'info', and enable the
+ * endpoint. */
+static void open_endpoint(bench_link& link, fi_info* info) {
+	check_libfabric(fi_domain(link.fabric, info, link.domain.out(), nullptr),
+			"fi_domain()");
+
+	/* Every send reports a completion unless it says otherwise, so small
+	 * messages can be injected without leaving anything to reap. */
+	info->tx_attr->op_flags |= FI_COMPLETION;
+	check_libfabric(fi_endpoint(link.domain, info, link.endpoint.out(),
+				nullptr), "fi_endpoint()");
+
+	fi_cq_attr completion_queue_attr = cq_attr(link.waiter.mode());
+	check_libfabric(fi_cq_open(link.domain, &completion_queue_attr,
+				link.recv_queue.out(), nullptr), "fi_cq_open(), recv_queue");
+	check_libfabric(fi_cq_open(link.domain, &completion_queue_attr,
+				link.transmit_queue.out(), nullptr),
+			"fi_cq_open(), transmit_queue");
+
+	check_libfabric(bind_queues(link.endpoint, link.recv_queue,
+				link.transmit_queue), "bind_queues()");
+	check_libfabric(fi_ep_bind(link.endpoint, &link.event_queue->fid, 0),
+			"fi_ep_bind(), event_queue");
+	check_libfabric(fi_enable(link.endpoint), "fi_enable()");
+
+	link.pool = std::make_unique<BufferPool>(link.domain, LINK_SLAB_SIZE,
+			LINK_SLAB_COUNT);
+	link.control_send_slab = link.pool->acquire();
+	link.control_recv_slab = link.pool->acquire();
+}
+
+/* Connect to the peer, or wait for it to connect. */
+void open_link(bench_link& link, const link_options& options) {
+	link.active = options.dest_port != -1;
+	link.waiter = CompletionWaiter(options.poll ? wait_mode::POLL :
+			wait_mode::BLOCK);
+
+	fi_info* hints = fi_allocinfo();
+	hints->caps = FI_MSG | FI_SEND | FI_RECV;
+	hints->ep_attr->type = FI_EP_MSG;
+	hints->domain_attr->mr_mode = FI_MR_LOCAL | FI_MR_ALLOCATED |
+		FI_MR_PROV_KEY | FI_MR_VIRT_ADDR;
+	if (!options.provider.empty())
+		hints->fabric_attr->prov_name = strdup(options.provider.c_str());
+
+	fi_info* info = nullptr;
+	check_libfabric(fi_getinfo(FI_VERSION(1, 15), 0, 0, 0, hints, &info),
+			"fi_getinfo()");
+	fi_freeinfo(hints);
+	link.info.reset(info);
+
+	check_libfabric(fi_fabric(link.info->fabric_attr, link.fabric.out(),
+				nullptr), "fi_fabric()");
+
+	fi_eq_attr event_queue_attr = {
+		.size = 10,
+		.wait_obj = FI_WAIT_UNSPEC
+	};
+	check_libfabric(fi_eq_open(link.fabric, &event_queue_attr,
+				link.event_queue.out(), 0), "fi_eq_open()");
+
+	fi_eq_cm_entry entry = {};
+	if (link.active) {
+		open_endpoint(link, link.info.get());
+
+		sockaddr_in dest = {};
+		dest.sin_family = AF_INET;
+		dest.sin_port = htons(options.dest_port);
+		inet_aton(options.dest_addr.c_str(), &dest.sin_addr);
+		check_libfabric(fi_connect(link.endpoint, &dest, 0, 0),
+				"fi_connect()");
+		wait_event(link, FI_CONNECTED, entry);
+		return;
+	}
+
+	/* Listen, and take the first peer that asks. */
+	check_libfabric(fi_passive_ep(link.fabric, link.info.get(),
+				link.passive_endpoint.out(), nullptr), "fi_passive_ep()");
+	check_libfabric(fi_pep_bind(link.passive_endpoint, &link.event_queue->fid,
+				0), "fi_pep_bind()");
+	check_libfabric(fi_listen(link.passive_endpoint), "fi_listen()");
+
+	sockaddr_in addr = {};
+	size_t addr_length = sizeof(sockaddr_in);
+	check_libfabric(fi_getname(&link.passive_endpoint->fid, &addr,
+				&addr_length), "fi_getname()");
+	std::cerr << "Listening on " << inet_ntoa(addr.sin_addr) << ":" <<
+		ntohs(addr.sin_port) << " (" << link.info->fabric_attr->prov_name <<
+		")" << std::endl;
+
+	wait_event(link, FI_CONNREQ, entry);
+
+	/* From here on, the requestor's info describes the endpoint. */
+	link.info.reset(entry.info);
+	open_endpoint(link, link.info.get());
+
+	/* The peer sends its first control message as soon as it is connected,
+	 * so there has to be somewhere for it to go before then. */
+	post_control_recv(link);
+	check_libfabric(fi_accept(link.endpoint, 0, 0), "fi_accept()");
+	wait_event(link, FI_CONNECTED, entry);
+}
+
+/* Close everything the link opened. */
+void close_link(bench_link& link) {
+	if (link.endpoint)
+		fi_shutdown(link.endpoint, 0);
+
+	if (link.pool) {
+		link.pool->release(link.control_send_slab);
+		link.pool->release(link.control_recv_slab);
+	}
+
+	/* Everything else is closed as 'closing' goes out of scope, in the
+	 * reverse of the order the link declares it in. Assigning over the link
+	 * would close it in declaration order instead. */
+	bench_link closing = std::move(link);
+	link = bench_link();
+}
+
+/* Wait for 'count' completions on one of the link's queues. */
+void wait_completions(bench_link& link, fid_cq* queue, size_t count) {
+	fi_cq_data_entry entries[COMPLETIONS_PER_WAIT];
+	while (count > 0) {
+		ssize_t read = link.waiter.wait(queue, entries,
+				std::min(count, COMPLETIONS_PER_WAIT));
+		if (read == -FI_EAVAIL)
+			read = -check_cq_error(queue).err;
+		check_libfabric(read < 0 ? static_cast<int>(read) : 0,
+				"CompletionWaiter::wait()");
+		count -= static_cast<size_t>(read);
+	}
+}
+
+/* Post the receive the peer's next control message lands in. */
+void post_control_recv(bench_link& link) {
+	check_libfabric(fi_recv(link.endpoint, link.control_recv_slab->data,
+				sizeof(bench_control), link.control_recv_slab->desc, 0,
+				nullptr), "fi_recv(), control");
+}
+
+/* Wait for the peer's control message. */
+bench_control wait_control(bench_link& link) {
+	wait_completions(link, link.recv_queue, 1);
+
+	bench_control control;
+	std::memcpy(&control, link.control_recv_slab->data, sizeof(control));
+	return control;
+}
+
+/* Send a control message, and wait until it is out. */
+void send_control(bench_link& link, const bench_control& control) {
+	std::memcpy(link.control_send_slab->data, &control, sizeof(control));
+	if (post_send(link, link.control_send_slab, sizeof(control)))
+		wait_completions(link, link.transmit_queue, 1);
+}
+
+buffer_slab* acquire_slab(bench_link& link, size_t size) {
+	buffer_slab* slab = link.pool->acquire(size);
+	if (!slab)
+		check_libfabric(-FI_ENOMEM, "BufferPool::acquire(), bench");
+	return slab;
+}
+
+/* Inject what fits, and send the rest. */
+bool post_send(bench_link& link, buffer_slab* slab, size_t len) {
+	ssize_t ret = 0;
+	bool inject = len <= link.info->tx_attr->inject_size;
+	do {
+		ret = inject ?
+			fi_inject(link.endpoint, slab->data, len, 0) :
+			fi_send(link.endpoint, slab->data, len, slab->desc, 0, nullptr);
+	} while (ret == -FI_EAGAIN);
+	check_libfabric(static_cast<int>(ret), "post_send()");
+
+	return !inject;
+}
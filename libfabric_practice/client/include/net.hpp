@@ -13,9 +13,41 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include "rma.hpp"
+#include "rdm.hpp"
+
+#include <string>
 #include <vector>
 
+/* The small messages of the exchange, kept together in one registered slab.
+ * Buffers have to outlive the operations posted with them. */
+struct control_block {
+	float send_buffer = 678.90;
+	float recv_buffer = 0.0;
+	size_t send_msg_size = 0;
+	size_t recv_msg_size = 0;
+	rma_request request = {};
+	char address[MAX_ADDRESS_SIZE] = {}; /* Our name, in RDM mode. */
+};
+
+/* Knobs for the client, filled in from the command line. */
+struct client_options {
+	std::string dest_addr = "127.0.0.1";
+	int dest_port = -1;
+	bool ring = false; /* Receive into a ring of 'FI_MULTI_RECV' buffers. */
+	bool poll = false; /* Busy-poll the completion queues instead of blocking. */
+	bool rma = false; /* Write and read the arrays instead of sending them. */
+	bool rdm = false; /* Use a connectionless 'FI_EP_RDM' endpoint. */
+	bool scalable = false; /* Send to the receive context we are handed. */
+	bool tagged = false; /* Send frames and chunks as tagged streams. */
+	bool credits = false; /* Only send the chunks the server has room for. */
+	size_t rendezvous = 0; /* Read arrays at least this big, or 0 for none. */
+	size_t array_len = 70; /* Floats in the array sent to the server. */
+	size_t calls = 0; /* Calls to make instead of exchanging arrays. */
+	size_t depth = 32; /* Calls kept in flight at once. */
+};
+
 /* Initialize and use a libfabric client. */
-int client(const char* dest_addr, int dest_port);
+int client(const client_options& options);
 
 #endif /* NET_HPP */
@@ -6,35 +6,120 @@
 #include <cstdlib>
 
 int main(int argc, char* argv[]) {
-	std::string dest_addr = "127.0.0.1";
-	int dest_port = -1;
+	client_options options;
 
 	/* Parse CLI arguments. */
 	int opt = -1;
-	while ((opt = getopt(argc, argv, "a:p:")) != -1) {
+	while ((opt = getopt(argc, argv, "a:p:rRDSTFPV:n:c:d:")) != -1) {
 		switch (opt) {
 			case 'a':
-				dest_addr = optarg;
+				options.dest_addr = optarg;
 
 				break;
 			case 'p':
-				dest_port = std::atoi(optarg);
+				options.dest_port = std::atoi(optarg);
+
+				break;
+			case 'r':
+				options.ring = true;
+
+				break;
+			case 'R':
+				options.rma = true;
+
+				break;
+			case 'D':
+				options.rdm = true;
+
+				break;
+			case 'S':
+				options.scalable = true;
+
+				break;
+			case 'T':
+				options.tagged = true;
+
+				break;
+			case 'F':
+				options.credits = true;
+
+				break;
+			case 'P':
+				options.poll = true;
+
+				break;
+			case 'V':
+				options.rendezvous = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'n':
+				options.array_len = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'c':
+				options.calls = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'd':
+				options.depth = std::strtoull(optarg, nullptr, 10);
 
 				break;
 			default:
 				std::cerr << "Usage: " << argv[0] <<
-					" [-a DEST_ADDRESS] [-p PORT]" << std::endl;
+					" [-a DEST_ADDRESS] [-p PORT] [-r] [-R] [-D] [-S] [-T] [-F]"
+					" [-P] [-V BYTES] [-n ARRAY_LEN]"
+					" [-c CALLS] [-d DEPTH]" <<
+					std::endl;
 
 				return EXIT_FAILURE;
 		}
 	}
 
-	if (dest_port == -1) {
+	if (options.dest_port == -1) {
 		std::cerr << "[ERROR] Port number was never specified." << std::endl;
 		return EXIT_FAILURE;
 	}
 
-	client(dest_addr.c_str(), dest_port);
+	/* Tagged messages never match the untagged buffers of a ring, and the
+	 * server's RDM mode is built on one. */
+	if (options.tagged && (options.ring || options.rdm)) {
+		std::cerr << "[ERROR] -T can't be combined with -r or -D." <<
+			std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* Credit updates are a tagged stream of their own. */
+	if (options.credits && !options.tagged) {
+		std::cerr << "[ERROR] -F needs -T." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* Only an RDM server has a scalable endpoint. */
+	if (options.scalable && !options.rdm) {
+		std::cerr << "[ERROR] -S needs -D." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* RMA mode moves the arrays through windows already. */
+	if (options.rendezvous > 0 && options.rma) {
+		std::cerr << "[ERROR] -V can't be combined with -R." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* Responses land in a receive ring, and calls only go over a connection
+	 * of their own. */
+	if (options.calls > 0) {
+		if (options.rma || options.rdm || options.tagged ||
+				options.rendezvous > 0) {
+			std::cerr <<
+				"[ERROR] -c can't be combined with -R, -D, -T or -V." <<
+				std::endl;
+			return EXIT_FAILURE;
+		}
+		options.ring = true;
+	}
+
+	client(options);
 	
 	return EXIT_SUCCESS;
 }
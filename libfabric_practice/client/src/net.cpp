@@ -1,19 +1,477 @@
 #include "net.hpp"
 #include "err.hpp"
+#include "fid_owner.hpp"
 #include "debugger.hpp" /* Thanks again Riley! :D */
+#include "buffer_pool.hpp"
+#include "transfer.hpp"
+#include "credit.hpp"
+#include "frame.hpp"
+#include "typed_frame.hpp"
+#include "recv_ring.hpp"
+#include "progress.hpp"
+#include "rma.hpp"
+#include "rdm.hpp"
+#include "rpc.hpp"
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <vector>
+
+/* One slab for our values, one for each of the two frames we send, one for
+ * the frame buffer we receive into, one for each direction of the array, and
+ * one for the server's credit updates. Arrays too big for a slab get a
+ * registered buffer of their own from the same pool. Slabs are exactly one
+ * frame big. */
+static constexpr size_t SLAB_SIZE = FRAME_SIZE;
+static constexpr size_t SLAB_COUNT = 7;
+
+/* Take apart a frame that just landed, and make sure it is the one the
+ * server should have sent next. */
+static frame_view check_frame(const recv_view& message, uint32_t sequence,
+		frame_type type) {
+	frame_view frame;
+	if (!read_frame(message, frame)) {
+		std::cerr << "Frame of " << message.len << " bytes is too short." <<
+			std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+
+	const frame_header& header = frame.header;
+	if (header.sequence != sequence ||
+			header.type != static_cast<uint16_t>(type)) {
+		std::cerr << "Expected frame " << sequence << " of type " <<
+			static_cast<uint16_t>(type) << ", got frame " << header.sequence <<
+			" of type " << header.type << "." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+
+	return frame;
+}
+
+/* Whether the frame in 'message' is of 'type', without checking anything
+ * else about it. */
+static bool is_frame(const recv_view& message, frame_type type) {
+	frame_view frame;
+	return read_frame(message, frame) &&
+		frame.header.type == static_cast<uint16_t>(type);
+}
+
+/* Wait until 'frames' of the frames we posted are out. Injected frames never
+ * show up on the transmit queue, so they must not be counted. */
+static void wait_sent(CompletionWaiter& waiter, fid_cq* transmit_queue,
+		int frames) {
+	fi_cq_data_entry transmit_cq_entries[2] = {};
+	while (frames > 0) {
+		ssize_t read = waiter.wait(transmit_queue, transmit_cq_entries,
+				std::min(frames, 2));
+		if (read == -FI_EAVAIL)
+			read = -check_cq_error(transmit_queue).err;
+		check_libfabric(read < 0 ? read : 0,
+				"CompletionWaiter::wait(), transmit_queue");
+		frames -= static_cast<int>(read);
+	}
+}
+
+/* Wait until the next message from the server is in. With a receive ring,
+ * the view points into the ring and has to be handed back to it. Otherwise,
+ * it points into the frame buffer. Credit updates that land in the meantime
+ * go to 'credits'. */
+static recv_view wait_message(CompletionWaiter& waiter, fid_cq* recv_queue,
+		RecvRing* ring, buffer_slab* recv_frame_slab,
+		CreditLink* credits = nullptr) {
+	while (true) {
+		fi_cq_data_entry entry = {};
+		ssize_t read = waiter.wait(recv_queue, &entry, 1);
+		if (read == -FI_EAVAIL)
+			read = -check_cq_error(recv_queue).err;
+		check_libfabric(read < 0 ? read : 0,
+				"CompletionWaiter::wait(), recv_queue");
+
+		if (credits && credits->is_update(entry.op_context)) {
+			check_libfabric(credits->take_update(),
+					"CreditLink::take_update()");
+			continue;
+		}
+
+		recv_view view;
+		if (!ring) {
+			view.data = recv_frame_slab->data;
+			view.len = entry.len;
+			view.flags = entry.flags;
+			view.cq_data = entry.data;
+			return view;
+		}
+
+		/* Completions that only release a buffer carry no message. */
+		ssize_t ret = ring->handle(entry, view);
+		check_libfabric(ret < 0 ? ret : 0, "RecvRing::handle()");
+		if (ret > 0)
+			return view;
+	}
+}
+
+/* The server's array is big enough to go by rendezvous, and 'window' is on
+ * it. Whatever part of our own array didn't fit in its frame has to be sent
+ * by now: reads complete on the transmit queue too, where they can't be told
+ * apart from sends. Read the server's array straight into a buffer of ours,
+ * and let the server know with a 'RENDEZVOUS_FIN' frame. Returns the slab
+ * the server's array was read into. */
+static buffer_slab* pull_array(fid_ep* endpoint, const fi_info* info,
+		fid_cq* transmit_queue, CompletionWaiter& waiter, BufferPool& pool,
+		const transfer_config& config, const rma_window& window,
+		buffer_slab* fin_frame_slab, control_block& control) {
+	control.recv_msg_size = window.length / sizeof(float);
+	std::cout << std::endl << "Array size received: " <<
+		control.recv_msg_size << std::endl;
+	buffer_slab* recv_arr_slab = pool.acquire(window.length);
+	check_libfabric(recv_arr_slab ? 0 : -FI_ENOMEM,
+			"BufferPool::acquire(), array");
+
+	ChunkedTransfer read_arr(ChunkedTransfer::direction::READ, endpoint,
+			recv_arr_slab->data, window.length, recv_arr_slab->desc, config,
+			nullptr, window);
+	check_libfabric(run_transfers(&read_arr, transmit_queue, nullptr, nullptr,
+				&waiter), "run_transfers(), fi_read()");
+
+	ssize_t ret = send_typed<frame_type::RENDEZVOUS_FIN>(endpoint, info,
+			fin_frame_slab, 2, std::span<const char, 0>(), nullptr, 0, config);
+	check_libfabric(ret < 0 ? ret : 0, "send_typed(), fin");
+	wait_sent(waiter, transmit_queue, typed_frame_completes<char, 0>);
+
+	return recv_arr_slab;
+}
+
+/* Move the arrays through the windows in 'offer': write ours into the one
+ * the server opened for it, and read the server's out of the other, then let
+ * the server know with an 'RMA_DONE' frame. The server's CPU never touches
+ * either array. Returns the slab the server's array was read into. */
+static buffer_slab* exchange_rma(fid_ep* endpoint, const fi_info* info,
+		fid_cq* transmit_queue, CompletionWaiter& waiter, BufferPool& pool,
+		const transfer_config& config, const rma_offer& offer,
+		buffer_slab* send_arr_slab, size_t send_bytes,
+		buffer_slab* done_frame_slab, control_block& control) {
+	if (offer.write.length < send_bytes) {
+		std::cerr << "The server's window is " << offer.write.length <<
+			" bytes, the array is " << send_bytes << "." << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+
+	control.recv_msg_size = offer.read.length / sizeof(float);
+	std::cout << std::endl << "Array size received: " <<
+		control.recv_msg_size << std::endl;
+	buffer_slab* recv_arr_slab = pool.acquire(offer.read.length);
+	check_libfabric(recv_arr_slab ? 0 : -FI_ENOMEM,
+			"BufferPool::acquire(), array");
+
+	/* Reads and writes both complete on the transmit queue, where they can't
+	 * be told apart, so one runs after the other. Each is split up and kept
+	 * a window deep just like a send. */
+	ChunkedTransfer write_arr(ChunkedTransfer::direction::WRITE, endpoint,
+			send_arr_slab->data, send_bytes, send_arr_slab->desc, config,
+			nullptr, offer.write);
+	check_libfabric(run_transfers(&write_arr, transmit_queue, nullptr, nullptr,
+				&waiter), "run_transfers(), fi_write()");
+
+	ChunkedTransfer read_arr(ChunkedTransfer::direction::READ, endpoint,
+			recv_arr_slab->data, offer.read.length, recv_arr_slab->desc, config,
+			nullptr, offer.read);
+	check_libfabric(run_transfers(&read_arr, transmit_queue, nullptr, nullptr,
+				&waiter), "run_transfers(), fi_read()");
+
+	ssize_t ret = send_typed<frame_type::RMA_DONE>(endpoint, info,
+			done_frame_slab, 2, std::span<const char, 0>(), nullptr, 0, config);
+	check_libfabric(ret < 0 ? ret : 0, "send_typed(), done");
+	wait_sent(waiter, transmit_queue, typed_frame_completes<char, 0>);
+
+	return recv_arr_slab;
+}
+
+/* Every this many calls is a 'SLEEP', so a few calls take longer than the
+ * rest and get overtaken by the ones behind them. */
+static constexpr size_t SLEEP_EVERY = 16;
+static constexpr uint64_t SLEEP_US = 200;
+
+/* Floats in the arguments of every 'SUM' and 'ECHO' call. */
+static constexpr size_t CALL_FLOATS = 16;
+
+/* One call we made and haven't heard the last of. Its request is built in
+ * the call buffer of its slab, and stays there until both its send and its
+ * response are in, so an echo can be checked against it. */
+struct call_slot {
+	buffer_slab* slab = nullptr;
+	rpc_method method = rpc_method::ECHO;
+	size_t args_len = 0;
+	float expected = 0; /* The answer to a 'SUM'. */
+	bool sending = false; /* Its send hasn't completed yet. */
+	bool waiting = false; /* Its response isn't in yet. */
+	std::chrono::steady_clock::time_point start;
+};
+
+/* Write call number 'index' into the call buffer of 'call'. Returns how long
+ * the request is, 'rpc_header' included. */
+static size_t write_call(call_slot& call, uint64_t id, size_t index) {
+	char* request = call_buffer(call.slab);
+	char* args = request + sizeof(rpc_header);
+
+	if (index % SLEEP_EVERY == SLEEP_EVERY - 1) {
+		call.method = rpc_method::SLEEP;
+		std::memcpy(args, &SLEEP_US, sizeof(uint64_t));
+		call.args_len = sizeof(uint64_t);
+	} else {
+		call.method = index % 2 ? rpc_method::ECHO : rpc_method::SUM;
+		float values[CALL_FLOATS];
+		call.expected = 0;
+		for (size_t i = 0; i < CALL_FLOATS; i++) {
+			values[i] = static_cast<float>((index + i) % 100) / 4;
+			call.expected += values[i];
+		}
+		std::memcpy(args, values, sizeof(values));
+		call.args_len = sizeof(values);
+	}
+
+	rpc_header header = {};
+	header.correlation_id = id;
+	header.method = static_cast<uint32_t>(call.method);
+	std::memcpy(request, &header, sizeof(rpc_header));
+	return sizeof(rpc_header) + call.args_len;
+}
+
+/* Make sure a response says what 'call' should have been answered with. The
+ * server adds the floats up in the order we did, so the sums match exactly. */
+static bool check_response(const call_slot& call, const rpc_header& header,
+		const char* result, size_t result_len) {
+	if (header.status != 0 ||
+			header.method != static_cast<uint32_t>(call.method))
+		return false;
+
+	switch (call.method) {
+		case rpc_method::SUM: {
+			float sum = 0;
+			if (result_len != sizeof(float))
+				return false;
+			std::memcpy(&sum, result, sizeof(float));
+			return sum == call.expected;
+		}
+		case rpc_method::ECHO:
+			return result_len == call.args_len && std::memcmp(result,
+					call_buffer(call.slab) + sizeof(rpc_header),
+					result_len) == 0;
+		default:
+			return result_len == 0;
+	}
+}
+
+/* Make 'options.calls' calls, keeping up to 'options.depth' of them in
+ * flight. Each goes out as an 'RPC_REQUEST' frame as soon as there is a slot
+ * for it, without waiting on the ones before it, and the server answers them
+ * in whatever order its handlers finish in. Responses find their calls again
+ * by correlation id. */
+static void make_calls(fid_ep* endpoint, const fi_info* info,
+		fid_cq* transmit_queue, fid_cq* recv_queue, CompletionWaiter& waiter,
+		BufferPool& pool, RecvRing& ring, const transfer_config& config,
+		const client_options& options) {
+	using clock = std::chrono::steady_clock;
+
+	const size_t depth = std::max<size_t>(options.depth, 1);
+	std::vector<call_slot> slots(depth);
+	std::vector<call_slot*> free_slots;
+	for (call_slot& call : slots) {
+		call.slab = pool.acquire();
+		free_slots.push_back(&call);
+	}
+
+	/* Twice as many slots as calls in flight, so the slot of the next id is
+	 * hardly ever still held by a call that is lagging behind. */
+	InFlightTable table(2 * depth);
+	Histogram latency;
+
+	size_t made = 0;
+	size_t answered = 0;
+	size_t out_of_order = 0;
+	uint64_t highest_answered = 0;
+	uint32_t send_sequence = 0;
+	uint32_t recv_sequence = 0;
+	fi_cq_data_entry entries[16];
+
+	const clock::time_point begin = clock::now();
+	while (answered < options.calls || free_slots.size() < depth) {
+		bool progress = false;
+
+		/* Keep the pipeline full. */
+		while (made < options.calls && !free_slots.empty()) {
+			call_slot* call = free_slots.back();
+			uint64_t id = table.insert(call);
+			if (id == 0)
+				break;
+
+			size_t length = write_call(*call, id, made);
+			call->start = clock::now();
+			ssize_t ret = post_frame(endpoint, info, call->slab,
+					frame_type::RPC_REQUEST, send_sequence,
+					call_buffer(call->slab), length, call->slab->desc, call,
+					config);
+			if (ret == -FI_EAGAIN) {
+				table.remove(id);
+				break;
+			}
+			check_libfabric(ret < 0 ? ret : 0, "post_frame(), call");
+
+			free_slots.pop_back();
+			call->sending = !frame_fits_inject(info, length);
+			call->waiting = true;
+			send_sequence++;
+			made++;
+			progress = true;
+		}
+
+		/* A slot is only free again once its send is done too, since the
+		 * request might still be read out of it. */
+		ssize_t read = fi_cq_read(transmit_queue, entries, std::size(entries));
+		if (read == -FI_EAVAIL)
+			read = -check_cq_error(transmit_queue).err;
+		if (read != -FI_EAGAIN) {
+			check_libfabric(read < 0 ? read : 0,
+					"fi_cq_read(), transmit_queue");
+			for (ssize_t i = 0; i < read; i++) {
+				call_slot* call =
+					static_cast<call_slot*>(entries[i].op_context);
+				call->sending = false;
+				if (!call->waiting)
+					free_slots.push_back(call);
+			}
+			progress |= read > 0;
+		}
+
+		read = fi_cq_read(recv_queue, entries, std::size(entries));
+		if (read == -FI_EAVAIL)
+			read = -check_cq_error(recv_queue).err;
+		if (read != -FI_EAGAIN) {
+			check_libfabric(read < 0 ? read : 0, "fi_cq_read(), recv_queue");
+			for (ssize_t i = 0; i < read; i++) {
+				recv_view view;
+				ssize_t ret = ring.handle(entries[i], view);
+				check_libfabric(ret < 0 ? ret : 0, "RecvRing::handle()");
+				if (ret == 0)
+					continue;
+
+				const frame_view frame = check_frame(view, recv_sequence++,
+						frame_type::RPC_RESPONSE);
+				if (frame.in_frame != frame.header.length ||
+						frame.in_frame < sizeof(rpc_header)) {
+					std::cerr << "The response frame is " << view.len <<
+						" bytes." << std::endl;
+					std::exit(EXIT_FAILURE);
+				}
+
+				rpc_header header;
+				std::memcpy(&header, frame.payload, sizeof(rpc_header));
+				call_slot* call = static_cast<call_slot*>(
+						table.remove(header.correlation_id));
+				if (!call) {
+					std::cerr << "Call " << header.correlation_id <<
+						" was answered, but isn't in flight." << std::endl;
+					std::exit(EXIT_FAILURE);
+				}
+				if (!check_response(*call, header,
+							frame.payload + sizeof(rpc_header),
+							frame.in_frame - sizeof(rpc_header))) {
+					std::cerr << "Call " << header.correlation_id <<
+						" got the wrong answer." << std::endl;
+					std::exit(EXIT_FAILURE);
+				}
+
+				/* Anything answered after a later call was overtaken. */
+				if (header.correlation_id < highest_answered)
+					out_of_order++;
+				highest_answered = std::max(highest_answered,
+						header.correlation_id);
+				latency.record(std::chrono::duration_cast<
+						std::chrono::nanoseconds>(clock::now() -
+							call->start).count());
+
+				check_libfabric(ring.consume(view), "RecvRing::consume()");
+				call->waiting = false;
+				if (!call->sending)
+					free_slots.push_back(call);
+				answered++;
+			}
+			progress |= read > 0;
+		}
+
+		if (progress)
+			waiter.reset();
+		else
+			waiter.idle();
+	}
+
+	const double seconds = std::chrono::duration<double>(clock::now() -
+			begin).count();
+	std::cout << std::endl << options.calls << " calls, " << depth <<
+		" in flight, in " << seconds << " s (" << options.calls / seconds <<
+		" calls/s)" << std::endl;
+	std::cout << "Latency (ns): p50 " << latency.percentile(50) << ", p99 " <<
+		latency.percentile(99) << ", max " << latency.max() << std::endl;
+	std::cout << out_of_order << " calls were answered out of order." <<
+		std::endl;
+
+	for (call_slot& call : slots)
+		pool.release(call.slab);
+}
 
 /* Initialize and use a libfabric client. */
-int client(const char* dest_addr, int dest_port) {
+int client(const client_options& options) {
 	/* Create a structure that holds the libfabric config. that
 	 * is being requested. This structure will be used to request
 	 * an actual structure to begin making the network. */
 	fi_info* hints = fi_allocinfo();
 
-	/* Request the ability to use the send/recv form of message passing. */
+	/* Request the ability to use the send/recv form of message passing. A
+	 * receive ring needs multi-receive buffers on top of that. */
 	hints->caps = FI_SEND | FI_RECV;
+	if (options.ring)
+		hints->caps |= FI_MSG | FI_MULTI_RECV;
+
+	/* RMA mode reads and writes the server's memory on top of that. */
+	if (options.rma)
+		hints->caps |= FI_RMA | FI_READ | FI_WRITE;
+
+	/* In rendezvous mode, we and the server read each other's arrays. */
+	if (options.rendezvous > 0)
+		hints->caps |= FI_RMA | FI_READ | FI_REMOTE_READ;
+
+	/* In tagged mode, frames and the chunks of arrays are separate streams
+	 * of tagged messages instead. */
+	if (options.tagged)
+		hints->caps |= FI_TAGGED;
+
+	/* Request a connection-oriented endpoint (TCP), or in RDM mode, a
+	 * reliable connectionless one that reaches the server through an
+	 * address vector. */
+	hints->ep_attr->type = options.rdm ? FI_EP_RDM : FI_EP_MSG;
+
+	/* A connection keeps our messages in order, RDM only does if asked to.
+	 * The server copies them out in the order they land. */
+	if (options.rdm) {
+		hints->tx_attr->msg_order = FI_ORDER_SAS;
+		hints->rx_attr->msg_order = FI_ORDER_SAS;
+	}
 
-	/* Request a connection-oriented endpoint (TCP). */
-	hints->ep_attr->type = FI_EP_MSG;
+	/* A scalable server's addresses name one of its receive contexts. */
+	if (options.scalable)
+		hints->caps |= FI_NAMED_RX_CTX;
+
+	/* Let libfabric know we register our own buffers, so providers that need
+	 * local registration ('FI_MR_LOCAL') can be picked too. */
+	hints->domain_attr->mr_mode = FI_MR_LOCAL | FI_MR_ALLOCATED |
+		FI_MR_PROV_KEY | FI_MR_VIRT_ADDR;
+
+	/* Small typed frames are injected without asking the provider first. */
+	hints->tx_attr->inject_size = TYPED_INJECT_SIZE;
 
 	fi_info* info = nullptr;
 	check_libfabric(fi_getinfo(FI_VERSION(1, 15), 0, 0, 0, hints, &info),
@@ -23,12 +481,19 @@ int client(const char* dest_addr, int dest_port) {
 	 * free the 'hints' info structure. */
 	fi_freeinfo(hints);
 
+	/* The owners below are declared in the order things are opened in, so
+	 * they close them the other way around when they go out of scope: the
+	 * endpoint and the address vector first, then the pool's memory
+	 * regions, the completion queues, the domain, the event queue and the
+	 * fabric. Everything is opened on 'info', so it is freed last. */
+	InfoOwner info_owner(info);
+
 	/* Use the info gathered to create a libfabric network using the
 	 * available providers available to the OS. This represents
 	 * a collection of resources such as domains, event queues,
 	 * completion queues, endpoints, etc. */
-	fid_fabric* fabric = nullptr;
-	check_libfabric(fi_fabric(info->fabric_attr, &fabric, nullptr),
+	FidOwner<fid_fabric> fabric{"fabric"};
+	check_libfabric(fi_fabric(info->fabric_attr, fabric.out(), nullptr),
 			"fi_fabric()");
 
 	/* Set event queue attributes. An event queue stores the
@@ -41,225 +506,441 @@ int client(const char* dest_addr, int dest_port) {
 	};
 
 	/* Create the event queue using the settings structure. */
-	fid_eq* event_queue = nullptr;
-	check_libfabric(fi_eq_open(fabric, &event_queue_attr, &event_queue, 0),
-			"fi_eq_open()");
-
-	/* Configure attributes of the completion queue. */
-	fi_cq_attr completion_queue_attr = {
-		.flags = 0,
-
-		/* When completing operations, like 'fi_send' for instance, you
-		 * might poll the CQ to get a completion entry. This option ensures
-		 * that the returned info is the context pointer. */
-		.format = FI_CQ_FORMAT_CONTEXT,
-		.wait_obj = FI_WAIT_UNSPEC,
-		.signaling_vector = 0,
-		.wait_cond = FI_CQ_COND_NONE, /* No condition needs to be met. */
-		.wait_set = 0
-	};
+	FidOwner<fid_eq> event_queue{"event_queue"};
+	check_libfabric(fi_eq_open(fabric, &event_queue_attr, event_queue.out(),
+				0), "fi_eq_open()");
+
+	/* Either sleep in the completion queues while waiting on them, or spin
+	 * on them and back off. */
+	const wait_mode mode = options.poll ? wait_mode::POLL : wait_mode::BLOCK;
+	CompletionWaiter waiter(mode);
+
+	/* Configure attributes of the completion queue. Polled queues don't
+	 * need a wait object at all. */
+	fi_cq_attr completion_queue_attr = cq_attr(mode);
 
 	sockaddr_in dest = {};
 	dest.sin_family = AF_INET;
-	dest.sin_port = htons(dest_port);
-	inet_aton(dest_addr, &dest.sin_addr);
+	dest.sin_port = htons(options.dest_port);
+	inet_aton(options.dest_addr.c_str(), &dest.sin_addr);
 
 	/* Create a domain for endpoints to be created on top of. */
-	fid_domain* domain = nullptr;
-	check_libfabric(fi_domain(fabric, info, &domain, 0),
+	FidOwner<fid_domain> domain{"domain"};
+	check_libfabric(fi_domain(fabric, info, domain.out(), 0),
 			"fi_domain()");
 
+	/* Open a receiving and transmission completion queue. */
+	FidOwner<fid_cq> recv_queue{"recv_queue"};
+	FidOwner<fid_cq> transmit_queue{"transmit_queue"};
+	check_libfabric(fi_cq_open(domain, &completion_queue_attr,
+				recv_queue.out(), nullptr), "fi_cq_open(), recv_queue");
+	check_libfabric(fi_cq_open(domain, &completion_queue_attr,
+				transmit_queue.out(), nullptr), "fi_cq_open(), transmit_queue");
+
+	/* Register every buffer we are going to use up front, so nothing has to
+	 * be allocated or registered once the exchange starts. */
+	uint64_t access = FI_SEND | FI_RECV;
+	if (options.rma)
+		access |= FI_READ | FI_WRITE;
+	if (options.rendezvous > 0)
+		access |= FI_READ;
+	auto pool = std::make_unique<BufferPool>(domain, SLAB_SIZE, SLAB_COUNT,
+			access);
+	buffer_slab* control_slab = pool->acquire();
+	control_block* control = new (control_slab->data) control_block;
+	control->send_msg_size = options.array_len;
+	buffer_slab* scalar_frame_slab = pool->acquire();
+	buffer_slab* array_frame_slab = pool->acquire();
+
+	/* Every send reports a completion unless it says otherwise. Injected
+	 * frames are the exception, see the transmit queue's binding below. */
+	info->tx_attr->op_flags |= FI_COMPLETION;
+
+	/* A write only completes once it is in the server's memory, so the
+	 * 'RMA_DONE' frame that follows can't get there before the array does. */
+	if (options.rma)
+		info->tx_attr->op_flags |= FI_DELIVERY_COMPLETE;
+
 	/* Create an endpoint that is responsible for initiating
 	 * communication. */
-	fid_ep* endpoint = nullptr;
-	check_libfabric(fi_endpoint(domain, info, &endpoint, nullptr),
+	FidOwner<fid_av> av{"av"};
+	FidOwner<fid_ep> endpoint{"endpoint"};
+	check_libfabric(fi_endpoint(domain, info, endpoint.out(), nullptr),
 			"fi_endpoint()");
 
 	Debugger debug;
 	debug.print_info(info);
 
-	/* Open a receiving and transmission completion queue. */
-	fid_cq* transmit_queue = nullptr;
-	fid_cq* recv_queue = nullptr;
-	check_libfabric(fi_cq_open(domain, &completion_queue_attr,
-				&recv_queue, nullptr), "fi_cq_open(), recv_queue");
-	check_libfabric(fi_cq_open(domain, &completion_queue_attr, &transmit_queue,
-				nullptr), "fi_cq_open(), transmit_queue");
+	/* Both sides size their frames and split the arrays the same way, since
+	 * they work it out from the same provider limits. Whatever the server
+	 * sends lands either in a ring big enough for its largest message, or
+	 * one at a time in a frame buffer. */
+	transfer_config config = make_transfer_config(info);
+	config.tagged = options.tagged;
+	std::unique_ptr<RecvRing> ring;
+	buffer_slab* recv_frame_slab = nullptr;
+	if (options.ring) {
+		ring = std::make_unique<RecvRing>(*pool,
+				std::max(FRAME_SIZE, config.chunk_size));
+		check_libfabric(ring->configure(endpoint),
+				"fi_setopt(), FI_OPT_MIN_MULTI_RECV");
+	} else {
+		recv_frame_slab = pool->acquire();
+	}
 
 	/* Bind and endpoint to both of the new completion queues. */
-	check_libfabric(fi_ep_bind(endpoint, &(recv_queue->fid), FI_RECV),
-			"fi_ep_bind(), recv_queue");
-	check_libfabric(fi_ep_bind(endpoint, &(transmit_queue->fid), FI_TRANSMIT),
-			"fi_ep_bind(), transmit_queue");
-
-	/* Bind the endpoint to the event queue and enable it. */
-	check_libfabric(fi_ep_bind(endpoint, &event_queue->fid, 0),
-			"fi_ep_bind(), event_queue");
+	check_libfabric(bind_queues(endpoint, recv_queue, transmit_queue),
+			"bind_queues()");
+
+	/* Bind the endpoint to the event queue and enable it. Without a
+	 * connection there are no events, but there is an address vector to
+	 * find the server in. */
+	if (options.rdm) {
+		check_libfabric(open_address_vector(domain, endpoint, av.out(),
+					options.scalable ? RX_CONTEXT_BITS : 0),
+				"open_address_vector()");
+	} else {
+		check_libfabric(fi_ep_bind(endpoint, &event_queue->fid, 0),
+				"fi_ep_bind(), event_queue");
+	}
 	check_libfabric(fi_enable(endpoint), "fi_enable()");
 
 	/* Communication is asynchronous for the most part in libfabric, so the
 	 * provider only completes the operation when the matching work on
-	 * the other size actually exists. */
-	float recv_buffer = 0.0;
-	check_libfabric(fi_recv(endpoint, &recv_buffer, sizeof(float), 0, 0, 0),
-			"fi_recv()");
-
-	/* Send the server the connection request. */
-	check_libfabric(fi_connect(endpoint, &dest, 0, 0), "fi_connect()");
-
-	/* Use the active endpoint to post a "FI_CONNECTED" event into the
-	 * event queue. */
-	fi_eq_entry event = {};
-	uint32_t event_type;
-	do {
-		int return_code = fi_eq_sread(event_queue, &event_type, &event,
-				sizeof(fi_eq_entry), -1, 0);
-		if (return_code < 0) {
-			if (-FI_EAVAIL == return_code) {
-				check_eq_error(event_queue);
-			} else {
-				std::fprintf(stderr,
-						"fi_eq_sread(), FI_CONNECTED: %s\n",
-						fi_strerror(-return_code));
+	 * the other size actually exists. The server's frames land in this one
+	 * frame buffer, one at a time, or all of them in the ring. */
+	if (ring)
+		check_libfabric(ring->post(endpoint, 0), "RecvRing::post()");
+	else
+		check_libfabric(post_frame_recv(endpoint, info, recv_frame_slab, 0,
+					config), "post_frame_recv()");
+
+	/* With flow control, the server's credit updates land in a slab of their
+	 * own, and the receive for them stays up until we are done. */
+	buffer_slab* credit_slab = nullptr;
+	std::unique_ptr<CreditLink> credits;
+	if (options.credits) {
+		credit_slab = pool->acquire();
+		credits = std::make_unique<CreditLink>(endpoint, info, credit_slab,
+				config);
+		check_libfabric(credits->post(), "CreditLink::post()");
+	}
+
+	recv_view message;
+	if (options.rdm) {
+		/* There is nothing to connect to. The server goes in the address
+		 * vector, and everything we send goes to it. */
+		check_libfabric(insert_service(av, options.dest_addr,
+					options.dest_port, &config.dest_addr), "insert_service()");
+
+		/* The server only knows who a message is from once it has our
+		 * address, so that goes first, in a 'HELLO' frame. Its float is the
+		 * answer, and until that is in, anything else we sent might not be
+		 * told apart from a stranger's. */
+		size_t address_len = sizeof(control->address);
+		check_libfabric(fi_getname(&endpoint->fid, control->address,
+					&address_len), "fi_getname()");
+		ssize_t ret = post_frame(endpoint, info, scalar_frame_slab,
+				frame_type::HELLO, 0, control->address, address_len,
+				control_slab->desc, 0, config);
+		check_libfabric(ret < 0 ? ret : 0, "post_frame(), hello");
+		wait_sent(waiter, transmit_queue,
+				!frame_fits_inject(info, address_len));
+
+		message = wait_message(waiter, recv_queue, ring.get(),
+				recv_frame_slab, credits.get());
+
+		/* A scalable server hands us to one of its workers, which tells us
+		 * which of its receive contexts to send to from now on, before it
+		 * sends its float. */
+		if (options.scalable) {
+			const frame_view welcome = check_frame(message, 0,
+					frame_type::WELCOME);
+			uint32_t rx_index = 0;
+			if (!read_value(welcome, rx_index)) {
+				std::cerr << "The welcome frame is " << message.len <<
+					" bytes." << std::endl;
+				std::exit(EXIT_FAILURE);
 			}
+			config.dest_addr = fi_rx_addr(config.dest_addr,
+					static_cast<int>(rx_index), RX_CONTEXT_BITS);
+
+			if (ring)
+				check_libfabric(ring->consume(message),
+						"RecvRing::consume()");
+			else
+				check_libfabric(post_frame_recv(endpoint, info,
+							recv_frame_slab, 0, config), "post_frame_recv()");
+			message = wait_message(waiter, recv_queue, ring.get(),
+					recv_frame_slab, credits.get());
 		}
-	} while (event_type != FI_CONNECTED);
-
-	/* Post a send buffer and send it to the now-connected server. This is an
-	 * asynchronous call. We are just sending a floating point number here. */
-	float send_buffer = 678.90;
-	check_libfabric(fi_send(endpoint, &send_buffer, sizeof(float), 0, 0, 0),
-			"fi_send()");
-
-	/* We read the transmission completion queue, and it will let us know when
-	 * the message has been transmitted. This essentially turns an asynchronous
-	 * call and make it synchronous. */
-	struct fi_cq_data_entry transmit_cq_entry = {};
-	int read = -1;
-	do {
-		read = fi_cq_sread(transmit_queue, &transmit_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-	/* check_libfabric(read); */
-
-	/* We read the receiving completion queue, and it will let us know when
-	 * a message has been received. We have posted a receive buffer already. */
-	struct fi_cq_data_entry recv_cq_entry = {};
-	do {
-		read = fi_cq_sread(recv_queue, &recv_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	std::cout << std::endl << "Data received: " << recv_buffer << std::endl;
-
-	/* A little more practice. We are gonna send and receive a couple
-	 * arrays. */
-	size_t send_msg_size = 70;
-	check_libfabric(fi_send(endpoint, &send_msg_size, sizeof(size_t), 0, 0, 0),
-			"fi_send(), array_size");
-	do {
-		read = fi_cq_sread(transmit_queue, &transmit_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	size_t recv_msg_size = 0;
-	check_libfabric(fi_recv(endpoint, &recv_msg_size, sizeof(size_t), 0, 0, 0),
-			"fi_recv(), array_size");
-	do {
-		read = fi_cq_sread(recv_queue, &recv_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	std::cout << std::endl << "Array size received: " << recv_msg_size <<
-		std::endl;
+	} else {
+		/* Send the server the connection request. */
+		check_libfabric(fi_connect(endpoint, &dest, 0, 0), "fi_connect()");
+
+		/* Use the active endpoint to post a "FI_CONNECTED" event into the
+		 * event queue. A server with a shared receive context can't tell
+		 * whose a message is by where it lands, so its acceptance carries a
+		 * token for us to mark every message with, right behind the entry. */
+		alignas(fi_eq_cm_entry) uint8_t event[sizeof(fi_eq_cm_entry) +
+			sizeof(uint64_t)] = {};
+		uint32_t event_type;
+		ssize_t return_code = 0;
+		do {
+			return_code = fi_eq_sread(event_queue, &event_type, event,
+					sizeof(event), -1, 0);
+			if (return_code < 0) {
+				if (-FI_EAVAIL == return_code) {
+					check_eq_error(event_queue);
+				} else {
+					std::fprintf(stderr,
+							"fi_eq_sread(), FI_CONNECTED: %s\n",
+							fi_strerror(-return_code));
+				}
+			}
+		} while (return_code < 0 || event_type != FI_CONNECTED);
 
-	std::vector<float> send_arr_buf(70);
-	std::fill(send_arr_buf.begin(), send_arr_buf.end(), 35.6);
-
-	/* Array's can't always be sent in one go, so we are going to keep sending
-	 * it until it is all sent, indicated by tracking the remaining client. */
-	ssize_t total_arr_size = send_arr_buf.size() * sizeof(float);
-	size_t remaining_send = total_arr_size;
-	ssize_t sent = 0;
-	ssize_t total_sent = 0;
-	char* current_buf = reinterpret_cast<char*>(send_arr_buf.data());
-	while (total_sent < total_arr_size) {
-		/* So, fi_send() will return zero if the whole buffer was able to be
-		 * sent. If it was a partial send though, it will return the amount of
-		 * bytes sent. So we want to advance the buffer by the amount of bytes
-		 * sent so we can track what to send next. A char* data type is the
-		 * smallest one we can use, as it has just a size of 1 byte. We will 
-		 * use this to track our buffer. */
-		sent = fi_send(endpoint, current_buf, remaining_send, 0, 0, 0);
-
-		if (sent > 0) {
-			total_sent += sent;
-			remaining_send -= sent;
-			current_buf += sent;
-		} else if (sent == 0) {
-			total_sent += remaining_send;
-			remaining_send = 0;
-		} else if (sent == -FI_EAGAIN) {
-			/* We will check the value 'read' after the loop finished. */
-			read = fi_cq_sread(transmit_queue, &transmit_cq_entry, 1, 0, -1);
-		} else if (sent < 0) {
-			break;
-		}
+		if (static_cast<size_t>(return_code) >= sizeof(event))
+			std::memcpy(&config.source,
+					reinterpret_cast<fi_eq_cm_entry*>(event)->data,
+					sizeof(uint64_t));
 	}
 
-	/* Poll one last time to make sure the sending is complete. */
-	do {
-		read = fi_cq_sread(transmit_queue, &transmit_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	const size_t expected_buf_size = recv_msg_size;
-	const size_t expected_buf_bytes = expected_buf_size * sizeof(float);
-	std::vector<float> recv_arr_buf(expected_buf_size);
-
-	current_buf = reinterpret_cast<char*>(recv_arr_buf.data());
-	size_t remaining_recv = expected_buf_bytes;
-	size_t recv = 0;
-	size_t total_recv = 0;
-	while (total_recv < expected_buf_bytes) {
-		recv = fi_recv(endpoint, current_buf, remaining_recv, 0, 0, 0);
-
-		if (recv > 0) {
-			total_recv += recv;
-			remaining_recv -= recv;
-			current_buf += recv;
-		} else if (recv == -FI_EAGAIN) {
-			read = fi_cq_sread(recv_queue, &recv_cq_entry, 1, 0, -1);
-		} else if (recv < 0) {
-			break;
+	buffer_slab* send_arr_slab = nullptr;
+	buffer_slab* recv_arr_slab = nullptr;
+	if (options.calls > 0) {
+		make_calls(endpoint, info, transmit_queue, recv_queue, waiter, *pool,
+				*ring, config, options);
+	} else {
+		/* Every frame carries a header with the length of its payload, so
+		 * there is no need to trade array sizes before the arrays themselves.
+		 * Our float and our array go out as one frame each, right away,
+		 * without waiting on the server. These are asynchronous calls. */
+		const size_t send_bytes = control->send_msg_size * sizeof(float);
+		send_arr_slab = pool->acquire(send_bytes);
+		check_libfabric(send_arr_slab ? 0 : -FI_ENOMEM,
+				"BufferPool::acquire(), array");
+
+		/* Fill the array in place, so it never has to be copied. */
+		float* send_arr_buf = reinterpret_cast<float*>(send_arr_slab->data);
+		std::fill(send_arr_buf, send_arr_buf + control->send_msg_size, 35.6);
+
+		ssize_t ret = send_value<frame_type::SCALAR>(endpoint,
+				scalar_frame_slab, 0, control->send_buffer, 0, config);
+		check_libfabric(ret < 0 ? ret : 0, "send_value(), float");
+
+		/* In RMA mode, the array frame is only a request for somewhere to
+		 * write the array to. An array big enough to go by rendezvous is
+		 * registered on its own, and the frame is only a window on it, for
+		 * the server to read it out of. */
+		bool second_completes = false;
+		fid_mr* send_arr_mr = nullptr;
+		if (options.rma) {
+			control->request.length = send_bytes;
+			second_completes = typed_frame_completes<rma_request>;
+			ret = send_value<frame_type::RMA_REQUEST>(endpoint,
+					array_frame_slab, 1, control->request, 0, config);
+		} else if (options.rendezvous > 0 && send_bytes >= options.rendezvous) {
+			check_libfabric(expose_region(domain, send_arr_slab->data,
+						send_bytes, FI_REMOTE_READ, &send_arr_mr),
+					"fi_mr_reg(), send_arr_mr");
+			second_completes = typed_frame_completes<rma_window>;
+			ret = send_value<frame_type::RENDEZVOUS>(endpoint,
+					array_frame_slab, 1, describe_region(info, send_arr_mr,
+						send_arr_slab->data, send_bytes), 0, config);
+		} else {
+			second_completes = !frame_fits_inject(info, send_bytes);
+			ret = send_typed<frame_type::ARRAY>(endpoint, info,
+					array_frame_slab, 1, std::span<const float>(send_arr_buf,
+						control->send_msg_size), send_arr_slab->desc, 0,
+					config);
 		}
+		check_libfabric(ret < 0 ? ret : 0, "send_typed(), array");
+
+		/* Nothing of an array the server reads is left to send. */
+		const size_t send_inline = send_arr_mr ?
+			send_bytes : static_cast<size_t>(ret);
+
+		/* We read the transmission completion queue, and it will let us know
+		 * when the frames have been transmitted. This essentially turns an
+		 * asynchronous call and make it synchronous. Injected frames never
+		 * show up there, so only the others are waited on. */
+		wait_sent(waiter, transmit_queue,
+				typed_frame_completes<float> + second_completes);
+
+		/* We read the receiving completion queue, and it will let us know when
+		 * a frame has been received. We have posted a frame buffer already. In
+		 * RDM mode, the float is in already. */
+		if (!options.rdm)
+			message = wait_message(waiter, recv_queue, ring.get(),
+					recv_frame_slab, credits.get());
+		const frame_view scalar = check_frame(message, 0, frame_type::SCALAR);
+		if (!read_value(scalar, control->recv_buffer)) {
+			std::cerr << "The float frame is " << message.len << " bytes." <<
+				std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+		std::cout << std::endl << "Data received: " << control->recv_buffer <<
+			std::endl;
+
+		/* The array frame is next, so the frame buffer goes right back up. The
+		 * ring only needs the float's view back. */
+		if (ring)
+			check_libfabric(ring->consume(message), "RecvRing::consume()");
+		else
+			check_libfabric(post_frame_recv(endpoint, info, recv_frame_slab, 0,
+						config), "post_frame_recv()");
+
+		message = wait_message(waiter, recv_queue, ring.get(),
+				recv_frame_slab, credits.get());
+		if (options.rma) {
+			/* We asked for a window instead of sending an array frame, and the
+			 * server answered with one to write to and one to read from. */
+			const frame_view windows = check_frame(message, 1,
+					frame_type::RMA_WINDOWS);
+			rma_offer offer;
+			if (!read_value(windows, offer)) {
+				std::cerr << "The window frame is " << message.len <<
+					" bytes." << std::endl;
+				std::exit(EXIT_FAILURE);
+			}
+			if (ring)
+				check_libfabric(ring->consume(message), "RecvRing::consume()");
+
+			recv_arr_slab = exchange_rma(endpoint, info, transmit_queue, waiter,
+					*pool, config, offer, send_arr_slab, send_bytes,
+					array_frame_slab, *control);
+		} else if (options.rendezvous > 0 &&
+				is_frame(message, frame_type::RENDEZVOUS)) {
+			/* The server's array is only a window on it, for us to read. */
+			const frame_view announce = check_frame(message, 1,
+					frame_type::RENDEZVOUS);
+			rma_window window;
+			if (!read_value(announce, window)) {
+				std::cerr << "The rendezvous frame is " << message.len <<
+					" bytes." << std::endl;
+				std::exit(EXIT_FAILURE);
+			}
+			if (ring)
+				check_libfabric(ring->consume(message), "RecvRing::consume()");
+
+			ChunkedTransfer send_rest(ChunkedTransfer::direction::SEND,
+					endpoint, send_arr_slab->data + send_inline,
+					send_bytes - send_inline, send_arr_slab->desc, config);
+			send_rest.use_credits(credits.get());
+			check_libfabric(run_transfers(&send_rest, transmit_queue, nullptr,
+						recv_queue, &waiter, credits.get()),
+					"run_transfers(), array");
+			recv_arr_slab = pull_array(endpoint, info, transmit_queue, waiter,
+					*pool, config, window, array_frame_slab, *control);
+		} else {
+			const frame_view array = check_frame(message, 1, frame_type::ARRAY);
+			control->recv_msg_size = array.header.length / sizeof(float);
+			std::cout << std::endl << "Array size received: " <<
+				control->recv_msg_size << std::endl;
+
+			/* The server's array gets a registered buffer big enough for all of
+			 * it, starting with what came along in the frame. */
+			const size_t expected_buf_bytes = array.header.length;
+			const size_t recv_inline = array.in_frame;
+			recv_arr_slab = pool->acquire(expected_buf_bytes);
+			check_libfabric(recv_arr_slab ? 0 : -FI_ENOMEM,
+					"BufferPool::acquire(), array");
+			std::memcpy(recv_arr_slab->data, array.payload, recv_inline);
+			if (ring)
+				check_libfabric(ring->consume(message), "RecvRing::consume()");
+
+			/* Arrays can't always be sent in one go. Whatever didn't fit in
+			 * the frames follows right behind them. 'fi_send()' never sends
+			 * part of a buffer, so the rest is split into chunks no bigger
+			 * than the provider's 'max_msg_size', and a window of them is kept
+			 * in flight. The server does the same with its array, and our
+			 * receives for its chunks are posted right into the array at the
+			 * offsets they belong at, so the array is reassembled as the
+			 * chunks land. Both directions run at the same time. */
+			ChunkedTransfer send_arr(ChunkedTransfer::direction::SEND, endpoint,
+					send_arr_slab->data + send_inline, send_bytes - send_inline,
+					send_arr_slab->desc, config);
+			if (ring) {
+				/* With a ring, the server's chunks land in the ring in the
+				 * order they were sent, and are copied over to the array from
+				 * there. Our own chunks go out in the meantime. */
+				check_libfabric(send_arr.post(),
+						"ChunkedTransfer::post(), array");
+				for (size_t filled = recv_inline; filled < expected_buf_bytes;
+						) {
+					message = wait_message(waiter, recv_queue, ring.get(),
+							nullptr);
+					if (message.len > expected_buf_bytes - filled) {
+						std::cerr << "Unexpected message of " << message.len <<
+							" bytes." << std::endl;
+						std::exit(EXIT_FAILURE);
+					}
+					std::memcpy(recv_arr_slab->data + filled, message.data,
+							message.len);
+					filled += message.len;
+					check_libfabric(ring->consume(message),
+							"RecvRing::consume()");
+				}
+				check_libfabric(run_transfers(&send_arr, transmit_queue,
+							nullptr, nullptr, &waiter),
+						"run_transfers(), array");
+			} else {
+				ChunkedTransfer recv_arr(ChunkedTransfer::direction::RECV,
+						endpoint, recv_arr_slab->data + recv_inline,
+						expected_buf_bytes - recv_inline, recv_arr_slab->desc,
+						config);
+				send_arr.use_credits(credits.get());
+				recv_arr.use_credits(credits.get());
+				check_libfabric(run_transfers(&send_arr, transmit_queue,
+							&recv_arr, recv_queue, &waiter, credits.get()),
+						"run_transfers(), array");
+			}
+		}
+
+		/* The server reads our array on its own time, and says when it is
+		 * done. Until then, the array has to stay put. */
+		if (send_arr_mr) {
+			if (!ring)
+				check_libfabric(post_frame_recv(endpoint, info,
+							recv_frame_slab, 0, config), "post_frame_recv()");
+			message = wait_message(waiter, recv_queue, ring.get(),
+					recv_frame_slab, credits.get());
+			check_frame(message, 2, frame_type::RENDEZVOUS_FIN);
+			if (ring)
+				check_libfabric(ring->consume(message), "RecvRing::consume()");
+			check_libfabric(fi_close(&send_arr_mr->fid),
+					"fi_close(), send_arr_mr");
+		}
+
+		const size_t expected_buf_size = control->recv_msg_size;
+		const float* recv_arr_buf =
+			reinterpret_cast<float*>(recv_arr_slab->data);
+
+		std::cout << "Array: ";
+		for (size_t i = 0; i < expected_buf_size; i++)
+			std::cout << recv_arr_buf[i] << " ";
+		std::cout << std::endl;
 	}
 
-	/* Poll one last time to make sure the recv is complete. */
-	do {
-		read = fi_cq_sread(recv_queue, &recv_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	std::cout << "Array: ";
-	for (auto i : recv_arr_buf)
-		std::cout << i << " ";
-	std::cout << std::endl;
-
-	/* Endpoints must be closed before any objects bound to them can be. */
-	check_libfabric(fi_close(&endpoint->fid),
-			"fi_close(), endpoint");
-
-	/* Objects inside a domain have to be closed before the domain can. */
-	check_libfabric(fi_close(&recv_queue->fid), "fi_close(), recv_queue");
-	check_libfabric(fi_close(&transmit_queue->fid),
-			"fi_close(), transmit_queue");
-
-	/* The domain and the event queue must be closed. The passive endpoint
-	 * is closed by it's own server-side. */
-	check_libfabric(fi_close(&domain->fid), "fi_close(), domain");
-	check_libfabric(fi_close(&event_queue->fid),
-			"fi_close(), event_queue");
-
-	/* Now close the fabric network. */
-	check_libfabric(fi_close(&fabric->fid), "fi_close(), fabric");
-
-	/* Free the fabric info structure last. */
-	fi_freeinfo(info);
-	
+	if (options.poll)
+		waiter.report(std::cout);
+
+	/* Endpoints must be closed before any objects bound to them can be, and
+	 * the ring and the credit link are done with the pool once it is. */
+	endpoint.reset();
+	pool->release(control_slab);
+	pool->release(scalar_frame_slab);
+	pool->release(array_frame_slab);
+	pool->release(recv_frame_slab);
+	pool->release(send_arr_slab);
+	pool->release(recv_arr_slab);
+	pool->release(credit_slab);
+	credits.reset();
+	ring.reset();
+
+	/* Everything else is closed by its owner, in the reverse of the order
+	 * it was opened in. The passive endpoint is closed by it's own
+	 * server-side. */
 	return 0;
 }
@@ -0,0 +1,214 @@
+#ifndef ASYNC_HPP
+#define ASYNC_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_rma.h>
+#include <rdma/fi_eq.h>
+
+#include "progress.hpp"
+#include "rma.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <sys/types.h>
+#include <vector>
+
+class CqScheduler;
+
+/* A coroutine run by a 'CqScheduler'. It starts suspended, and runs once it
+ * is handed to 'CqScheduler::spawn()'. Nothing is returned out of it, and
+ * nothing may be thrown out of it either. */
+class Task {
+public:
+	struct promise_type {
+		Task get_return_object() {
+			return Task(std::coroutine_handle<promise_type>::from_promise(
+						*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+
+	Task(Task&& other) noexcept;
+	Task& operator=(Task&& other) noexcept;
+	~Task();
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	bool done() const { return !coroutine || coroutine.done(); }
+
+private:
+	friend class CqScheduler;
+	explicit Task(std::coroutine_handle<promise_type> coroutine) :
+		coroutine(coroutine) {}
+
+	std::coroutine_handle<promise_type> coroutine;
+};
+
+/* One operation a coroutine waits on with 'co_await'. It is posted when the
+ * coroutine suspends on it, with its own address as the operation's context,
+ * and the coroutine resumes once the scheduler reads its completion. That
+ * makes it the only thing that has to outlive the operation, and since it
+ * lives in the suspended coroutine's frame, it does.
+ *
+ * 'co_await' hands back how many bytes moved ('len' of the completion for
+ * receives, the requested length otherwise), or a negative libfabric error
+ * code if the operation couldn't be posted or failed. */
+class AsyncOp {
+public:
+	virtual ~AsyncOp() = default;
+
+	AsyncOp(const AsyncOp&) = delete;
+	AsyncOp& operator=(const AsyncOp&) = delete;
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> coroutine);
+	ssize_t await_resume() const noexcept { return result; }
+
+	/* The completion, once the operation is done. */
+	const fi_cq_data_entry& completion() const { return entry; }
+
+protected:
+	/* 'transmit' says which of the scheduler's queues it completes on. */
+	AsyncOp(CqScheduler& scheduler, bool transmit, size_t len) :
+		scheduler(scheduler),
+		transmit(transmit),
+		len(len) {}
+
+	size_t length() const { return len; }
+
+	/* Post the operation with 'this' as its context. Returns 0 if a
+	 * completion is coming, a positive number if it is done already (an
+	 * injected send), or a negative libfabric error code. '-FI_EAGAIN' gets
+	 * it posted again later. */
+	virtual ssize_t post() = 0;
+
+private:
+	friend class CqScheduler;
+
+	CqScheduler& scheduler;
+	bool transmit;
+	size_t len;
+	std::coroutine_handle<> waiting;
+	ssize_t result = 0;
+	fi_cq_data_entry entry = {};
+};
+
+/* 'fi_send()' of a registered buffer, or 'fi_inject()' if it fits and
+ * 'inject' allows it. An injected send is done as soon as it is taken. */
+class AsyncSend : public AsyncOp {
+public:
+	AsyncSend(CqScheduler& scheduler, fid_ep* endpoint, const void* buf,
+			size_t len, void* desc, bool inject = false,
+			fi_addr_t dest_addr = FI_ADDR_UNSPEC);
+
+private:
+	ssize_t post() override;
+
+	fid_ep* endpoint;
+	const void* buf;
+	void* desc;
+	bool inject;
+	fi_addr_t dest_addr;
+};
+
+/* 'fi_recv()' into a registered buffer. */
+class AsyncRecv : public AsyncOp {
+public:
+	AsyncRecv(CqScheduler& scheduler, fid_ep* endpoint, void* buf, size_t len,
+			void* desc, fi_addr_t src_addr = FI_ADDR_UNSPEC);
+
+private:
+	ssize_t post() override;
+
+	fid_ep* endpoint;
+	void* buf;
+	void* desc;
+	fi_addr_t src_addr;
+};
+
+/* 'fi_write()' or 'fi_read()' of a registered buffer to or from 'offset'
+ * bytes into a peer's window. Both complete on the transmit queue. */
+class AsyncRma : public AsyncOp {
+public:
+	enum class direction { WRITE, READ };
+
+	AsyncRma(CqScheduler& scheduler, direction dir, fid_ep* endpoint,
+			void* buf, size_t len, void* desc, const rma_window& remote,
+			uint64_t offset = 0, fi_addr_t dest_addr = FI_ADDR_UNSPEC);
+
+private:
+	ssize_t post() override;
+
+	direction dir;
+	fid_ep* endpoint;
+	void* buf;
+	void* desc;
+	rma_window remote;
+	uint64_t offset;
+	fi_addr_t dest_addr;
+};
+
+/* Runs coroutines over one endpoint's transmit and receive queues. Each
+ * pass posts whatever couldn't be posted before, in the order it was
+ * awaited in, reads both queues, and resumes the coroutine of every
+ * operation that completed, right there on the thread that called 'run()'.
+ * One thread can keep as many operations in flight as the provider's queues
+ * take, each one written as if it blocked.
+ *
+ * The scheduler never reads more completions off of a queue than it has
+ * operations in flight on it. Operations posted behind them by anyone else
+ * leave their completions on the queue, as long as it completes in order,
+ * which the receives of a connected endpoint do.
+ *
+ * Both queues have to be opened with 'FI_CQ_FORMAT_DATA'. The scheduler
+ * isn't thread-safe. */
+class CqScheduler {
+public:
+	CqScheduler(fid_cq* transmit_queue, fid_cq* recv_queue,
+			CompletionWaiter& waiter);
+
+	CqScheduler(const CqScheduler&) = delete;
+	CqScheduler& operator=(const CqScheduler&) = delete;
+
+	/* Start 'task'. It runs up to its first 'co_await' before this
+	 * returns. */
+	void spawn(Task task);
+
+	/* Post 'op' behind everything waiting to be posted. Returns false if it
+	 * finished or failed already, and its coroutine goes on right away. */
+	bool submit(AsyncOp& op);
+
+	/* One pass without blocking. Returns how many coroutines were resumed,
+	 * or a negative libfabric error code if a queue itself failed. */
+	ssize_t poll();
+
+	/* Run until every task spawned so far is done, waiting through the
+	 * waiter while nothing completes. Returns 0, or a negative libfabric
+	 * error code. */
+	ssize_t run();
+
+	size_t in_flight() const { return transmit_in_flight + recv_in_flight; }
+
+private:
+	ssize_t drain(fid_cq* queue, size_t& in_flight, bool block);
+	void finish(AsyncOp& op, ssize_t result);
+
+	fid_cq* transmit_queue;
+	fid_cq* recv_queue;
+	CompletionWaiter& waiter;
+
+	std::vector<Task> tasks;
+	std::deque<AsyncOp*> backlog; /* Awaited, but not posted yet. */
+	size_t transmit_in_flight = 0;
+	size_t recv_in_flight = 0;
+};
+
+#endif /* ASYNC_HPP */
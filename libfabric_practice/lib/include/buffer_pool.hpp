@@ -0,0 +1,102 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+/* Slabs are handed out on cache line boundaries, so two slabs never share a
+ * line and the payloads stay friendly to the NIC's DMA engine. */
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/* A memory region key nothing else registered through here has asked for.
+ * Unless the provider hands out its own keys ('FI_MR_PROV_KEY'), every memory
+ * region in a domain needs one. */
+uint64_t requested_mr_key();
+
+/* A single buffer handed out by a 'BufferPool'. The memory is already
+ * registered, so 'desc' can be passed straight to 'fi_send()', 'fi_recv()'
+ * and friends. */
+struct buffer_slab {
+	char* data = nullptr;
+	size_t size = 0;
+	void* desc = nullptr;
+};
+
+/* A pool of pre-registered slabs carved out of large arenas. Every arena is
+ * registered with the domain exactly once when it is created, so handing a
+ * slab out and taking it back is just a push or pop on the free list, with
+ * no allocation and no registration. Providers whose 'mr_mode' has
+ * 'FI_MR_LOCAL' need this, and everyone else is spared the bounce copies.
+ *
+ * The pool isn't thread-safe. */
+class BufferPool {
+public:
+	/* 'slab_size' is rounded up to a whole number of cache lines. The first
+	 * arena holds 'slab_count' slabs, and the pool grows by another arena of
+	 * the same size if it ever runs dry. If even the first one can't be
+	 * registered, the pool starts out empty, see 'available()'. */
+	BufferPool(fid_domain* domain, size_t slab_size, size_t slab_count,
+			uint64_t access = FI_SEND | FI_RECV);
+	~BufferPool();
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	/* Take a slab out of the pool. It stays registered until the pool is
+	 * destroyed. Exits if the pool has to grow and can't. */
+	buffer_slab* acquire();
+
+	/* The same, but returns nullptr if the pool has to grow and can't, for
+	 * callers that can turn a peer away instead. */
+	buffer_slab* try_acquire();
+
+	/* Take a slab of at least 'bytes' out of the pool. Anything up to
+	 * 'slab_size()' is an ordinary slab. Anything bigger gets an arena of its
+	 * own, which is registered once and then kept around for the next big
+	 * request, so repeated large transfers don't register anything either.
+	 *
+	 * Returns nullptr if no slab that big can be allocated or registered,
+	 * and the pool is left as it was. 'bytes' may come from a peer, so
+	 * failing is up to the caller, and no size makes this exit. */
+	buffer_slab* acquire(size_t bytes);
+
+	/* Give a slab back. Any operation posted with it must be complete. */
+	void release(buffer_slab* slab);
+
+	size_t slab_size() const { return slab_bytes; }
+	size_t available() const { return free_slabs.size(); }
+
+private:
+	/* One registered allocation that slabs are carved out of. */
+	struct arena {
+		char* memory = nullptr;
+		fid_mr* mr = nullptr;
+		std::vector<buffer_slab> slabs;
+	};
+
+	/* Both return 0, or a negative libfabric error code, and then nothing
+	 * was allocated. */
+	ssize_t grow();
+	ssize_t register_arena(size_t bytes_per_slab, size_t slab_count,
+			arena*& registered);
+
+	fid_domain* domain;
+	size_t slab_bytes;
+	size_t slabs_per_arena;
+	uint64_t access;
+
+	std::vector<arena*> arenas;
+	std::vector<buffer_slab*> free_slabs;
+
+	/* Oversized single-slab arenas from 'acquire(bytes)' that are not in
+	 * use right now. */
+	std::vector<buffer_slab*> free_large_slabs;
+};
+
+#endif /* BUFFER_POOL_HPP */
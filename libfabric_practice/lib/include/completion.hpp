@@ -0,0 +1,83 @@
+#ifndef COMPLETION_HPP
+#define COMPLETION_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_eq.h>
+
+#include "progress.hpp"
+#include "metrics.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+/* How many completions are read off of a queue per call, unless the
+ * dispatcher is told otherwise. */
+constexpr size_t DEFAULT_COMPLETION_BATCH = 16;
+
+/* Whoever posted an operation, and wants to hear back about it. */
+class CompletionHandler {
+public:
+	virtual ~CompletionHandler() = default;
+
+	/* The operation completed. Returning false stops the rest of the batch
+	 * from being dispatched, for handlers that just tore down whatever the
+	 * remaining completions would have been handed to. */
+	virtual bool on_completion(const fi_cq_data_entry& entry) = 0;
+
+	/* The operation failed. */
+	virtual void on_error(const fi_cq_err_entry& entry) = 0;
+};
+
+/* Reads a completion queue in batches of 'FI_CQ_FORMAT_DATA' entries, and
+ * hands every one of them to the handler of the operation it belongs to.
+ * Handlers are found through each operation's context. Error entries are
+ * read with 'fi_cq_readerr()' and handed to the failed operation's handler
+ * the same way, so none of them go unnoticed.
+ *
+ * The queue has to be opened with 'FI_CQ_FORMAT_DATA'. */
+class CompletionDispatcher {
+public:
+	/* Finds the handler of an operation from its context. Returning nullptr
+	 * drops the completion, which is how completions for operations whose
+	 * owner is already gone get ignored. Without a resolver, every context
+	 * is taken to be a 'CompletionHandler*' itself. */
+	using resolver = CompletionHandler* (*)(void* context, void* arg);
+
+	CompletionDispatcher(fid_cq* queue, size_t batch = DEFAULT_COMPLETION_BATCH,
+			resolver resolve = nullptr, void* arg = nullptr);
+
+	/* Read one batch without blocking, and dispatch it. Returns how many
+	 * completions and errors were dispatched, 0 if the queue was empty, or a
+	 * negative libfabric error code if the queue itself failed. */
+	ssize_t poll();
+
+	/* The same, but wait through 'waiter' until there is at least one. */
+	ssize_t wait(CompletionWaiter& waiter);
+
+	/* How many reads it took to get how many completions. Reads that came
+	 * up empty don't count. */
+	uint64_t reads() const { return read_calls; }
+	uint64_t completions() const { return dispatched; }
+
+	/* Count error completions and the queue's depth in 'stats' from now on.
+	 * It has to belong to the thread reading the queue. */
+	void track(op_stats* stats) { this->stats = stats; }
+
+private:
+	ssize_t dispatch(ssize_t read);
+	CompletionHandler* find(void* context) const;
+
+	fid_cq* queue;
+	resolver resolve;
+	void* arg;
+	std::vector<fi_cq_data_entry> entries;
+	op_stats* stats = nullptr;
+
+	uint64_t read_calls = 0;
+	uint64_t dispatched = 0;
+};
+
+#endif /* COMPLETION_HPP */
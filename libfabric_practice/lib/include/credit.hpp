@@ -0,0 +1,99 @@
+#ifndef CREDIT_HPP
+#define CREDIT_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_endpoint.h>
+
+#include "buffer_pool.hpp"
+#include "transfer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+/* Credit-based flow control for the chunks of arrays, in tagged mode. A
+ * sender may only have as many chunks out as the receiver has posted
+ * receives for, one credit per receive. Until the receiver grants more, the
+ * rest of the transfer waits on the sender's side, unposted, instead of
+ * piling up in the provider as unexpected messages or RNR retries. Memory
+ * use on both sides stays what the posted windows are.
+ *
+ * Grants are counted from the start of the link, so an update only ever
+ * says how many receives were posted in total. Updates can't be lost that
+ * way, and it doesn't matter in which order they land. They travel two
+ * ways. Every chunk sent the other way carries the latest total as remote
+ * CQ data, if the provider has 64 bits of it. Whatever is still due after
+ * that goes out on its own, as an injected message of the 'CREDIT' stream,
+ * which lands in the link's own buffer.
+ *
+ * The receive for those updates stays posted for as long as the link lives,
+ * so one can show up on the receive queue at any time. Whoever reads the
+ * queue hands it over with 'take_update()'. */
+class CreditLink {
+public:
+	/* 'slot' is the registered buffer the peer's updates land in, and
+	 * 'context' is passed along with the receive for them, the link itself
+	 * if there is none. */
+	CreditLink(fid_ep* endpoint, const fi_info* info, buffer_slab* slot,
+			const transfer_config& config, void* context = nullptr);
+
+	CreditLink(const CreditLink&) = delete;
+	CreditLink& operator=(const CreditLink&) = delete;
+
+	/* Post the receive for the peer's next update. Returns 0, or a negative
+	 * libfabric error code. */
+	ssize_t post();
+
+	/* Sending: one credit per chunk posted. 'take()' returns false if there
+	 * is none left, and 'give_back()' returns one for a chunk that couldn't
+	 * be posted after all. */
+	bool take();
+	void give_back() { taken--; }
+	uint64_t available() const { return peer_granted - taken; }
+
+	/* Receiving: one more receive for the peer's chunks is posted. */
+	void grant() { granted++; }
+	bool due() const { return granted > announced; }
+
+	/* The total to piggy-back on a chunk sent the other way, and whether
+	 * the provider can carry one at all. Once that chunk is posted, the
+	 * total counts as announced. */
+	bool piggybacks() const { return cq_data; }
+	uint64_t total() const { return granted; }
+	void announce(uint64_t sent) { announced = std::max(announced, sent); }
+
+	/* Whether a completion on the receive queue is the peer's update. */
+	bool is_update(void* op_context) const { return op_context == context; }
+
+	/* Take in the update that landed, and post the receive again. Returns
+	 * 0, or a negative libfabric error code. */
+	ssize_t take_update();
+
+	/* Take in a total the peer piggy-backed on one of its chunks, if the
+	 * completion 'flags' say it carries one. */
+	void take_piggyback(uint64_t flags, uint64_t data);
+
+	/* Send what the peer hasn't heard yet, as an update of its own. Returns
+	 * 0, or a negative libfabric error code. If the provider's queue is
+	 * full, it stays due for the next call. */
+	ssize_t flush();
+
+private:
+	void receive_grant(uint64_t total);
+
+	fid_ep* endpoint;
+	buffer_slab* slot;
+	transfer_config config;
+	void* context;
+	bool cq_data = false;
+
+	uint64_t peer_granted = 0; /* Receives the peer posted for us. */
+	uint64_t taken = 0;
+	uint64_t granted = 0; /* Receives we posted for the peer. */
+	uint64_t announced = 0;
+	uint64_t updates = 0; /* Sent so far, to tag the next one with. */
+};
+
+#endif /* CREDIT_HPP */
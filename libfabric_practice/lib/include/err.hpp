@@ -11,7 +11,13 @@
 /* Perform error checking for libfabric functions. */
 void check_libfabric(int code, const char* message);
 
-/* Perform error checking for specific event queues. */
-void check_eq_error(fid_eq* event_queue);
+/* Read the error entry waiting on an event queue ('-FI_EAVAIL') and print
+ * it. The entry is handed back, since its 'fid' says whose it is. */
+fi_eq_err_entry check_eq_error(fid_eq* event_queue);
+
+/* Read the error entry waiting on a completion queue ('-FI_EAVAIL') and
+ * print it. The entry is handed back, since its context says which
+ * operation failed. */
+fi_cq_err_entry check_cq_error(fid_cq* completion_queue);
 
 #endif /* ERR_HPP */
@@ -0,0 +1,88 @@
+#ifndef EXPORTER_HPP
+#define EXPORTER_HPP
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* A set of metrics, put together for one dump, that renders as Prometheus
+ * text or as JSON. Every metric is described once, and then gets any number
+ * of samples, each with labels of its own. */
+class MetricsReport {
+public:
+	using labels = std::vector<std::pair<std::string, std::string>>;
+
+	/* 'type' is "counter", "gauge" or "summary". */
+	void describe(const std::string& name, const char* type,
+			const char* help);
+
+	/* A sample of a metric described before. A summary's count and sum go
+	 * in with a 'suffix' of "_count" and "_sum". */
+	void add(const std::string& name, const labels& sample_labels,
+			double value, const char* suffix = "");
+
+	/* The text format Prometheus scrapes. */
+	std::string prometheus() const;
+
+	/* One JSON object, with every sample in its "metrics" array. */
+	std::string json() const;
+
+private:
+	struct sample {
+		std::string name;
+		labels sample_labels;
+		double value = 0;
+	};
+
+	struct family {
+		std::string name;
+		std::string type;
+		std::string help;
+		std::vector<sample> samples;
+	};
+
+	std::vector<family> families;
+};
+
+/* Hands out reports from a thread of its own, so nothing on the hot path
+ * ever formats or writes one. A report goes out in two ways: as JSON on
+ * standard output whenever the process gets 'SIGUSR1', and over a Unix
+ * socket, if it is given a path, to anyone who connects. The socket answers
+ * with Prometheus text, or with JSON if the first line it is sent says
+ * "json".
+ *
+ * The exporter blocks 'SIGUSR1' in the thread that starts it, and only its
+ * own thread takes it. Threads started after it inherit that, so the signal
+ * never interrupts anybody else's sleep, which means it has to be started
+ * before any other thread is. */
+class MetricsExporter {
+public:
+	using collector = std::function<MetricsReport()>;
+
+	/* Start the thread. 'collect' is called on it for every report. */
+	MetricsExporter(collector collect, const std::string& path);
+	~MetricsExporter();
+
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	/* Whether the socket is up. If it couldn't be, the reason was printed,
+	 * and reports still go out on the signal. */
+	bool listening() const { return listener >= 0; }
+
+private:
+	int listen_on(const std::string& socket_path);
+	void run();
+	void serve(int client);
+
+	collector collect;
+	std::string path;
+	int listener = -1;
+	std::atomic<bool> stopping{false};
+	std::thread thread;
+};
+
+#endif /* EXPORTER_HPP */
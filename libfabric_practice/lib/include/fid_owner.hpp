@@ -0,0 +1,86 @@
+#ifndef FID_OWNER_HPP
+#define FID_OWNER_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+
+#include "err.hpp"
+
+#include <memory>
+#include <string>
+#include <utility>
+
+/* Owns one libfabric object, a 'fid_fabric', 'fid_domain', 'fid_eq',
+ * 'fid_cq', 'fid_ep' or anything else with a 'fid' in it, and closes it with
+ * 'fi_close()' when it goes away. A failed close exits, like any other
+ * failed libfabric call.
+ *
+ * Objects have to be closed before whatever they were opened on or bound to:
+ * endpoints before their queues, memory regions and address vectors, those
+ * before their domain, and the domain and event queues before the fabric.
+ * Members are destroyed in the reverse of the order they are declared in,
+ * so a struct that declares its owners in the order they are opened closes
+ * them in the right order all by itself. */
+template <typename T>
+class FidOwner {
+public:
+	/* 'name' says which object failed to close, if one does. */
+	explicit FidOwner(const char* name, T* object = nullptr) :
+		object(object),
+		name(name) {}
+	~FidOwner() { reset(); }
+
+	FidOwner(const FidOwner&) = delete;
+	FidOwner& operator=(const FidOwner&) = delete;
+
+	FidOwner(FidOwner&& other) noexcept :
+		object(std::exchange(other.object, nullptr)),
+		name(other.name) {}
+	FidOwner& operator=(FidOwner&& other) noexcept {
+		if (this != &other) {
+			reset();
+			object = std::exchange(other.object, nullptr);
+			name = other.name;
+		}
+		return *this;
+	}
+
+	/* Close the object now. */
+	void reset() {
+		if (!object)
+			return;
+
+		T* closing = std::exchange(object, nullptr);
+		check_libfabric(fi_close(&closing->fid),
+				(std::string("fi_close(), ") + name).c_str());
+	}
+
+	/* The out parameter of the call that opens the object. Whatever was
+	 * owned before is closed first. */
+	T** out() {
+		reset();
+		return &object;
+	}
+
+	/* Stop owning the object without closing it. */
+	T* release() { return std::exchange(object, nullptr); }
+
+	T* get() const { return object; }
+	T* operator->() const { return object; }
+	operator T*() const { return object; }
+
+private:
+	T* object = nullptr;
+	const char* name;
+};
+
+/* Frees an 'fi_info' list with 'fi_freeinfo()'. */
+struct info_deleter {
+	void operator()(fi_info* info) const { fi_freeinfo(info); }
+};
+
+/* Owns the 'fi_info' list 'fi_getinfo()' handed back. It describes the
+ * objects opened on it, so it goes last. */
+using InfoOwner = std::unique_ptr<fi_info, info_deleter>;
+
+#endif /* FID_OWNER_HPP */
@@ -0,0 +1,120 @@
+#ifndef FRAME_HPP
+#define FRAME_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_endpoint.h>
+
+#include "buffer_pool.hpp"
+#include "recv_ring.hpp"
+#include "transfer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+/* Every frame buffer, on both sides, is this big: header included. Both peers
+ * have to agree on it, since the sender fills exactly as much of the payload
+ * into the frame as the receiver's pre-posted buffer can take. */
+constexpr size_t FRAME_SIZE = 64 * 1024;
+
+/* What a frame carries. */
+enum class frame_type : uint16_t {
+	SCALAR = 1,	/* A single float. */
+	ARRAY = 2,	/* An array of floats. */
+	RMA_REQUEST = 3,	/* An 'rma_request': sent instead of an array. */
+	RMA_WINDOWS = 4,	/* An 'rma_offer', in answer to an 'RMA_REQUEST'. */
+	RMA_DONE = 5,	/* Every read and write on the windows completed. */
+	HELLO = 6,	/* The sender's endpoint name, to reply to it with. */
+	RPC_REQUEST = 7,	/* An 'rpc_header' and a call's arguments. */
+	RPC_RESPONSE = 8,	/* An 'rpc_header' and a call's result. */
+	WELCOME = 9,	/* Which receive context of a scalable endpoint is ours. */
+	RENDEZVOUS = 10,	/* An 'rma_window' on an array, instead of the array. */
+	RENDEZVOUS_FIN = 11	/* The array was read out of that window. */
+};
+
+/* Sent in front of every payload, in the same message as the payload. */
+struct frame_header {
+	uint64_t length;	/* Payload bytes in total, not just in this frame. */
+	uint32_t sequence;	/* Counts up by one for every frame sent. */
+	uint16_t type;		/* A 'frame_type'. */
+	uint16_t reserved;
+};
+
+static_assert(sizeof(frame_header) == 16, "frame_header is sent as-is");
+
+/* The header of frame 'sequence', carrying 'length' bytes of 'type'. */
+constexpr frame_header make_frame_header(frame_type type, uint64_t length,
+		uint32_t sequence) {
+	return { length, sequence, static_cast<uint16_t>(type), 0 };
+}
+
+/* A frame that landed, taken apart. */
+struct frame_view {
+	frame_header header = {};
+	const char* payload = nullptr;	/* The part that came along in the frame. */
+	size_t in_frame = 0;		/* How many bytes of the payload that is. */
+};
+
+/* How many payload bytes fit in a frame behind its header. Providers that
+ * can't send 'FRAME_SIZE' in one message get smaller frames. */
+size_t frame_capacity(const fi_info* info);
+
+/* Whether a frame with a payload of 'length' bytes is small enough for the
+ * provider to take in one go ('tx_attr->inject_size'). Those are sent with
+ * 'fi_inject()', which never reports a completion. */
+bool frame_fits_inject(const fi_info* info, size_t length);
+
+/* Post one frame: the header and up to 'frame_capacity()' bytes of the
+ * payload go out together as a single message, to 'config.dest_addr' if the
+ * endpoint isn't connected, and on the 'CONTROL' stream if 'config.tagged'
+ * is set. The header is written to the start of 'slot', which only needs
+ * room for it and the part of the payload that goes with it.
+ *
+ * If the provider's 'cq_data_size' holds 64 bits, and the header packs into
+ * them, the header rides along as remote CQ data instead, and the payload
+ * is sent on its own, straight from where it is. The receiver finds it in
+ * its completion, so it costs no bytes in the message. With a
+ * 'config.source', that goes in the remote CQ data, and the header stays in
+ * front of the payload.
+ *
+ * A frame that 'frame_fits_inject()' is injected, so 'slot'
+ * is free again right away and no completion comes for it. Otherwise 'slot'
+ * must stay untouched until the send completes. If the provider can gather
+ * two buffers into one message, the payload is sent straight from where it
+ * is with a two-entry 'fi_sendv()'. Otherwise it is copied into 'slot' behind
+ * the header.
+ *
+ * Returns how many payload bytes went out with the frame, or a negative
+ * libfabric error code. Anything past that is the remainder, which the
+ * caller sends right after as a 'ChunkedTransfer'. */
+ssize_t post_frame(fid_ep* endpoint, const fi_info* info, buffer_slab* slot,
+		frame_type type, uint32_t sequence, const void* payload, size_t length,
+		void* payload_desc, void* context,
+		const transfer_config& config = transfer_config());
+
+/* Post a frame that is whole already: its header and all of its payload,
+ * 'frame_len' bytes at 'frame'. It goes wherever 'post_frame()' would send
+ * it, injected if 'inject' is set, and otherwise sent out of 'desc'. Returns
+ * 0, or a negative libfabric error code. */
+ssize_t post_whole_frame(fid_ep* endpoint, const void* frame, size_t frame_len,
+		void* desc, uint32_t sequence, bool inject, void* context,
+		const transfer_config& config = transfer_config());
+
+/* Post 'slot' as the buffer the next frame lands in. Only one frame buffer
+ * may be posted at a time: if a frame has a remainder, its chunks have to be
+ * the next receives posted, so they can't be swallowed by a frame buffer. A
+ * 'RecvRing' has no such limit, since everything lands in it anyway, and
+ * neither do tagged frame buffers, which only match the 'CONTROL' stream. */
+ssize_t post_frame_recv(fid_ep* endpoint, const fi_info* info,
+		buffer_slab* slot, void* context,
+		const transfer_config& config = transfer_config());
+
+/* Take apart the frame in 'message'. Its header is either in front of the
+ * payload, or, if the completion has 'FI_REMOTE_CQ_DATA' set, packed into
+ * its data. Frames in a receive ring can start at any offset, so the header
+ * is copied out rather than read in place. Returns false if the message is
+ * too short to be a frame. */
+bool read_frame(const recv_view& message, frame_view& frame);
+
+#endif /* FRAME_HPP */
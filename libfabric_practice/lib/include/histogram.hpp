@@ -0,0 +1,46 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* How many bits of every value a 'Histogram' keeps by default. Values are
+ * bucketed to within 1 / 2^(bits - 1) of what was recorded, so 8 bits keep
+ * every value to within 0.8%. */
+constexpr unsigned DEFAULT_HISTOGRAM_BITS = 8;
+
+/* A histogram in the style of HdrHistogram: every power of two gets the same
+ * number of buckets, so the relative error is the same from nanoseconds to
+ * seconds, and recording a value is a couple of shifts and an increment no
+ * matter how many have been recorded. */
+class Histogram {
+public:
+	explicit Histogram(unsigned significant_bits = DEFAULT_HISTOGRAM_BITS);
+
+	void record(uint64_t value);
+	void reset();
+
+	/* The value 'percent' percent of the recorded values are at or below,
+	 * give or take the histogram's precision. */
+	uint64_t percentile(double percent) const;
+
+	uint64_t count() const { return total; }
+	uint64_t min() const { return total ? lowest : 0; }
+	uint64_t max() const { return highest; }
+	double mean() const;
+
+private:
+	size_t index_of(uint64_t value) const;
+	uint64_t highest_in(size_t index) const;
+
+	unsigned bits;
+	std::vector<uint64_t> counts;
+
+	uint64_t total = 0;
+	uint64_t lowest = UINT64_MAX;
+	uint64_t highest = 0;
+	long double sum = 0;
+};
+
+#endif /* HISTOGRAM_HPP */
@@ -0,0 +1,155 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_errno.h>
+
+#include "fid_owner.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+/* How many latency stamps a 'LatencyRing' holds before the oldest ones are
+ * written over. A power of two. */
+constexpr size_t LATENCY_RING_SIZE = 4096;
+
+static_assert((LATENCY_RING_SIZE & (LATENCY_RING_SIZE - 1)) == 0,
+		"the ring is indexed with a mask");
+
+/* Nanoseconds on the monotonic clock, for latency stamps. */
+inline uint64_t monotonic_ns() {
+	return static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/* Counts of what had to wait or went wrong on the hot path. A set belongs to
+ * the one thread that bumps it, and any other may read it at any time. With
+ * a single writer, bumping one is a plain load and store, with no locked
+ * instruction, so leaving them on costs next to nothing. */
+struct op_stats {
+	std::atomic<uint64_t> eagain{0}; /* Posts the provider had no room for. */
+	std::atomic<uint64_t> retries{0}; /* Posts that made it after one didn't. */
+	std::atomic<uint64_t> credit_stalls{0}; /* Posts held back for credits. */
+	std::atomic<uint64_t> cq_errors{0}; /* Error completions of any kind. */
+	std::atomic<uint64_t> rnr{0}; /* Of those, receivers not ready. */
+
+	/* The most completions one read found waiting on a queue. A read never
+	 * asks for more than its batch, so a mark at the batch size only says
+	 * the queue was at least that deep. */
+	std::atomic<uint64_t> cq_depth_max{0};
+
+	/* Only the owning thread may call these. */
+	static void bump(std::atomic<uint64_t>& counter, uint64_t by = 1) {
+		counter.store(counter.load(std::memory_order_relaxed) + by,
+				std::memory_order_relaxed);
+	}
+	static void raise(std::atomic<uint64_t>& mark, uint64_t value) {
+		if (value > mark.load(std::memory_order_relaxed))
+			mark.store(value, std::memory_order_relaxed);
+	}
+
+	/* An error completion with 'err' came in. Providers report a receiver
+	 * that ran out of posted buffers as 'FI_ENORX'. */
+	void count_error(int err) {
+		bump(cq_errors);
+		if (err == FI_ENORX)
+			bump(rnr);
+	}
+};
+
+/* What a latency stamp timed. */
+enum class latency_op : uint32_t {
+	FRAME,		/* A frame, from its post to its send completing. */
+	ARRAY_SEND,	/* The chunks of an array, from the first post on. */
+	ARRAY_RECV,	/* The same, receiving them. */
+	ARRAY_READ,	/* The same, reading them out of the peer's memory. */
+	RESPONSE,	/* A call, from taking it in to its response going out. */
+	COUNT
+};
+
+/* The name of an op in reports. */
+const char* latency_op_name(latency_op op);
+
+/* One stamp, as it was read back out of a ring. */
+struct latency_stamp {
+	uint64_t connection = 0;
+	latency_op op = latency_op::FRAME;
+	uint64_t nanos = 0;
+};
+
+/* Latency stamps of one thread, on their way to whoever reports them. The
+ * thread that owns the ring pushes, and never waits: once the ring is full,
+ * the oldest stamps are written over. One other thread at a time drains,
+ * and never blocks the owner either. Every slot carries the number of the
+ * stamp in it, and a stamp that changed while it was being copied out gets
+ * dropped and counted as lost, like the ones written over before it was
+ * read. */
+class LatencyRing {
+public:
+	LatencyRing() = default;
+	LatencyRing(const LatencyRing&) = delete;
+	LatencyRing& operator=(const LatencyRing&) = delete;
+
+	/* Only the owning thread pushes. */
+	void push(uint64_t connection, latency_op op, uint64_t nanos);
+
+	/* Append every stamp pushed since 'cursor' to 'out', and move 'cursor'
+	 * past them. Starts at 0. Returns how many were lost along the way. */
+	uint64_t drain(uint64_t& cursor, std::vector<latency_stamp>& out) const;
+
+private:
+	struct slot {
+		std::atomic<uint64_t> sequence{0}; /* The stamp's number, plus one. */
+		std::atomic<uint64_t> tag{0}; /* The connection, and the op below. */
+		std::atomic<uint64_t> nanos{0};
+	};
+
+	std::array<slot, LATENCY_RING_SIZE> slots;
+	std::atomic<uint64_t> head{0};
+};
+
+/* What an endpoint's counters said. */
+struct op_counts {
+	uint64_t transmits = 0;
+	uint64_t transmit_errors = 0;
+	uint64_t receives = 0;
+	uint64_t receive_errors = 0;
+
+	op_counts& operator+=(const op_counts& other);
+};
+
+/* A pair of 'fi_cntr' counters bound to one endpoint, one for everything it
+ * transmits (sends, writes and reads) and one for what it receives. The
+ * provider counts every operation that completes, injected ones and those
+ * without 'FI_COMPLETION' too, without anything to read off of a queue.
+ * Reading them is a call into the provider, so it is only done when a
+ * report asks for it, never on the hot path. */
+class OpCounters {
+public:
+	/* Open the counters on 'domain', and bind them to 'endpoint', which
+	 * must not be enabled yet. Returns 0, or a negative libfabric error code,
+	 * and then there are no counters. Not every provider has them. */
+	ssize_t bind(fid_domain* domain, fid_ep* endpoint);
+
+	bool bound() const { return transmit.get() != nullptr; }
+	op_counts read() const;
+
+	/* Close the counters. Has to be done after their endpoint is closed,
+	 * and before their domain is. */
+	void reset();
+
+private:
+	FidOwner<fid_cntr> transmit{"transmit counter"};
+	FidOwner<fid_cntr> recv{"recv counter"};
+};
+
+#endif /* METRICS_HPP */
@@ -0,0 +1,97 @@
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_eq.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <sys/types.h>
+
+/* How a thread waits on its completion queues. */
+enum class wait_mode {
+	BLOCK,	/* Sleep in the queue's wait object with 'fi_cq_sread()'. */
+	POLL,	/* Spin on 'fi_cq_read()', backing off the longer it's dry. */
+	EPOLL	/* Sleep on the queue's file descriptor, next to other ones. */
+};
+
+/* The wait object completion queues are opened with in 'mode'. Polled queues
+ * get none, so the provider doesn't have to keep one signalled. In 'EPOLL'
+ * mode it has to be a file descriptor, see 'FdWaitSet'. */
+fi_wait_obj cq_wait_obj(wait_mode mode);
+
+/* What every completion queue is opened with: room for 'size' entries, or
+ * the provider's default for 0, the wait object of 'mode', and completions
+ * that carry the context along with where a received message landed and
+ * how long it is. */
+fi_cq_attr cq_attr(wait_mode mode, size_t size = 0);
+
+/* Bind 'recv_queue' and 'transmit_queue' to 'endpoint'. Only sends flagged
+ * with 'FI_COMPLETION' show up on the transmit queue, so small messages can
+ * be injected without leaving anything to reap. Returns 0, or a negative
+ * libfabric error code. */
+int bind_queues(fid_ep* endpoint, fid_cq* recv_queue, fid_cq* transmit_queue);
+
+/* The phases a polling wait backs off through. */
+enum backoff_phase {
+	SPIN,	/* Poll again right away, with a pause hint to the CPU. */
+	YIELD,	/* Give the core up to anybody else who wants it between polls. */
+	SLEEP,	/* Nap between polls, a little longer every time. A queue without
+		 * a wait object can't be slept on, so this is as close as polling
+		 * gets to blocking. */
+	BACKOFF_PHASES
+};
+
+/* Where the time spent waiting went. */
+struct backoff_stats {
+	uint64_t nanoseconds[BACKOFF_PHASES] = {};
+	uint64_t waits[BACKOFF_PHASES] = {}; /* Waits that ended in each phase. */
+};
+
+/* Waits for completions the way its 'wait_mode' says. In 'POLL' mode, every
+ * wait starts out spinning, moves on to yielding and then to sleeping the
+ * longer nothing shows up, and starts over at spinning as soon as something
+ * does. Short waits never pay for a wake-up, and long ones don't burn a core.
+ *
+ * Loops that poll several things at once report each pass through 'idle()'
+ * and 'reset()' themselves instead of calling 'wait()'. */
+class CompletionWaiter {
+public:
+	explicit CompletionWaiter(wait_mode mode = wait_mode::BLOCK);
+
+	/* Read up to 'count' completions off of 'queue' into 'entries', waiting
+	 * until there is at least one. Returns how many were read, or a negative
+	 * libfabric error code. '-FI_EAVAIL' means an error entry is waiting. */
+	ssize_t wait(fid_cq* queue, void* entries, size_t count);
+
+	/* A poll came up empty: back off according to how long it has been. */
+	void idle();
+
+	/* A poll found something: the wait is over. */
+	void reset();
+
+	wait_mode mode() const { return policy; }
+	const backoff_stats& stats() const { return totals; }
+
+	/* Print the time spent in each phase. */
+	void report(std::ostream& out) const;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	void enter(backoff_phase next, clock::time_point now);
+
+	wait_mode policy;
+	backoff_stats totals;
+
+	bool waiting = false;
+	backoff_phase phase = SPIN;
+	size_t polls = 0;
+	clock::time_point phase_start;
+	std::chrono::nanoseconds nap;
+};
+
+#endif /* PROGRESS_HPP */
@@ -0,0 +1,48 @@
+#ifndef RDM_HPP
+#define RDM_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_endpoint.h>
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+
+/* The longest endpoint name a 'HELLO' frame may carry. Names of the
+ * providers that do 'FI_EP_RDM' over IP are a socket address, which is far
+ * shorter than that. */
+constexpr size_t MAX_ADDRESS_SIZE = 64;
+
+/* How many peers an address vector is opened for. It only sizes the initial
+ * allocation, more can be inserted than that. */
+constexpr size_t ADDRESS_VECTOR_SIZE = 64;
+
+/* How many of the top bits of an address name one of the receive contexts
+ * of a scalable endpoint (see 'fi_rx_addr()'). Both sides have to agree on
+ * it, and it caps how many receive contexts a scalable endpoint can have. */
+constexpr int RX_CONTEXT_BITS = 8;
+constexpr size_t MAX_RX_CONTEXTS = size_t(1) << RX_CONTEXT_BITS;
+
+/* Open an address vector on 'domain' and bind 'endpoint' to it. A reliable
+ * datagram endpoint reaches every one of its peers through the address it
+ * was given for it in there, instead of through a connection of its own.
+ * With 'rx_ctx_bits', addresses can name a receive context of a peer's
+ * scalable endpoint. A 'scalable' endpoint is bound as one, so every one of
+ * its contexts shares the address vector. Returns 0, or a negative libfabric
+ * error code. */
+ssize_t open_address_vector(fid_domain* domain, fid_ep* endpoint,
+		fid_av** av, int rx_ctx_bits = 0, bool scalable = false);
+
+/* Look up 'node' and 'port' the way 'fi_getinfo()' would, and add the result
+ * to 'av'. 'address' is what to send to it with from then on. */
+ssize_t insert_service(fid_av* av, const std::string& node, int port,
+		fi_addr_t* address);
+
+/* Add a peer's endpoint name, 'len' bytes as 'fi_getname()' gave them on its
+ * side, to 'av'. Names longer than 'MAX_ADDRESS_SIZE' are refused. */
+ssize_t insert_address(fid_av* av, const void* name, size_t len,
+		fi_addr_t* address);
+
+#endif /* RDM_HPP */
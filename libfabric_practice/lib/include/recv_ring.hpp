@@ -0,0 +1,107 @@
+#ifndef RECV_RING_HPP
+#define RECV_RING_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_eq.h>
+
+#include "buffer_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <sys/types.h>
+#include <vector>
+
+/* How many multi-receive buffers a ring keeps, and how many of the largest
+ * messages each one holds. While one buffer is being filled the others are
+ * already posted, so there is always somewhere for a message to land. */
+constexpr size_t DEFAULT_RING_BUFFERS = 2;
+constexpr size_t MESSAGES_PER_RING_BUFFER = 4;
+
+/* One message that landed in a ring, read in place. It has to be handed back
+ * with 'RecvRing::consume()' once the consumer is done with it. */
+struct recv_view {
+	const char* data = nullptr;
+	size_t len = 0;
+	size_t buffer = 0; /* Which of the ring's buffers it landed in. */
+
+	/* The flags of its completion, and with 'FI_REMOTE_CQ_DATA' among
+	 * them, the data the sender put in it. */
+	uint64_t flags = 0;
+	uint64_t cq_data = 0;
+};
+
+/* A ring of large 'FI_MULTI_RECV' buffers that stay posted on an endpoint.
+ * Every message the peer sends lands in place, right behind the one before
+ * it, so nothing has to be posted per message and nothing that arrives
+ * early is left without a buffer. Once a buffer has less than the largest
+ * message left in it, the provider releases it and moves on to the next one.
+ * The ring posts it again as soon as every view into it has been consumed.
+ *
+ * The endpoint needs the 'FI_MULTI_RECV' capability, and its receive
+ * completion queue has to be 'FI_CQ_FORMAT_DATA' or richer, since the ring
+ * finds its messages through each completion's 'buf' and 'len'. Every
+ * receive completion on the endpoint belongs to the ring, so nothing else may
+ * be posted for receiving while it is up.
+ *
+ * The ring isn't thread-safe. */
+class RecvRing {
+public:
+	/* Carve 'buffer_count' buffers out of 'pool', each big enough for
+	 * 'MESSAGES_PER_RING_BUFFER' messages of up to 'largest_message'. */
+	RecvRing(BufferPool& pool, size_t largest_message,
+			size_t buffer_count = DEFAULT_RING_BUFFERS);
+
+	/* Hands the buffers back to the pool. The endpoint must be closed first,
+	 * so the provider can't write into them anymore. */
+	~RecvRing();
+
+	RecvRing(const RecvRing&) = delete;
+	RecvRing& operator=(const RecvRing&) = delete;
+
+	/* Tell the endpoint how little room a buffer may have left before it is
+	 * released ('FI_OPT_MIN_MULTI_RECV'). This has to happen before
+	 * 'fi_enable()'. */
+	int configure(fid_ep* endpoint) const;
+
+	/* Post every buffer. 'context' comes back with every completion. If the
+	 * pool couldn't hand out every buffer, nothing is posted, and this
+	 * returns '-FI_ENOMEM'. */
+	ssize_t post(fid_ep* endpoint, void* context);
+
+	/* Hand the ring a completion read off of the receive queue. Returns 1 and
+	 * fills in 'view' if a message landed, 0 if the completion only released
+	 * a buffer, or a negative libfabric error code if a buffer couldn't be
+	 * posted again. */
+	ssize_t handle(const fi_cq_data_entry& entry, recv_view& view);
+
+	/* Give a view back. The last one out of a released buffer posts it
+	 * again. Returns 0, or a negative libfabric error code. */
+	ssize_t consume(const recv_view& view);
+
+	size_t largest_message() const { return min_free; }
+
+private:
+	struct ring_buffer {
+		buffer_slab* slab = nullptr;
+		size_t outstanding = 0;	/* Views not yet consumed. */
+		bool released = false;	/* Done being filled, not posted again yet. */
+	};
+
+	ssize_t repost(size_t index);
+
+	BufferPool& pool;
+	size_t min_free;
+	std::vector<ring_buffer> buffers;
+
+	/* The posted buffers, oldest first. Buffers are filled in the order they
+	 * were posted, so messages always land in the one at the front. */
+	std::deque<size_t> posted;
+
+	fid_ep* endpoint = nullptr;
+	void* context = nullptr;
+};
+
+#endif /* RECV_RING_HPP */
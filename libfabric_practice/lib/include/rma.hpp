@@ -0,0 +1,49 @@
+#ifndef RMA_HPP
+#define RMA_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_domain.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+/* Where a peer can reach a registered buffer with 'fi_write()' and
+ * 'fi_read()'. Sent as-is in an 'RMA_WINDOWS' frame. */
+struct rma_window {
+	uint64_t addr;		/* The buffer's address on the side that owns it. */
+	uint64_t key;		/* The remote key of the buffer's memory region. */
+	uint64_t length;	/* Bytes that may be accessed from 'addr' on. */
+};
+
+static_assert(sizeof(rma_window) == 24, "rma_window is sent as-is");
+
+/* The payload of an 'RMA_REQUEST' frame: how big a window the sender wants to
+ * write its array into. */
+struct rma_request {
+	uint64_t length;
+};
+
+/* The payload of an 'RMA_WINDOWS' frame, the answer to an 'RMA_REQUEST'. The
+ * requester reads the other side's array out of 'read', and writes its own
+ * into 'write'. */
+struct rma_offer {
+	rma_window read;
+	rma_window write;
+};
+
+/* Register 'len' bytes at 'buf' as a memory region of their own, that the
+ * peer can reach with 'access' ('FI_REMOTE_READ', 'FI_REMOTE_WRITE' or
+ * both). The memory may already be registered for local use, a buffer can be
+ * in more than one region. Returns 0, or a negative libfabric error code. */
+ssize_t expose_region(fid_domain* domain, void* buf, size_t len,
+		uint64_t access, fid_mr** mr);
+
+/* Describe a region 'expose_region()' registered, for the peer. Providers
+ * with 'FI_MR_VIRT_ADDR' in their 'mr_mode' are addressed by virtual address,
+ * the rest by the offset into the region. */
+rma_window describe_region(const fi_info* info, fid_mr* mr, const void* buf,
+		size_t len);
+
+#endif /* RMA_HPP */
@@ -0,0 +1,89 @@
+#ifndef RPC_HPP
+#define RPC_HPP
+
+#include "buffer_pool.hpp"
+#include "frame.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/* What a call asks the other side to do. */
+enum class rpc_method : uint32_t {
+	ECHO = 1,	/* Answer with the arguments, as they are. */
+	SUM = 2,	/* Answer with the sum of an array of floats. */
+	SLEEP = 3	/* Answer once a 'uint64_t' of microseconds have passed. */
+};
+
+/* In front of the arguments of every 'RPC_REQUEST' frame, and of the result
+ * of every 'RPC_RESPONSE' frame. */
+struct rpc_header {
+	uint64_t correlation_id;	/* Which call a response answers. */
+	uint32_t method;	/* An 'rpc_method'. */
+	int32_t status;		/* In a response, 0 or a negative libfabric
+				 * error code. */
+};
+
+static_assert(sizeof(rpc_header) == 16, "rpc_header is sent as-is");
+
+/* The most a call can carry in arguments, or its answer in a result. Calls
+ * are meant to be small and many, anything bigger is a frame of its own. */
+constexpr size_t RPC_MAX_PAYLOAD = 1024;
+constexpr size_t RPC_MESSAGE_SIZE = sizeof(rpc_header) + RPC_MAX_PAYLOAD;
+
+/* Calls are built in the tail of the frame slab they are sent from. That
+ * memory is registered like the rest of the slab, and the frame never gets
+ * that far, since it only takes a header and the call. */
+static_assert(FRAME_SIZE >= 2 * (sizeof(frame_header) + RPC_MESSAGE_SIZE),
+		"calls have to fit behind their frame");
+
+inline char* call_buffer(buffer_slab* slab) {
+	return slab->data + slab->size - RPC_MESSAGE_SIZE;
+}
+
+/* The calls a client is waiting on, by correlation id. Each id maps to a
+ * slot of its own (the id modulo the capacity), so a response finds its
+ * call in one step, whatever order responses come back in. Slots are
+ * claimed and given back with compare-and-swap alone, so the thread posting
+ * calls and the one reaping responses never take a lock.
+ *
+ * Ids start at 1 and count up, and are never reused. A response for a call
+ * that isn't in flight anymore, or never was, simply finds nothing. */
+class InFlightTable {
+public:
+	/* Room for 'capacity' calls, rounded up to a power of two. */
+	explicit InFlightTable(size_t capacity);
+
+	InFlightTable(const InFlightTable&) = delete;
+	InFlightTable& operator=(const InFlightTable&) = delete;
+
+	/* Give a new call an id, and keep 'call' under it. Returns 0 if the slot
+	 * of the next id is still held by an older call, which has to be
+	 * answered before anything else can go out. */
+	uint64_t insert(void* call);
+
+	/* Take back the call that 'id' was handed out for. Returns nullptr if it
+	 * isn't in flight. */
+	void* remove(uint64_t id);
+
+	size_t in_flight() const { return count.load(std::memory_order_relaxed); }
+	size_t capacity() const { return mask + 1; }
+
+private:
+	/* A slot's id is 0 while it is free, and 'CLAIMED' while a thread is
+	 * filling it in or emptying it. */
+	static constexpr uint64_t CLAIMED = ~0ULL;
+
+	struct slot {
+		std::atomic<uint64_t> id{0};
+		void* call = nullptr;
+	};
+
+	std::unique_ptr<slot[]> slots;
+	size_t mask;
+	std::atomic<uint64_t> next_id{1};
+	std::atomic<size_t> count{0};
+};
+
+#endif /* RPC_HPP */
@@ -0,0 +1,29 @@
+#ifndef TAG_HPP
+#define TAG_HPP
+
+#include <cstdint>
+
+/* In tagged mode, every message carries a 64-bit tag: the logical stream it
+ * belongs to in the top 16 bits, and where it goes within that stream in the
+ * other 48. A tagged receive only matches messages with its own tag, outside
+ * of the bits it ignores, so the streams sharing an endpoint never wait
+ * behind each other's messages, and complete in whatever order they land. */
+enum class stream_id : uint16_t {
+	CONTROL = 1,	/* Frames. Their headers carry their sequence numbers. */
+	BULK = 2,	/* The chunks of an array's remainder, by chunk index. */
+	CREDIT = 3	/* Credit updates, see 'credit.hpp'. */
+};
+
+constexpr unsigned STREAM_SHIFT = 48;
+
+/* The bits of a tag below the stream. A receive that ignores them matches
+ * any message of its stream. */
+constexpr uint64_t ANY_SEQUENCE = (1ULL << STREAM_SHIFT) - 1;
+
+/* The tag of message 'sequence' of 'stream'. */
+constexpr uint64_t stream_tag(stream_id stream, uint64_t sequence = 0) {
+	return (static_cast<uint64_t>(stream) << STREAM_SHIFT) |
+		(sequence & ANY_SEQUENCE);
+}
+
+#endif /* TAG_HPP */
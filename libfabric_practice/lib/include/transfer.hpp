@@ -0,0 +1,142 @@
+#ifndef TRANSFER_HPP
+#define TRANSFER_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_eq.h>
+
+#include "progress.hpp"
+#include "rma.hpp"
+#include "tag.hpp"
+
+#include <cstddef>
+#include <sys/types.h>
+
+class CreditLink;
+struct op_stats;
+
+/* The largest single message the engine sends, unless the provider's
+ * 'max_msg_size' is smaller. Both peers use the same value, since the
+ * receiver splits its buffer the same way the sender does. */
+constexpr size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+/* How many chunks may be in flight at once, unless the provider's queues are
+ * shallower than that. */
+constexpr size_t DEFAULT_WINDOW = 16;
+
+/* How a payload gets split up and how much of it may be in flight, and on
+ * an endpoint that isn't connected, which peer it goes to. With 'tagged'
+ * set, messages are sent and received with 'fi_tsend()' and 'fi_trecv()' on
+ * the streams of 'tag.hpp' instead. */
+struct transfer_config {
+	size_t chunk_size = DEFAULT_CHUNK_SIZE;
+	size_t window = DEFAULT_WINDOW;
+	fi_addr_t dest_addr = FI_ADDR_UNSPEC;
+	bool tagged = false;
+
+	/* If set, every message sent carries it as remote CQ data, frame
+	 * headers go in front of their payloads instead. A server with a shared
+	 * receive context hands its clients one each, so it can tell whose a
+	 * message is. */
+	uint64_t source = 0;
+
+	/* If set, posts that had to wait are counted there. Only the thread
+	 * that owns it may post with this config. */
+	op_stats* stats = nullptr;
+};
+
+/* Fit the requested chunk size and window to what the provider in 'info'
+ * supports: chunks no bigger than 'ep_attr->max_msg_size', and no more
+ * in-flight operations than 'tx_attr->size' and 'rx_attr->size' allow. */
+transfer_config make_transfer_config(const fi_info* info,
+		size_t chunk_size = DEFAULT_CHUNK_SIZE, size_t window = DEFAULT_WINDOW);
+
+/* Moves one buffer across an endpoint as a series of chunk-sized messages,
+ * keeping up to a window of them posted at a time. The receiving side posts
+ * its chunks straight into the destination buffer at the matching offsets,
+ * and since a connected endpoint matches receives in the order they were
+ * posted, the payload is reassembled in place as the chunks land. Tagged
+ * chunks carry their index on the 'BULK' stream instead, so each one only
+ * matches the receive at its own offset, whatever order they land in, and
+ * frames can't be mistaken for them.
+ *
+ * 'WRITE' and 'READ' move the buffer to or from a peer's 'rma_window' with
+ * 'fi_write()' and 'fi_read()' instead, chunk by chunk at the same offsets.
+ * The peer posts nothing for those, and both complete on the transmit queue.
+ *
+ * The transfer doesn't read any completion queue itself. Whoever owns the
+ * queue reports completed chunks through 'complete()', which slides the
+ * window forward. That way it fits in the server's event loop just as well
+ * as in a blocking call.
+ *
+ * Tagged transfers can run under a 'CreditLink'. Every chunk sent takes a
+ * credit then, and the rest wait until the peer grants more, every chunk
+ * receive posted grants the peer one, and sent chunks piggy-back whatever
+ * the link grants the other way. A sender that ran out has to be posted
+ * again once credits come in. */
+class ChunkedTransfer {
+public:
+	enum class direction { SEND, RECV, WRITE, READ };
+
+	/* 'context' is passed along with every chunk that gets posted. 'remote'
+	 * is the peer's window for 'WRITE' and 'READ', and is ignored
+	 * otherwise. */
+	ChunkedTransfer(direction dir, fid_ep* endpoint, void* buf, size_t len,
+			void* desc, const transfer_config& config, void* context = nullptr,
+			const rma_window& remote = {});
+
+	/* Post chunks until the window is full or nothing is left to post.
+	 * Returns 0, or a negative libfabric error code. Running out of room in
+	 * the provider's queue ('-FI_EAGAIN') isn't an error, the rest of the
+	 * window just gets posted on a later call. */
+	ssize_t post();
+
+	/* Run under 'link' from now on. */
+	void use_credits(CreditLink* link) { credits = link; }
+
+	/* Account for 'count' chunks that completed, and refill the window. */
+	ssize_t complete(size_t count);
+
+	bool done() const { return completed == total_chunks; }
+	size_t in_flight() const { return posted - completed; }
+	size_t chunks() const { return total_chunks; }
+
+private:
+	direction dir;
+	fid_ep* endpoint;
+	char* buf;
+	size_t len;
+	void* desc;
+	transfer_config config;
+	void* context;
+	rma_window remote;
+	CreditLink* credits = nullptr;
+
+	size_t total_chunks;
+	size_t posted = 0;
+	size_t completed = 0;
+	bool stalled = false; /* The last post got '-FI_EAGAIN'. */
+};
+
+/* Drive a send and a receive (either can be nullptr) to completion, reading
+ * their completions off of 'transmit_queue' and 'recv_queue'. The two run at
+ * the same time, so both directions of the link stay busy. Every completion
+ * on those queues is assumed to belong to these transfers, or with
+ * 'credits', to be an update of the link's. Waits go through 'waiter' if
+ * there is one, and otherwise block in 'fi_cq_sread()'. Returns 0, or a
+ * negative libfabric error code.
+ *
+ * With 'credits', both transfers have to run under it already, and the
+ * receive queue has to be opened with 'FI_CQ_FORMAT_DATA'. */
+ssize_t run_transfers(ChunkedTransfer* send, fid_cq* transmit_queue,
+		ChunkedTransfer* recv, fid_cq* recv_queue,
+		CompletionWaiter* waiter = nullptr, CreditLink* credits = nullptr);
+
+/* Blocking conveniences around 'ChunkedTransfer' for a single direction. */
+ssize_t send_chunked(fid_ep* endpoint, fid_cq* transmit_queue,
+		const void* buf, size_t len, void* desc, const transfer_config& config);
+ssize_t recv_chunked(fid_ep* endpoint, fid_cq* recv_queue, void* buf,
+		size_t len, void* desc, const transfer_config& config);
+
+#endif /* TRANSFER_HPP */
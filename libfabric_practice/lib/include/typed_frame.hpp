@@ -0,0 +1,135 @@
+#ifndef TYPED_FRAME_HPP
+#define TYPED_FRAME_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+#include <rdma/fi_endpoint.h>
+
+#include "buffer_pool.hpp"
+#include "frame.hpp"
+#include "transfer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <sys/types.h>
+#include <type_traits>
+
+/* Frames up to this big, header included, are injected. Both programs ask
+ * for at least this much 'tx_attr->inject_size' in their hints, so no
+ * provider that couldn't take them is ever picked, and whether a typed frame
+ * is injected is known before it is built. */
+constexpr size_t TYPED_INJECT_SIZE = 64;
+
+/* Frames up to this big, header included, are copied whole into their slot
+ * and sent as one message. A page is well under any provider's
+ * 'max_msg_size'. */
+constexpr size_t TYPED_EAGER_SIZE = 4096;
+
+static_assert(TYPED_INJECT_SIZE <= TYPED_EAGER_SIZE &&
+		TYPED_EAGER_SIZE <= FRAME_SIZE, "typed frames have to fit a frame");
+
+/* How a typed payload goes out. */
+enum class wire_protocol {
+	INJECT,	/* Header and payload in one 'fi_inject()'. Nothing completes. */
+	EAGER,	/* Header and payload in one send, out of the frame slot. */
+	CHUNKED	/* 'post_frame()', and the remainder as a 'ChunkedTransfer'. */
+};
+
+/* The protocol for a payload of 'length' bytes. */
+constexpr wire_protocol protocol_for(size_t length) {
+	if (sizeof(frame_header) + length <= TYPED_INJECT_SIZE)
+		return wire_protocol::INJECT;
+	if (sizeof(frame_header) + length <= TYPED_EAGER_SIZE)
+		return wire_protocol::EAGER;
+	return wire_protocol::CHUNKED;
+}
+
+/* Whether sending 'N' of 'T' in a frame reports a completion. Only injected
+ * frames don't. */
+template <typename T, size_t N = 1>
+constexpr bool typed_frame_completes =
+	protocol_for(sizeof(T) * N) != wire_protocol::INJECT;
+
+/* Send 'payload' as a frame of 'Type'. With a fixed extent, the protocol,
+ * the frame's length and all of its header but the sequence number are
+ * settled at compile time, so a small fixed-size frame is a copy and one
+ * 'fi_inject()', with no size checks and no branches on the way. An injected
+ * frame is built on the stack and leaves 'slot' alone. An eager one is built
+ * in 'slot', which has to be a frame slot, and stays in use until the send
+ * completes.
+ *
+ * Anything else, whether too big for an eager frame or only sized at run
+ * time, goes through 'post_frame()', which makes the same choices as the
+ * payload comes in.
+ *
+ * Returns what 'post_frame()' does: how many payload bytes went out with the
+ * frame, or a negative libfabric error code. The rest is for the caller to
+ * send as a 'ChunkedTransfer', and only a 'CHUNKED' payload ever has any. */
+template <frame_type Type, typename T, size_t N>
+ssize_t send_typed(fid_ep* endpoint, const fi_info* info, buffer_slab* slot,
+		uint32_t sequence, std::span<const T, N> payload, void* payload_desc,
+		void* context, const transfer_config& config = transfer_config()) {
+	static_assert(std::is_trivially_copyable_v<T>, "frames are raw bytes");
+
+	if constexpr (N == std::dynamic_extent ||
+			protocol_for(sizeof(T) * N) == wire_protocol::CHUNKED) {
+		return post_frame(endpoint, info, slot, Type, sequence,
+				payload.data(), payload.size_bytes(), payload_desc, context,
+				config);
+	} else {
+		constexpr size_t length = sizeof(T) * N;
+		constexpr size_t frame_len = sizeof(frame_header) + length;
+		constexpr bool inject =
+			protocol_for(length) == wire_protocol::INJECT;
+
+		alignas(frame_header) char stack_frame[inject ? frame_len : 1];
+		char* frame = inject ? stack_frame : slot->data;
+
+		const frame_header header = make_frame_header(Type, length, sequence);
+		std::memcpy(frame, &header, sizeof(frame_header));
+		if constexpr (length > 0)
+			std::memcpy(frame + sizeof(frame_header), payload.data(), length);
+
+		ssize_t ret = post_whole_frame(endpoint, frame, frame_len,
+				inject ? nullptr : slot->desc, sequence, inject, context,
+				config);
+		return ret < 0 ? ret : static_cast<ssize_t>(length);
+	}
+}
+
+/* Send one 'value' as a frame of 'Type'. */
+template <frame_type Type, typename T>
+ssize_t send_value(fid_ep* endpoint, buffer_slab* slot, uint32_t sequence,
+		const T& value, void* context,
+		const transfer_config& config = transfer_config()) {
+	static_assert(protocol_for(sizeof(T)) != wire_protocol::CHUNKED,
+			"a single value has to fit in an eager frame");
+	return send_typed<Type>(endpoint, nullptr, slot, sequence,
+			std::span<const T, 1>(&value, 1), nullptr, context, config);
+}
+
+/* Copy the payload of 'frame' into 'out', if it is exactly as big as 'out'
+ * and came whole in the frame. Returns false if it isn't. */
+template <typename T, size_t N>
+bool read_typed(const frame_view& frame, std::span<T, N> out) {
+	static_assert(std::is_trivially_copyable_v<T>, "frames are raw bytes");
+	static_assert(N != std::dynamic_extent, "the size has to be fixed");
+
+	constexpr size_t length = sizeof(T) * N;
+	if (frame.header.length != length || frame.in_frame != length)
+		return false;
+
+	if constexpr (length > 0)
+		std::memcpy(out.data(), frame.payload, length);
+	return true;
+}
+
+/* Copy the payload of 'frame' into 'value'. */
+template <typename T>
+bool read_value(const frame_view& frame, T& value) {
+	return read_typed(frame, std::span<T, 1>(&value, 1));
+}
+
+#endif /* TYPED_FRAME_HPP */
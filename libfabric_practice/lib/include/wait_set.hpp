@@ -0,0 +1,57 @@
+#ifndef WAIT_SET_HPP
+#define WAIT_SET_HPP
+
+/* Libfabric libraries. */
+#include <rdma/fabric.h>
+
+#include <cstddef>
+#include <vector>
+
+/* How many ready file descriptors one 'epoll_wait()' reports at most. The
+ * caller polls its queues after every wait anyway, so this only has to be
+ * big enough to not wake it twice for the same burst. */
+constexpr size_t WAIT_SET_EVENTS = 64;
+
+/* Sleeps on any number of event and completion queues at once, from one
+ * thread. Every queue is opened with 'FI_WAIT_FD' and hands over its file
+ * descriptor ('fi_control(FI_GETWAIT)'), and they all go in one 'epoll'
+ * instance. One thread can then sleep on every connection it serves, next to
+ * anything else with a file descriptor, costs nothing while they are quiet,
+ * and wakes as soon as any of them has something.
+ *
+ * A descriptor being readable only means something might have happened since
+ * the provider was last asked. Some providers need to be driven before they
+ * signal, so every sleep starts with 'fi_trywait()' over every queue, and
+ * doesn't sleep at all if something is already waiting.
+ *
+ * The set isn't thread-safe. */
+class FdWaitSet {
+public:
+	explicit FdWaitSet(fid_fabric* fabric);
+	~FdWaitSet();
+
+	FdWaitSet(const FdWaitSet&) = delete;
+	FdWaitSet& operator=(const FdWaitSet&) = delete;
+
+	/* Start watching 'queue', an event or completion queue opened with
+	 * 'FI_WAIT_FD'. Returns 0, or a negative libfabric error code. */
+	int add(fid_t queue);
+
+	/* Stop watching 'queue'. Has to be done before it is closed. */
+	void remove(fid_t queue);
+
+	/* Sleep until one of the queues might have something, or 'timeout_ms'
+	 * milliseconds pass (-1 waits for good). Returns how many descriptors
+	 * woke it up, 0 if it timed out or didn't have to sleep, or a negative
+	 * libfabric error code. */
+	int wait(int timeout_ms);
+
+	size_t size() const { return queues.size(); }
+
+private:
+	fid_fabric* fabric;
+	int epoll_fd = -1;
+	std::vector<fid_t> queues;
+};
+
+#endif /* WAIT_SET_HPP */
@@ -0,0 +1,234 @@
+#include "async.hpp"
+#include "err.hpp"
+
+#include <rdma/fi_errno.h>
+
+#include <algorithm>
+#include <utility>
+
+/* How many completions are pulled off of a queue per read. */
+static constexpr size_t COMPLETIONS_PER_READ = 16;
+
+Task::Task(Task&& other) noexcept :
+	coroutine(std::exchange(other.coroutine, nullptr)) {}
+
+Task& Task::operator=(Task&& other) noexcept {
+	if (this != &other) {
+		if (coroutine)
+			coroutine.destroy();
+		coroutine = std::exchange(other.coroutine, nullptr);
+	}
+	return *this;
+}
+
+Task::~Task() {
+	if (coroutine)
+		coroutine.destroy();
+}
+
+/* Post the operation, or queue it up behind the ones before it. */
+bool AsyncOp::await_suspend(std::coroutine_handle<> coroutine) {
+	waiting = coroutine;
+	return scheduler.submit(*this);
+}
+
+AsyncSend::AsyncSend(CqScheduler& scheduler, fid_ep* endpoint,
+		const void* buf, size_t len, void* desc, bool inject,
+		fi_addr_t dest_addr) :
+	AsyncOp(scheduler, true, len),
+	endpoint(endpoint),
+	buf(buf),
+	desc(desc),
+	inject(inject),
+	dest_addr(dest_addr) {}
+
+ssize_t AsyncSend::post() {
+	if (inject) {
+		ssize_t ret = fi_inject(endpoint, buf, length(), dest_addr);
+		return ret < 0 ? ret : 1;
+	}
+
+	return fi_send(endpoint, buf, length(), desc, dest_addr, this);
+}
+
+AsyncRecv::AsyncRecv(CqScheduler& scheduler, fid_ep* endpoint, void* buf,
+		size_t len, void* desc, fi_addr_t src_addr) :
+	AsyncOp(scheduler, false, len),
+	endpoint(endpoint),
+	buf(buf),
+	desc(desc),
+	src_addr(src_addr) {}
+
+ssize_t AsyncRecv::post() {
+	return fi_recv(endpoint, buf, length(), desc, src_addr, this);
+}
+
+AsyncRma::AsyncRma(CqScheduler& scheduler, direction dir, fid_ep* endpoint,
+		void* buf, size_t len, void* desc, const rma_window& remote,
+		uint64_t offset, fi_addr_t dest_addr) :
+	AsyncOp(scheduler, true, len),
+	dir(dir),
+	endpoint(endpoint),
+	buf(buf),
+	desc(desc),
+	remote(remote),
+	offset(offset),
+	dest_addr(dest_addr) {}
+
+ssize_t AsyncRma::post() {
+	if (dir == direction::WRITE)
+		return fi_write(endpoint, buf, length(), desc, dest_addr,
+				remote.addr + offset, remote.key, this);
+
+	return fi_read(endpoint, buf, length(), desc, dest_addr,
+			remote.addr + offset, remote.key, this);
+}
+
+CqScheduler::CqScheduler(fid_cq* transmit_queue, fid_cq* recv_queue,
+		CompletionWaiter& waiter) :
+	transmit_queue(transmit_queue),
+	recv_queue(recv_queue),
+	waiter(waiter) {}
+
+/* Start a task, and let it run up to its first operation. */
+void CqScheduler::spawn(Task task) {
+	std::coroutine_handle<> coroutine = task.coroutine;
+	tasks.push_back(std::move(task));
+	coroutine.resume();
+}
+
+/* Post an operation, unless older ones are still waiting to be. Receives
+ * have to be posted in the order they were awaited in, since that is the
+ * order messages land in them. */
+bool CqScheduler::submit(AsyncOp& op) {
+	if (!backlog.empty()) {
+		backlog.push_back(&op);
+		return true;
+	}
+
+	ssize_t ret = op.post();
+	if (ret == -FI_EAGAIN) {
+		backlog.push_back(&op);
+		return true;
+	}
+	if (ret != 0) {
+		op.result = ret < 0 ? ret : static_cast<ssize_t>(op.len);
+		return false;
+	}
+
+	/* Nobody is waiting on an operation posted from outside a coroutine, so
+	 * its completion is left to whoever posted it. */
+	if (op.waiting)
+		(op.transmit ? transmit_in_flight : recv_in_flight)++;
+	return true;
+}
+
+/* An operation is done: hand its coroutine the result, and let it go on. */
+void CqScheduler::finish(AsyncOp& op, ssize_t result) {
+	op.result = result;
+	if (op.waiting)
+		std::exchange(op.waiting, nullptr).resume();
+}
+
+/* Read up to as many completions as there are operations in flight on
+ * 'queue', and resume their coroutines. */
+ssize_t CqScheduler::drain(fid_cq* queue, size_t& in_flight, bool block) {
+	if (in_flight == 0)
+		return 0;
+
+	fi_cq_data_entry entries[COMPLETIONS_PER_READ];
+	size_t count = std::min(in_flight, COMPLETIONS_PER_READ);
+	ssize_t read = block ? waiter.wait(queue, entries, count) :
+		fi_cq_read(queue, entries, count);
+	if (read == -FI_EAGAIN)
+		return 0;
+
+	/* An error entry has to be read on its own, and fails the operation it
+	 * belongs to. */
+	if (read == -FI_EAVAIL) {
+		fi_cq_err_entry error_entry = check_cq_error(queue);
+		in_flight--;
+		if (error_entry.op_context)
+			finish(*static_cast<AsyncOp*>(error_entry.op_context),
+					-static_cast<ssize_t>(error_entry.err));
+		return 1;
+	}
+
+	if (read < 0)
+		return read;
+
+	/* The counts go down before any coroutine runs, since it may well post
+	 * its next operation right away. */
+	in_flight -= static_cast<size_t>(read);
+	for (ssize_t i = 0; i < read; i++) {
+		AsyncOp& op = *static_cast<AsyncOp*>(entries[i].op_context);
+		op.entry = entries[i];
+		finish(op, op.transmit ? static_cast<ssize_t>(op.len) :
+				static_cast<ssize_t>(entries[i].len));
+	}
+
+	return read;
+}
+
+/* Post what is waiting to be, then reap both queues. */
+ssize_t CqScheduler::poll() {
+	ssize_t resumed = 0;
+	while (!backlog.empty()) {
+		AsyncOp& op = *backlog.front();
+		ssize_t ret = op.post();
+		if (ret == -FI_EAGAIN)
+			break;
+		backlog.pop_front();
+
+		if (ret == 0) {
+			if (op.waiting)
+				(op.transmit ? transmit_in_flight : recv_in_flight)++;
+			continue;
+		}
+
+		finish(op, ret < 0 ? ret : static_cast<ssize_t>(op.len));
+		resumed++;
+	}
+
+	ssize_t read = drain(transmit_queue, transmit_in_flight, false);
+	if (read < 0)
+		return read;
+	resumed += read;
+
+	read = drain(recv_queue, recv_in_flight, false);
+	if (read < 0)
+		return read;
+	return resumed + read;
+}
+
+/* Keep passing until every task is done. */
+ssize_t CqScheduler::run() {
+	for (;;) {
+		std::erase_if(tasks, [](const Task& task) { return task.done(); });
+		if (tasks.empty())
+			return 0;
+
+		ssize_t resumed = poll();
+		if (resumed < 0)
+			return resumed;
+		if (resumed > 0) {
+			waiter.reset();
+			continue;
+		}
+
+		/* With operations in flight on only one of the queues, and nothing
+		 * left to post, it is safe to wait on that queue the waiter's way.
+		 * Otherwise, back off and look at both again. */
+		const bool transmitting = transmit_in_flight > 0;
+		const bool receiving = recv_in_flight > 0;
+		if (backlog.empty() && transmitting != receiving) {
+			resumed = transmitting ?
+				drain(transmit_queue, transmit_in_flight, true) :
+				drain(recv_queue, recv_in_flight, true);
+			if (resumed < 0)
+				return resumed;
+		} else {
+			waiter.idle();
+		}
+	}
+}
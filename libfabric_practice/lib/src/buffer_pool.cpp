@@ -0,0 +1,147 @@
+#include "buffer_pool.hpp"
+#include "err.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+/* Unless the provider hands out its own keys ('FI_MR_PROV_KEY'), every memory
+ * region in a domain needs a key the application picked that isn't in use by
+ * any other region. */
+static std::atomic<uint64_t> next_requested_key{1};
+
+uint64_t requested_mr_key() {
+	return next_requested_key++;
+}
+
+BufferPool::BufferPool(fid_domain* domain, size_t slab_size, size_t slab_count,
+		uint64_t access) :
+	domain(domain),
+	slab_bytes((slab_size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1)),
+	slabs_per_arena(slab_count > 0 ? slab_count : 1),
+	access(access) {
+	/* If this fails, the pool starts out empty, and the first slab asked
+	 * for tries again. */
+	grow();
+}
+
+BufferPool::~BufferPool() {
+	/* Memory regions have to be closed before the memory under them can be
+	 * handed back. */
+	for (arena* a : arenas) {
+		check_libfabric(fi_close(&a->mr->fid), "fi_close(), buffer_pool mr");
+		std::free(a->memory);
+		delete a;
+	}
+}
+
+/* Allocate and register an arena of 'slab_count' slabs of 'bytes_per_slab'
+ * each. */
+ssize_t BufferPool::register_arena(size_t bytes_per_slab, size_t slab_count,
+		arena*& registered) {
+	size_t arena_bytes = bytes_per_slab * slab_count;
+
+	char* memory = static_cast<char*>(std::aligned_alloc(CACHE_LINE_SIZE,
+				arena_bytes));
+	if (!memory)
+		return -FI_ENOMEM;
+
+	/* Register the whole arena in one go. Every slab shares its descriptor,
+	 * since the descriptor covers any address inside of the region. */
+	fid_mr* mr = nullptr;
+	int ret = fi_mr_reg(domain, memory, arena_bytes, access, 0,
+			requested_mr_key(), 0, &mr, nullptr);
+	if (ret < 0) {
+		std::free(memory);
+		return ret;
+	}
+
+	arena* a = new arena;
+	a->memory = memory;
+	a->mr = mr;
+	void* desc = fi_mr_desc(a->mr);
+
+	a->slabs.resize(slab_count);
+	for (size_t i = 0; i < slab_count; i++) {
+		a->slabs[i].data = a->memory + i * bytes_per_slab;
+		a->slabs[i].size = bytes_per_slab;
+		a->slabs[i].desc = desc;
+	}
+
+	arenas.push_back(a);
+	registered = a;
+	return 0;
+}
+
+/* Register another arena, and put all of its slabs on the free list. */
+ssize_t BufferPool::grow() {
+	arena* a = nullptr;
+	ssize_t ret = register_arena(slab_bytes, slabs_per_arena, a);
+	if (ret < 0)
+		return ret;
+
+	/* Hand the slabs out lowest address first. */
+	free_slabs.reserve(free_slabs.size() + slabs_per_arena);
+	for (size_t i = slabs_per_arena; i > 0; i--)
+		free_slabs.push_back(&a->slabs[i - 1]);
+	return 0;
+}
+
+/* Take a slab out of the pool. */
+buffer_slab* BufferPool::acquire() {
+	if (free_slabs.empty())
+		check_libfabric(static_cast<int>(grow()), "grow(), buffer_pool");
+
+	buffer_slab* slab = free_slabs.back();
+	free_slabs.pop_back();
+	return slab;
+}
+
+/* Take a slab out of the pool, if it can be had. */
+buffer_slab* BufferPool::try_acquire() {
+	if (free_slabs.empty() && grow() < 0)
+		return nullptr;
+	return acquire();
+}
+
+/* Take a slab of at least 'bytes' out of the pool. */
+buffer_slab* BufferPool::acquire(size_t bytes) {
+	if (bytes <= slab_bytes)
+		return try_acquire();
+
+	/* Rounding this up to a whole cache line would wrap around. */
+	if (bytes > SIZE_MAX - (CACHE_LINE_SIZE - 1))
+		return nullptr;
+
+	/* Reuse the smallest oversized slab that is big enough. */
+	auto best = free_large_slabs.end();
+	for (auto it = free_large_slabs.begin(); it != free_large_slabs.end();
+			it++) {
+		if ((*it)->size >= bytes &&
+				(best == free_large_slabs.end() || (*it)->size < (*best)->size))
+			best = it;
+	}
+
+	if (best != free_large_slabs.end()) {
+		buffer_slab* slab = *best;
+		free_large_slabs.erase(best);
+		return slab;
+	}
+
+	size_t rounded = (bytes + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+	arena* a = nullptr;
+	if (register_arena(rounded, 1, a) < 0)
+		return nullptr;
+	return &a->slabs[0];
+}
+
+/* Give a slab back. */
+void BufferPool::release(buffer_slab* slab) {
+	if (!slab)
+		return;
+
+	if (slab->size > slab_bytes)
+		free_large_slabs.push_back(slab);
+	else
+		free_slabs.push_back(slab);
+}
@@ -0,0 +1,61 @@
+#include "completion.hpp"
+#include "err.hpp"
+
+CompletionDispatcher::CompletionDispatcher(fid_cq* queue, size_t batch,
+		resolver resolve, void* arg) :
+	queue(queue),
+	resolve(resolve),
+	arg(arg),
+	entries(batch > 0 ? batch : 1) {}
+
+/* Find the handler of the operation a context belongs to. */
+CompletionHandler* CompletionDispatcher::find(void* context) const {
+	if (resolve)
+		return resolve(context, arg);
+
+	return static_cast<CompletionHandler*>(context);
+}
+
+/* Hand what one read returned to the handlers. */
+ssize_t CompletionDispatcher::dispatch(ssize_t read) {
+	if (read == -FI_EAGAIN)
+		return 0;
+	read_calls++;
+
+	if (read == -FI_EAVAIL) {
+		/* An error entry is at the front of the queue, and has to be read
+		 * on its own before anything behind it can be. */
+		fi_cq_err_entry error_entry = check_cq_error(queue);
+		if (stats)
+			stats->count_error(error_entry.err);
+		CompletionHandler* handler = find(error_entry.op_context);
+		if (handler)
+			handler->on_error(error_entry);
+		dispatched++;
+		return 1;
+	}
+
+	if (read < 0)
+		return read;
+	if (stats)
+		op_stats::raise(stats->cq_depth_max, static_cast<uint64_t>(read));
+
+	for (ssize_t i = 0; i < read; i++) {
+		CompletionHandler* handler = find(entries[i].op_context);
+		if (handler && !handler->on_completion(entries[i]))
+			break;
+	}
+
+	dispatched += static_cast<uint64_t>(read);
+	return read;
+}
+
+/* Read one batch without blocking, and dispatch it. */
+ssize_t CompletionDispatcher::poll() {
+	return dispatch(fi_cq_read(queue, entries.data(), entries.size()));
+}
+
+/* Wait for at least one completion, and dispatch what came. */
+ssize_t CompletionDispatcher::wait(CompletionWaiter& waiter) {
+	return dispatch(waiter.wait(queue, entries.data(), entries.size()));
+}
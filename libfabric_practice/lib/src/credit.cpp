@@ -0,0 +1,71 @@
+#include "credit.hpp"
+#include "tag.hpp"
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_tagged.h>
+
+#include <cstring>
+
+CreditLink::CreditLink(fid_ep* endpoint, const fi_info* info,
+		buffer_slab* slot, const transfer_config& config, void* context) :
+	endpoint(endpoint),
+	slot(slot),
+	config(config),
+	context(context ? context : this),
+	cq_data(config.source == 0 && info && info->domain_attr &&
+			info->domain_attr->cq_data_size >= sizeof(uint64_t)) {}
+
+/* Post the receive for the next update. Any update of the stream will do,
+ * since each one carries the whole total. */
+ssize_t CreditLink::post() {
+	return fi_trecv(endpoint, slot->data, sizeof(uint64_t), slot->desc,
+			config.dest_addr, stream_tag(stream_id::CREDIT), ANY_SEQUENCE,
+			context);
+}
+
+/* Take a credit for the next chunk, if there is one. */
+bool CreditLink::take() {
+	if (available() == 0)
+		return false;
+
+	taken++;
+	return true;
+}
+
+/* Totals only ever grow, but they can land out of order. */
+void CreditLink::receive_grant(uint64_t total) {
+	peer_granted = std::max(peer_granted, total);
+}
+
+/* Take in an update, and make room for the next one. */
+ssize_t CreditLink::take_update() {
+	uint64_t total = 0;
+	std::memcpy(&total, slot->data, sizeof(uint64_t));
+	receive_grant(total);
+	return post();
+}
+
+/* Take in a piggy-backed total. */
+void CreditLink::take_piggyback(uint64_t flags, uint64_t data) {
+	if (cq_data && (flags & FI_REMOTE_CQ_DATA))
+		receive_grant(data);
+}
+
+/* Inject whatever is still due. The provider copies it out right away, so
+ * the total can come straight off of the stack. */
+ssize_t CreditLink::flush() {
+	if (!due())
+		return 0;
+
+	const uint64_t total = granted;
+	ssize_t ret = fi_tinject(endpoint, &total, sizeof(uint64_t),
+			config.dest_addr, stream_tag(stream_id::CREDIT, updates));
+	if (ret == -FI_EAGAIN)
+		return 0;
+	if (ret < 0)
+		return ret;
+
+	updates++;
+	announced = total;
+	return 0;
+}
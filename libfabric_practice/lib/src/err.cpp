@@ -14,10 +14,37 @@ void check_libfabric(int code, const char* message) {
 }
 
 /* Perform error checking for specific event queues. */
-void check_eq_error(fid_eq* event_queue) {
+fi_eq_err_entry check_eq_error(fid_eq* event_queue) {
 	struct fi_eq_err_entry error_entry = {};
-	fi_eq_readerr(event_queue, &error_entry, 0); /* Read the EQ. */
+	if (fi_eq_readerr(event_queue, &error_entry, 0) < 0) { /* Read the EQ. */
+		std::cerr << "fi_eq_readerr(): nothing to read." << std::endl;
+		error_entry = {};
+		error_entry.err = FI_EOTHER;
+		return error_entry;
+	}
 
 	std::cerr << "Event queue error: " << fi_strerror(error_entry.err) <<
 		", Data size: " << error_entry.err_data_size << std::endl;
+	return error_entry;
+}
+
+/* Perform error checking for specific completion queues. */
+fi_cq_err_entry check_cq_error(fid_cq* completion_queue) {
+	fi_cq_err_entry error_entry = {};
+	if (fi_cq_readerr(completion_queue, &error_entry, 0) < 0) {
+		std::cerr << "fi_cq_readerr(): nothing to read." << std::endl;
+		error_entry.err = FI_EOTHER;
+		return error_entry;
+	}
+
+	/* The provider's own error number says more than the generic one. */
+	char provider_message[256] = {};
+	const char* provider_error = fi_cq_strerror(completion_queue,
+			error_entry.prov_errno, error_entry.err_data, provider_message,
+			sizeof(provider_message));
+
+	std::cerr << "Completion queue error: " << fi_strerror(error_entry.err) <<
+		" (" << (provider_error ? provider_error : "unknown") << ")" <<
+		std::endl;
+	return error_entry;
 }
@@ -0,0 +1,245 @@
+#include "exporter.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <poll.h>
+#include <pthread.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* How long the exporter sleeps between looks at the signal flag, how long a
+ * client of the socket gets to say which format it wants, and how long it
+ * gets to read all of its report. */
+static constexpr int EXPORTER_POLL_MS = 200;
+static constexpr int EXPORTER_REQUEST_MS = 100;
+static constexpr int EXPORTER_SEND_MS = 1000;
+
+/* Set by the signal handler, and taken by the exporter's thread. It has to be
+ * lock-free to be touched from a signal handler at all. */
+static std::atomic<bool> dump_requested{false};
+static_assert(std::atomic<bool>::is_always_lock_free,
+		"dump_requested is set from a signal handler");
+
+static void request_dump(int) {
+	dump_requested.store(true, std::memory_order_relaxed);
+}
+
+/* Numbers go out as they are, counters without a decimal point. */
+static std::string format_value(double value) {
+	std::ostringstream out;
+	out << std::setprecision(15) << value;
+	return out.str();
+}
+
+/* Escape a string for a Prometheus label value or a JSON string, which both
+ * take the same backslash escapes for what a label can hold. */
+static std::string escape(const std::string& text) {
+	std::string escaped;
+	escaped.reserve(text.size());
+	for (char c : text) {
+		if (c == '\\' || c == '"')
+			escaped += '\\';
+		if (c == '\n') {
+			escaped += "\\n";
+			continue;
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+void MetricsReport::describe(const std::string& name, const char* type,
+		const char* help) {
+	family described;
+	described.name = name;
+	described.type = type;
+	described.help = help;
+	families.push_back(std::move(described));
+}
+
+void MetricsReport::add(const std::string& name,
+		const labels& sample_labels, double value, const char* suffix) {
+	for (family& described : families) {
+		if (described.name != name)
+			continue;
+
+		sample added;
+		added.name = name + suffix;
+		added.sample_labels = sample_labels;
+		added.value = value;
+		described.samples.push_back(std::move(added));
+		return;
+	}
+}
+
+std::string MetricsReport::prometheus() const {
+	std::ostringstream out;
+	for (const family& described : families) {
+		out << "# HELP " << described.name << " " << described.help << "\n";
+		out << "# TYPE " << described.name << " " << described.type << "\n";
+		for (const sample& value : described.samples) {
+			out << value.name;
+			if (!value.sample_labels.empty()) {
+				out << "{";
+				for (size_t i = 0; i < value.sample_labels.size(); i++)
+					out << (i > 0 ? "," : "") << value.sample_labels[i].first <<
+						"=\"" << escape(value.sample_labels[i].second) << "\"";
+				out << "}";
+			}
+			out << " " << format_value(value.value) << "\n";
+		}
+	}
+	return out.str();
+}
+
+std::string MetricsReport::json() const {
+	std::ostringstream out;
+	out << "{\"metrics\":[";
+	bool first = true;
+	for (const family& described : families) {
+		for (const sample& value : described.samples) {
+			out << (first ? "" : ",") << "{\"name\":\"" << value.name <<
+				"\",\"type\":\"" << described.type << "\",\"labels\":{";
+			for (size_t i = 0; i < value.sample_labels.size(); i++)
+				out << (i > 0 ? "," : "") << "\"" <<
+					value.sample_labels[i].first << "\":\"" <<
+					escape(value.sample_labels[i].second) << "\"";
+			out << "},\"value\":" << format_value(value.value) << "}";
+			first = false;
+		}
+	}
+	out << "]}";
+	return out.str();
+}
+
+/* Take the signal over, bind the socket, and start the thread. */
+MetricsExporter::MetricsExporter(collector collect, const std::string& path) :
+	collect(std::move(collect)),
+	path(path) {
+	struct sigaction action = {};
+	action.sa_handler = request_dump;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, nullptr);
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+	if (!path.empty())
+		listener = listen_on(path);
+	thread = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+	stopping.store(true, std::memory_order_relaxed);
+	thread.join();
+
+	if (listener >= 0) {
+		close(listener);
+		unlink(path.c_str());
+	}
+}
+
+/* Bind a Unix socket at 'socket_path', in place of whatever a previous run
+ * left there. Returns the socket, or -1 if it couldn't be. */
+int MetricsExporter::listen_on(const std::string& socket_path) {
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Metrics socket " << socket_path << ": path too long." <<
+			std::endl;
+		return -1;
+	}
+	std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0) {
+		unlink(socket_path.c_str());
+		if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+				listen(fd, 4) == 0)
+			return fd;
+	}
+
+	std::cerr << "Metrics socket " << socket_path << ": " <<
+		std::strerror(errno) << std::endl;
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+/* Wait for the signal or a client, and answer whichever shows up. */
+void MetricsExporter::run() {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+
+	while (!stopping.load(std::memory_order_relaxed)) {
+		pollfd socket_fd = {};
+		socket_fd.fd = listener;
+		socket_fd.events = POLLIN;
+		int ready = poll(&socket_fd, listener >= 0 ? 1 : 0, EXPORTER_POLL_MS);
+
+		if (dump_requested.exchange(false, std::memory_order_relaxed))
+			std::cout << collect().json() << std::endl;
+
+		if (ready > 0 && (socket_fd.revents & POLLIN)) {
+			int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+			if (client >= 0) {
+				serve(client);
+				close(client);
+			}
+		}
+	}
+}
+
+/* Give a client of the socket a moment to ask for JSON, then send it a
+ * report. Sends never block, so a client that stops reading is dropped once
+ * its time is up, and can't hold up the signal, other clients or stop(). */
+void MetricsExporter::serve(int client) {
+	bool json = false;
+	pollfd request = {};
+	request.fd = client;
+	request.events = POLLIN;
+	if (poll(&request, 1, EXPORTER_REQUEST_MS) > 0) {
+		char line[64] = {};
+		ssize_t got = recv(client, line, sizeof(line) - 1, 0);
+		json = got >= 4 && std::strncmp(line, "json", 4) == 0;
+	}
+
+	MetricsReport report = collect();
+	const std::string text = json ? report.json() + "\n" :
+		report.prometheus();
+	const auto deadline = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(EXPORTER_SEND_MS);
+	for (size_t sent = 0; sent < text.size();) {
+		ssize_t ret = send(client, text.data() + sent, text.size() - sent,
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+					deadline - std::chrono::steady_clock::now()).count();
+			if (left <= 0 || stopping.load(std::memory_order_relaxed))
+				return;
+
+			pollfd room = {};
+			room.fd = client;
+			room.events = POLLOUT;
+			poll(&room, 1, static_cast<int>(
+					std::min<long long>(left, EXPORTER_POLL_MS)));
+			continue;
+		}
+		if (ret <= 0)
+			return;
+		sent += static_cast<size_t>(ret);
+	}
+}
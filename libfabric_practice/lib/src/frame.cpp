@@ -0,0 +1,183 @@
+#include "frame.hpp"
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_tagged.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sys/uio.h>
+
+/* A header packed into remote CQ data: the payload length in the top 32
+ * bits, then the sequence number in 24, and the type in the last 8. Frames
+ * with bigger values than that carry their header in front of the payload
+ * like any other. */
+static constexpr unsigned CQ_LENGTH_SHIFT = 32;
+static constexpr unsigned CQ_SEQUENCE_SHIFT = 8;
+static constexpr uint64_t CQ_SEQUENCE_MASK = (1ULL << 24) - 1;
+static constexpr uint64_t CQ_TYPE_MASK = (1ULL << 8) - 1;
+
+/* Whether the provider carries 64 bits of remote CQ data, and the header
+ * packs into them. */
+static bool header_fits_cq_data(const fi_info* info,
+		const frame_header& header) {
+	if (!info || !info->domain_attr ||
+			info->domain_attr->cq_data_size < sizeof(uint64_t))
+		return false;
+
+	return header.length <= std::numeric_limits<uint32_t>::max() &&
+		header.sequence <= CQ_SEQUENCE_MASK && header.type <= CQ_TYPE_MASK;
+}
+
+static uint64_t pack_header(const frame_header& header) {
+	return (header.length << CQ_LENGTH_SHIFT) |
+		(static_cast<uint64_t>(header.sequence) << CQ_SEQUENCE_SHIFT) |
+		header.type;
+}
+
+static frame_header unpack_header(uint64_t data) {
+	frame_header header = {};
+	header.length = data >> CQ_LENGTH_SHIFT;
+	header.sequence = static_cast<uint32_t>(
+			(data >> CQ_SEQUENCE_SHIFT) & CQ_SEQUENCE_MASK);
+	header.type = static_cast<uint16_t>(data & CQ_TYPE_MASK);
+	return header;
+}
+
+/* How many payload bytes fit in a frame behind its header. */
+size_t frame_capacity(const fi_info* info) {
+	size_t frame_size = FRAME_SIZE;
+	if (info && info->ep_attr && info->ep_attr->max_msg_size > 0)
+		frame_size = std::min(frame_size, info->ep_attr->max_msg_size);
+
+	return frame_size - sizeof(frame_header);
+}
+
+/* Whether the whole frame fits in 'tx_attr->inject_size'. */
+bool frame_fits_inject(const fi_info* info, size_t length) {
+	if (!info || !info->tx_attr || length > frame_capacity(info))
+		return false;
+
+	return sizeof(frame_header) + length <= info->tx_attr->inject_size;
+}
+
+/* Post one frame. */
+ssize_t post_frame(fid_ep* endpoint, const fi_info* info, buffer_slab* slot,
+		frame_type type, uint32_t sequence, const void* payload, size_t length,
+		void* payload_desc, void* context, const transfer_config& config) {
+	size_t inline_len = std::min(length, frame_capacity(info));
+	if (slot->size < sizeof(frame_header) + inline_len)
+		return -FI_ETOOSMALL;
+
+	frame_header* header = reinterpret_cast<frame_header*>(slot->data);
+	*header = make_frame_header(type, length, sequence);
+
+	const fi_addr_t dest_addr = config.dest_addr;
+	const uint64_t tag = stream_tag(stream_id::CONTROL, sequence);
+
+	/* Whether a frame is injected doesn't depend on where its header goes,
+	 * so callers can tell which frames complete either way. */
+	const bool inject = frame_fits_inject(info, length);
+
+	/* With a 'config.source', the remote CQ data already says who we are,
+	 * so the header can't go there. */
+	ssize_t ret = 0;
+	if (config.source == 0 && header_fits_cq_data(info, *header)) {
+		/* The header goes in the receiver's completion, so the payload
+		 * needs neither a copy nor a gather. */
+		const uint64_t data = pack_header(*header);
+		if (inject)
+			ret = config.tagged ?
+				fi_tinjectdata(endpoint, payload, inline_len, data, dest_addr,
+						tag) :
+				fi_injectdata(endpoint, payload, inline_len, data, dest_addr);
+		else
+			ret = config.tagged ?
+				fi_tsenddata(endpoint, payload, inline_len, payload_desc, data,
+						dest_addr, tag, context) :
+				fi_senddata(endpoint, payload, inline_len, payload_desc, data,
+						dest_addr, context);
+	} else if (config.source == 0 && !inject && inline_len > 0 &&
+			info->tx_attr && info->tx_attr->iov_limit >= 2) {
+		/* Gather the header and the payload into one message. */
+		iovec iov[2] = {
+			{ .iov_base = header, .iov_len = sizeof(frame_header) },
+			{ .iov_base = const_cast<void*>(payload), .iov_len = inline_len }
+		};
+		void* desc[2] = { slot->desc, payload_desc };
+		ret = config.tagged ?
+			fi_tsendv(endpoint, iov, desc, 2, dest_addr, tag, context) :
+			fi_sendv(endpoint, iov, desc, 2, dest_addr, context);
+	} else {
+		/* One buffer per message, so the payload joins the header. */
+		if (inline_len > 0)
+			std::memcpy(slot->data + sizeof(frame_header), payload, inline_len);
+		ret = post_whole_frame(endpoint, slot->data,
+				sizeof(frame_header) + inline_len, slot->desc, sequence, inject,
+				context, config);
+	}
+
+	return ret < 0 ? ret : static_cast<ssize_t>(inline_len);
+}
+
+/* Post a frame that is whole already. An injected one is copied out before
+ * this returns, so there is nothing to wait on. */
+ssize_t post_whole_frame(fid_ep* endpoint, const void* frame, size_t frame_len,
+		void* desc, uint32_t sequence, bool inject, void* context,
+		const transfer_config& config) {
+	const fi_addr_t dest_addr = config.dest_addr;
+	const uint64_t tag = stream_tag(stream_id::CONTROL, sequence);
+
+	if (config.source != 0)
+		return inject ?
+			fi_injectdata(endpoint, frame, frame_len, config.source,
+					dest_addr) :
+			fi_senddata(endpoint, frame, frame_len, desc, config.source,
+					dest_addr, context);
+
+	if (inject)
+		return config.tagged ?
+			fi_tinject(endpoint, frame, frame_len, dest_addr, tag) :
+			fi_inject(endpoint, frame, frame_len, dest_addr);
+
+	return config.tagged ?
+		fi_tsend(endpoint, frame, frame_len, desc, dest_addr, tag, context) :
+		fi_send(endpoint, frame, frame_len, desc, dest_addr, context);
+}
+
+/* Post 'slot' as the buffer the next frame lands in. */
+ssize_t post_frame_recv(fid_ep* endpoint, const fi_info* info,
+		buffer_slab* slot, void* context, const transfer_config& config) {
+	size_t frame_size = sizeof(frame_header) + frame_capacity(info);
+	if (slot->size < frame_size)
+		return -FI_ETOOSMALL;
+
+	/* Frames are told apart by the sequence numbers in their headers, so any
+	 * frame of the stream will do. */
+	if (config.tagged)
+		return fi_trecv(endpoint, slot->data, frame_size, slot->desc,
+				config.dest_addr, stream_tag(stream_id::CONTROL),
+				ANY_SEQUENCE, context);
+
+	return fi_recv(endpoint, slot->data, frame_size, slot->desc,
+			config.dest_addr, context);
+}
+
+/* Take apart a received frame. */
+bool read_frame(const recv_view& message, frame_view& frame) {
+	if (message.flags & FI_REMOTE_CQ_DATA) {
+		frame.header = unpack_header(message.cq_data);
+		frame.payload = message.data;
+		frame.in_frame = std::min<size_t>(frame.header.length, message.len);
+		return true;
+	}
+
+	if (message.len < sizeof(frame_header))
+		return false;
+
+	std::memcpy(&frame.header, message.data, sizeof(frame_header));
+	frame.payload = message.data + sizeof(frame_header);
+	frame.in_frame = std::min<size_t>(frame.header.length,
+			message.len - sizeof(frame_header));
+	return true;
+}
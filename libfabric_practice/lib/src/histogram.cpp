@@ -0,0 +1,78 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+/* Values below 2^bits get a bucket each. Every power of two above that is
+ * split into 2^(bits - 1) buckets. */
+Histogram::Histogram(unsigned significant_bits) :
+	bits(std::clamp(significant_bits, 2u, 16u)),
+	counts((size_t{1} << bits) + (64 - bits) * (size_t{1} << (bits - 1))) {}
+
+/* Find the bucket a value falls in. */
+size_t Histogram::index_of(uint64_t value) const {
+	size_t linear = size_t{1} << bits;
+	if (value < linear)
+		return static_cast<size_t>(value);
+
+	/* Keep the top 'bits' bits of the value. Their highest bit is always
+	 * set, so only the ones below it pick the bucket. */
+	unsigned msb = 63 - std::countl_zero(value);
+	unsigned shift = msb - bits + 1;
+	size_t half = linear >> 1;
+	size_t sub = static_cast<size_t>(value >> shift) - half;
+	return linear + (msb - bits) * half + sub;
+}
+
+/* The biggest value that lands in a bucket. */
+uint64_t Histogram::highest_in(size_t index) const {
+	size_t linear = size_t{1} << bits;
+	if (index < linear)
+		return index;
+
+	size_t half = linear >> 1;
+	size_t octave = (index - linear) / half;
+	uint64_t sub = (index - linear) % half + half;
+	unsigned shift = static_cast<unsigned>(octave) + 1;
+	return (sub << shift) + ((uint64_t{1} << shift) - 1);
+}
+
+void Histogram::record(uint64_t value) {
+	counts[index_of(value)]++;
+	total++;
+	sum += value;
+	lowest = std::min(lowest, value);
+	highest = std::max(highest, value);
+}
+
+void Histogram::reset() {
+	std::fill(counts.begin(), counts.end(), 0);
+	total = 0;
+	lowest = UINT64_MAX;
+	highest = 0;
+	sum = 0;
+}
+
+/* Walk the buckets until enough values have been passed. */
+uint64_t Histogram::percentile(double percent) const {
+	if (total == 0)
+		return 0;
+
+	double fraction = std::clamp(percent, 0.0, 100.0) / 100.0;
+	uint64_t wanted = std::max<uint64_t>(1,
+			static_cast<uint64_t>(std::ceil(fraction * total)));
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < counts.size(); i++) {
+		seen += counts[i];
+		if (seen >= wanted)
+			return std::min(highest_in(i), highest);
+	}
+
+	return highest;
+}
+
+double Histogram::mean() const {
+	return total ? static_cast<double>(sum / total) : 0.0;
+}
@@ -0,0 +1,119 @@
+#include "metrics.hpp"
+
+/* The op goes in the low byte of a slot's tag, the connection above it. */
+static constexpr unsigned LATENCY_OP_BITS = 8;
+
+const char* latency_op_name(latency_op op) {
+	switch (op) {
+		case latency_op::FRAME:
+			return "frame";
+		case latency_op::ARRAY_SEND:
+			return "array_send";
+		case latency_op::ARRAY_RECV:
+			return "array_recv";
+		case latency_op::ARRAY_READ:
+			return "array_read";
+		case latency_op::RESPONSE:
+			return "response";
+		default:
+			return "unknown";
+	}
+}
+
+/* Mark the slot as being written, write it, then give it its number. A
+ * reader that sees the same number before and after copying the slot out
+ * got all of it. */
+void LatencyRing::push(uint64_t connection, latency_op op, uint64_t nanos) {
+	const uint64_t index = head.load(std::memory_order_relaxed);
+	slot& target = slots[index & (LATENCY_RING_SIZE - 1)];
+
+	target.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	target.tag.store((connection << LATENCY_OP_BITS) |
+			static_cast<uint64_t>(op), std::memory_order_relaxed);
+	target.nanos.store(nanos, std::memory_order_relaxed);
+	target.sequence.store(index + 1, std::memory_order_release);
+	head.store(index + 1, std::memory_order_release);
+}
+
+/* Copy out what is still in the ring, slot by slot. */
+uint64_t LatencyRing::drain(uint64_t& cursor,
+		std::vector<latency_stamp>& out) const {
+	const uint64_t end = head.load(std::memory_order_acquire);
+	uint64_t lost = 0;
+	if (end - cursor > LATENCY_RING_SIZE) {
+		lost = end - cursor - LATENCY_RING_SIZE;
+		cursor = end - LATENCY_RING_SIZE;
+	}
+
+	for (; cursor < end; cursor++) {
+		const slot& source = slots[cursor & (LATENCY_RING_SIZE - 1)];
+		if (source.sequence.load(std::memory_order_acquire) != cursor + 1) {
+			lost++;
+			continue;
+		}
+
+		const uint64_t tag = source.tag.load(std::memory_order_relaxed);
+		const uint64_t nanos = source.nanos.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (source.sequence.load(std::memory_order_relaxed) != cursor + 1) {
+			lost++;
+			continue;
+		}
+
+		latency_stamp stamp;
+		stamp.connection = tag >> LATENCY_OP_BITS;
+		stamp.op = static_cast<latency_op>(
+				tag & ((uint64_t(1) << LATENCY_OP_BITS) - 1));
+		stamp.nanos = nanos;
+		out.push_back(stamp);
+	}
+
+	return lost;
+}
+
+op_counts& op_counts::operator+=(const op_counts& other) {
+	transmits += other.transmits;
+	transmit_errors += other.transmit_errors;
+	receives += other.receives;
+	receive_errors += other.receive_errors;
+	return *this;
+}
+
+/* Open both counters, and bind each to the operations it counts. */
+ssize_t OpCounters::bind(fid_domain* domain, fid_ep* endpoint) {
+	/* Nobody waits on them, they are only ever read. */
+	fi_cntr_attr attr = {};
+	attr.events = FI_CNTR_EVENTS_COMP;
+	attr.wait_obj = FI_WAIT_NONE;
+
+	ssize_t ret = fi_cntr_open(domain, &attr, transmit.out(), nullptr);
+	if (ret == 0)
+		ret = fi_cntr_open(domain, &attr, recv.out(), nullptr);
+	if (ret == 0)
+		ret = fi_ep_bind(endpoint, &transmit->fid,
+				FI_SEND | FI_WRITE | FI_READ);
+	if (ret == 0)
+		ret = fi_ep_bind(endpoint, &recv->fid, FI_RECV);
+
+	if (ret < 0)
+		reset();
+	return ret;
+}
+
+op_counts OpCounters::read() const {
+	op_counts counts;
+	if (!bound())
+		return counts;
+
+	counts.transmits = fi_cntr_read(transmit);
+	counts.transmit_errors = fi_cntr_readerr(transmit);
+	counts.receives = fi_cntr_read(recv);
+	counts.receive_errors = fi_cntr_readerr(recv);
+	return counts;
+}
+
+void OpCounters::reset() {
+	recv.reset();
+	transmit.reset();
+}
@@ -0,0 +1,139 @@
+#include "progress.hpp"
+
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_errno.h>
+
+#include <algorithm>
+#include <sched.h>
+#include <thread>
+
+/* How many empty polls are spent spinning, and then yielding, before the
+ * waiter starts to nap. */
+static constexpr size_t SPIN_POLLS = 4096;
+static constexpr size_t YIELD_POLLS = 256;
+
+/* Naps start short and double every time, up to a cap that keeps the worst
+ * case wake-up well under a millisecond. */
+static constexpr std::chrono::nanoseconds FIRST_NAP{1000};
+static constexpr std::chrono::nanoseconds LONGEST_NAP{200 * 1000};
+
+static const char* const PHASE_NAMES[BACKOFF_PHASES] = {
+	"spin", "yield", "sleep"
+};
+
+/* Tell the CPU we are spinning, so it can go easy on the pipeline and on the
+ * other hardware thread of the core. */
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+fi_wait_obj cq_wait_obj(wait_mode mode) {
+	switch (mode) {
+		case wait_mode::POLL:
+			return FI_WAIT_NONE;
+		case wait_mode::EPOLL:
+			return FI_WAIT_FD;
+		default:
+			return FI_WAIT_UNSPEC;
+	}
+}
+
+fi_cq_attr cq_attr(wait_mode mode, size_t size) {
+	fi_cq_attr attr = {};
+	attr.size = size;
+	attr.format = FI_CQ_FORMAT_DATA;
+	attr.wait_obj = cq_wait_obj(mode);
+	attr.wait_cond = FI_CQ_COND_NONE;
+	return attr;
+}
+
+int bind_queues(fid_ep* endpoint, fid_cq* recv_queue, fid_cq* transmit_queue) {
+	int ret = fi_ep_bind(endpoint, &recv_queue->fid, FI_RECV);
+	if (ret < 0)
+		return ret;
+
+	return fi_ep_bind(endpoint, &transmit_queue->fid,
+			FI_TRANSMIT | FI_SELECTIVE_COMPLETION);
+}
+
+CompletionWaiter::CompletionWaiter(wait_mode mode) :
+	policy(mode),
+	nap(FIRST_NAP) {}
+
+/* Read at least one completion, one way or another. */
+ssize_t CompletionWaiter::wait(fid_cq* queue, void* entries, size_t count) {
+	for (;;) {
+		ssize_t read = policy != wait_mode::POLL ?
+			fi_cq_sread(queue, entries, count, nullptr, -1) :
+			fi_cq_read(queue, entries, count);
+		if (read != -FI_EAGAIN) {
+			reset();
+			return read;
+		}
+
+		if (policy == wait_mode::POLL)
+			idle();
+	}
+}
+
+/* Start the next phase, and charge the one before it for its time. */
+void CompletionWaiter::enter(backoff_phase next, clock::time_point now) {
+	totals.nanoseconds[phase] += std::chrono::duration_cast<
+		std::chrono::nanoseconds>(now - phase_start).count();
+	phase = next;
+	phase_start = now;
+}
+
+/* A poll came up empty. */
+void CompletionWaiter::idle() {
+	if (!waiting) {
+		waiting = true;
+		phase = SPIN;
+		polls = 0;
+		phase_start = clock::now();
+		nap = FIRST_NAP;
+	}
+
+	polls++;
+	if (phase == SPIN && polls > SPIN_POLLS)
+		enter(YIELD, clock::now());
+	else if (phase == YIELD && polls > SPIN_POLLS + YIELD_POLLS)
+		enter(SLEEP, clock::now());
+
+	switch (phase) {
+		case SPIN:
+			cpu_relax();
+			break;
+		case YIELD:
+			sched_yield();
+			break;
+		default:
+			std::this_thread::sleep_for(nap);
+			nap = std::min(nap * 2, LONGEST_NAP);
+			break;
+	}
+}
+
+/* A poll found something. */
+void CompletionWaiter::reset() {
+	if (!waiting)
+		return;
+
+	totals.waits[phase]++;
+	enter(SPIN, clock::now());
+	waiting = false;
+}
+
+/* Print the time spent in each phase. */
+void CompletionWaiter::report(std::ostream& out) const {
+	out << "Time spent waiting on completions:" << std::endl;
+	for (size_t i = 0; i < BACKOFF_PHASES; i++) {
+		out << "  " << PHASE_NAMES[i] << ": " <<
+			totals.nanoseconds[i] / 1000 << " us, " << totals.waits[i] <<
+			" waits ended here" << std::endl;
+	}
+}
@@ -0,0 +1,52 @@
+#include "rdm.hpp"
+
+#include <rdma/fi_errno.h>
+
+#include <cstring>
+
+/* Open an address vector, and bind the endpoint to it. */
+ssize_t open_address_vector(fid_domain* domain, fid_ep* endpoint,
+		fid_av** av, int rx_ctx_bits, bool scalable) {
+	fi_av_attr av_attr = {};
+	av_attr.type = FI_AV_UNSPEC; /* Whatever the provider prefers. */
+	av_attr.count = ADDRESS_VECTOR_SIZE;
+	av_attr.rx_ctx_bits = rx_ctx_bits;
+
+	int ret = fi_av_open(domain, &av_attr, av, nullptr);
+	if (ret < 0)
+		return ret;
+
+	if (scalable)
+		return fi_scalable_ep_bind(endpoint, &(*av)->fid, 0);
+	return fi_ep_bind(endpoint, &(*av)->fid, 0);
+}
+
+/* Resolve a node and port, and add it. */
+ssize_t insert_service(fid_av* av, const std::string& node, int port,
+		fi_addr_t* address) {
+	std::string service = std::to_string(port);
+	int inserted = fi_av_insertsvc(av, node.c_str(), service.c_str(), address,
+			0, nullptr);
+	if (inserted < 0)
+		return inserted;
+
+	return inserted == 1 ? 0 : -FI_EADDRNOTAVAIL;
+}
+
+/* Add a peer by its raw endpoint name. */
+ssize_t insert_address(fid_av* av, const void* name, size_t len,
+		fi_addr_t* address) {
+	if (len == 0 || len > MAX_ADDRESS_SIZE)
+		return -FI_EINVAL;
+
+	/* The provider reads as much of the name as its address format takes,
+	 * so a short one is padded out rather than read past. */
+	char padded[MAX_ADDRESS_SIZE] = {};
+	std::memcpy(padded, name, len);
+
+	int inserted = fi_av_insert(av, padded, 1, address, 0, nullptr);
+	if (inserted < 0)
+		return inserted;
+
+	return inserted == 1 ? 0 : -FI_EADDRNOTAVAIL;
+}
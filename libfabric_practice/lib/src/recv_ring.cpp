@@ -0,0 +1,115 @@
+#include "recv_ring.hpp"
+
+#include <rdma/fi_errno.h>
+
+#include <sys/uio.h>
+
+RecvRing::RecvRing(BufferPool& pool, size_t largest_message,
+		size_t buffer_count) :
+	pool(pool),
+	min_free(largest_message),
+	buffers(buffer_count > 0 ? buffer_count : 1) {
+	for (ring_buffer& buffer : buffers)
+		buffer.slab = pool.acquire(largest_message * MESSAGES_PER_RING_BUFFER);
+}
+
+RecvRing::~RecvRing() {
+	for (ring_buffer& buffer : buffers)
+		pool.release(buffer.slab);
+}
+
+/* Set 'FI_OPT_MIN_MULTI_RECV' on the endpoint. */
+int RecvRing::configure(fid_ep* endpoint) const {
+	size_t threshold = min_free;
+	return fi_setopt(&endpoint->fid, FI_OPT_ENDPOINT, FI_OPT_MIN_MULTI_RECV,
+			&threshold, sizeof(threshold));
+}
+
+/* Post every buffer. */
+ssize_t RecvRing::post(fid_ep* endpoint, void* context) {
+	this->endpoint = endpoint;
+	this->context = context;
+
+	/* A buffer the pool couldn't hand out leaves the ring unusable. */
+	for (const ring_buffer& buffer : buffers)
+		if (!buffer.slab)
+			return -FI_ENOMEM;
+
+	for (size_t i = 0; i < buffers.size(); i++) {
+		ssize_t ret = repost(i);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Post one buffer as a whole, so the provider fills it message by message. */
+ssize_t RecvRing::repost(size_t index) {
+	ring_buffer& buffer = buffers[index];
+	iovec iov = { .iov_base = buffer.slab->data, .iov_len = buffer.slab->size };
+	void* desc = buffer.slab->desc;
+	fi_msg msg = {
+		.msg_iov = &iov,
+		.desc = &desc,
+		.iov_count = 1,
+		.addr = 0,
+		.context = context,
+		.data = 0
+	};
+
+	ssize_t ret = fi_recvmsg(endpoint, &msg, FI_MULTI_RECV);
+	if (ret < 0)
+		return ret;
+
+	buffer.released = false;
+	posted.push_back(index);
+	return 0;
+}
+
+/* Hand the ring a completion read off of the receive queue. */
+ssize_t RecvRing::handle(const fi_cq_data_entry& entry, recv_view& view) {
+	if (posted.empty())
+		return 0;
+
+	size_t index = posted.front();
+	ring_buffer& buffer = buffers[index];
+
+	/* A release can come on the completion of the last message that fit,
+	 * or on a completion of its own with nothing in it. A message can be
+	 * empty too, if all it carries is its remote CQ data. */
+	bool landed = (entry.flags & FI_RECV) &&
+		(entry.len > 0 || (entry.flags & FI_REMOTE_CQ_DATA));
+	if (landed) {
+		view.data = static_cast<const char*>(entry.buf);
+		view.len = entry.len;
+		view.buffer = index;
+		view.flags = entry.flags;
+		view.cq_data = entry.data;
+		buffer.outstanding++;
+	}
+
+	if (entry.flags & FI_MULTI_RECV) {
+		posted.pop_front();
+		buffer.released = true;
+		if (buffer.outstanding == 0) {
+			ssize_t ret = repost(index);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return landed ? 1 : 0;
+}
+
+/* Give a view back. */
+ssize_t RecvRing::consume(const recv_view& view) {
+	ring_buffer& buffer = buffers[view.buffer];
+	if (buffer.outstanding > 0)
+		buffer.outstanding--;
+
+	if (buffer.released && buffer.outstanding == 0)
+		return repost(view.buffer);
+
+	return 0;
+}
@@ -0,0 +1,24 @@
+#include "rma.hpp"
+#include "buffer_pool.hpp"
+
+#include <rdma/fi_errno.h>
+
+/* Register a buffer for the peer to reach. */
+ssize_t expose_region(fid_domain* domain, void* buf, size_t len,
+		uint64_t access, fid_mr** mr) {
+	return fi_mr_reg(domain, buf, len, access, 0, requested_mr_key(), 0, mr,
+			nullptr);
+}
+
+/* Describe a registered buffer for the peer. */
+rma_window describe_region(const fi_info* info, fid_mr* mr, const void* buf,
+		size_t len) {
+	bool virtual_address = info && info->domain_attr &&
+		(info->domain_attr->mr_mode & FI_MR_VIRT_ADDR);
+
+	rma_window window;
+	window.addr = virtual_address ? reinterpret_cast<uintptr_t>(buf) : 0;
+	window.key = fi_mr_key(mr);
+	window.length = len;
+	return window;
+}
@@ -0,0 +1,45 @@
+#include "rpc.hpp"
+
+#include <algorithm>
+#include <bit>
+
+InFlightTable::InFlightTable(size_t capacity) :
+	slots(std::make_unique<slot[]>(std::bit_ceil(std::max<size_t>(capacity,
+						1)))),
+	mask(std::bit_ceil(std::max<size_t>(capacity, 1)) - 1) {}
+
+/* Give a new call an id. */
+uint64_t InFlightTable::insert(void* call) {
+	uint64_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+	slot& s = slots[id & mask];
+
+	/* Claim the slot before filling it in, so a response can't see the id
+	 * before the call is there. */
+	uint64_t expected = 0;
+	if (!s.id.compare_exchange_strong(expected, CLAIMED,
+				std::memory_order_acquire))
+		return 0;
+
+	s.call = call;
+	s.id.store(id, std::memory_order_release);
+	count.fetch_add(1, std::memory_order_relaxed);
+	return id;
+}
+
+/* Take back the call 'id' was handed out for. */
+void* InFlightTable::remove(uint64_t id) {
+	if (id == 0 || id == CLAIMED)
+		return nullptr;
+
+	slot& s = slots[id & mask];
+	uint64_t expected = id;
+	if (!s.id.compare_exchange_strong(expected, CLAIMED,
+				std::memory_order_acquire))
+		return nullptr;
+
+	void* call = s.call;
+	s.call = nullptr;
+	s.id.store(0, std::memory_order_release);
+	count.fetch_sub(1, std::memory_order_relaxed);
+	return call;
+}
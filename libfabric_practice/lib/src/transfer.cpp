@@ -0,0 +1,272 @@
+#include "transfer.hpp"
+#include "credit.hpp"
+#include "metrics.hpp"
+#include "err.hpp"
+
+#include <rdma/fi_errno.h>
+#include <rdma/fi_rma.h>
+#include <rdma/fi_tagged.h>
+
+#include <algorithm>
+
+/* Completions are read into the biggest entry format there is, so this works
+ * no matter which format the queue was opened with. */
+static constexpr size_t COMPLETIONS_PER_READ = DEFAULT_WINDOW;
+
+/* Fit the requested chunk size and window to the provider. */
+transfer_config make_transfer_config(const fi_info* info, size_t chunk_size,
+		size_t window) {
+	transfer_config config;
+	config.chunk_size = std::max<size_t>(chunk_size, 1);
+	config.window = std::max<size_t>(window, 1);
+
+	if (info && info->ep_attr && info->ep_attr->max_msg_size > 0)
+		config.chunk_size = std::min(config.chunk_size,
+				info->ep_attr->max_msg_size);
+	if (info && info->tx_attr && info->tx_attr->size > 0)
+		config.window = std::min(config.window, info->tx_attr->size);
+	if (info && info->rx_attr && info->rx_attr->size > 0)
+		config.window = std::min(config.window, info->rx_attr->size);
+
+	return config;
+}
+
+ChunkedTransfer::ChunkedTransfer(direction dir, fid_ep* endpoint, void* buf,
+		size_t len, void* desc, const transfer_config& config, void* context,
+		const rma_window& remote) :
+	dir(dir),
+	endpoint(endpoint),
+	buf(static_cast<char*>(buf)),
+	len(len),
+	desc(desc),
+	config(config),
+	context(context),
+	remote(remote),
+	total_chunks((len + config.chunk_size - 1) / config.chunk_size) {}
+
+/* Post chunks until the window is full or nothing is left to post. */
+ssize_t ChunkedTransfer::post() {
+	while (posted < total_chunks && in_flight() < config.window) {
+		size_t offset = posted * config.chunk_size;
+		size_t chunk = std::min(config.chunk_size, len - offset);
+
+		/* Out of credit, the rest waits here until the peer grants more. */
+		const bool sending = dir == direction::SEND && credits;
+		if (sending && !credits->take()) {
+			if (config.stats)
+				op_stats::bump(config.stats->credit_stalls);
+			return 0;
+		}
+		const uint64_t grants = sending ? credits->total() : 0;
+
+		ssize_t ret = 0;
+		const uint64_t tag = stream_tag(stream_id::BULK, posted);
+		switch (dir) {
+			case direction::SEND:
+				if (config.tagged && sending && credits->piggybacks())
+					ret = fi_tsenddata(endpoint, buf + offset, chunk, desc,
+							grants, config.dest_addr, tag, context);
+				else if (config.tagged)
+					ret = fi_tsend(endpoint, buf + offset, chunk, desc,
+							config.dest_addr, tag, context);
+				else if (config.source)
+					ret = fi_senddata(endpoint, buf + offset, chunk, desc,
+							config.source, config.dest_addr, context);
+				else
+					ret = fi_send(endpoint, buf + offset, chunk, desc,
+							config.dest_addr, context);
+				break;
+			case direction::RECV:
+				ret = config.tagged ?
+					fi_trecv(endpoint, buf + offset, chunk, desc,
+							config.dest_addr, tag, 0, context) :
+					fi_recv(endpoint, buf + offset, chunk, desc,
+							config.dest_addr, context);
+				break;
+			case direction::WRITE:
+				ret = fi_write(endpoint, buf + offset, chunk, desc,
+						config.dest_addr, remote.addr + offset, remote.key, context);
+				break;
+			case direction::READ:
+				ret = fi_read(endpoint, buf + offset, chunk, desc,
+						config.dest_addr, remote.addr + offset, remote.key, context);
+				break;
+		}
+		if (ret == -FI_EAGAIN || ret < 0) {
+			if (sending)
+				credits->give_back();
+			/* The provider's queue is full, try again later. */
+			if (ret == -FI_EAGAIN && config.stats)
+				op_stats::bump(config.stats->eagain);
+			stalled = ret == -FI_EAGAIN;
+			return ret == -FI_EAGAIN ? 0 : ret;
+		}
+
+		if (stalled && config.stats)
+			op_stats::bump(config.stats->retries);
+		stalled = false;
+		posted++;
+		if (sending && credits->piggybacks())
+			credits->announce(grants);
+		else if (dir == direction::RECV && credits)
+			credits->grant();
+	}
+
+	return 0;
+}
+
+/* Account for completed chunks, and refill the window. */
+ssize_t ChunkedTransfer::complete(size_t count) {
+	completed = std::min(completed + count, posted);
+	return post();
+}
+
+/* Read whatever completions a queue has for a transfer and credit them to
+ * it. With 'block' set, this waits for at least one, through 'waiter' if
+ * there is one. Returns how many were read, or a negative libfabric error
+ * code. */
+static ssize_t reap(ChunkedTransfer* transfer, fid_cq* queue, bool block,
+		CompletionWaiter* waiter) {
+	fi_cq_tagged_entry entries[COMPLETIONS_PER_READ];
+	size_t count = std::min(COMPLETIONS_PER_READ,
+			std::max<size_t>(transfer->in_flight(), 1));
+
+	ssize_t read = 0;
+	if (!block)
+		read = fi_cq_read(queue, entries, count);
+	else if (waiter)
+		read = waiter->wait(queue, entries, count);
+	else
+		read = fi_cq_sread(queue, entries, count, nullptr, -1);
+
+	if (read > 0) {
+		ssize_t ret = transfer->complete(static_cast<size_t>(read));
+		return ret < 0 ? ret : read;
+	}
+
+	if (read == -FI_EAVAIL)
+		return -check_cq_error(queue).err;
+
+	if (read == -FI_EAGAIN)
+		return transfer->post(); /* Anything the queue was too full for. */
+
+	return read;
+}
+
+/* Read whatever the receive queue has under a credit link: chunks for
+ * 'recv', which may be nullptr or done already, and the peer's updates. The
+ * queue is read entry by entry, since the two have to be told apart, and
+ * chunks may carry grants of their own. Whatever the peer granted lets
+ * 'send' post more, and whatever we granted goes out right after. Returns how
+ * many completions were read, or a negative libfabric error code. */
+static ssize_t reap_credited(ChunkedTransfer* recv, ChunkedTransfer* send,
+		fid_cq* queue, bool block, CompletionWaiter* waiter,
+		CreditLink& credits) {
+	/* One more than the chunks in flight, for an update. */
+	fi_cq_data_entry entries[COMPLETIONS_PER_READ];
+	size_t count = std::min(COMPLETIONS_PER_READ,
+			(recv ? recv->in_flight() : 0) + 1);
+
+	ssize_t read = 0;
+	if (!block)
+		read = fi_cq_read(queue, entries, count);
+	else if (waiter)
+		read = waiter->wait(queue, entries, count);
+	else
+		read = fi_cq_sread(queue, entries, count, nullptr, -1);
+
+	if (read == -FI_EAVAIL)
+		return -check_cq_error(queue).err;
+	if (read == -FI_EAGAIN)
+		read = 0;
+	if (read < 0)
+		return read;
+
+	ssize_t ret = 0;
+	size_t chunks = 0;
+	for (ssize_t i = 0; i < read && ret == 0; i++) {
+		if (credits.is_update(entries[i].op_context)) {
+			ret = credits.take_update();
+		} else {
+			credits.take_piggyback(entries[i].flags, entries[i].data);
+			chunks++;
+		}
+	}
+
+	if (ret == 0 && recv)
+		ret = recv->complete(chunks);
+	if (ret == 0 && send)
+		ret = send->post();
+	if (ret == 0)
+		ret = credits.flush();
+
+	return ret < 0 ? ret : read;
+}
+
+/* Drive a send and a receive to completion. */
+ssize_t run_transfers(ChunkedTransfer* send, fid_cq* transmit_queue,
+		ChunkedTransfer* recv, fid_cq* recv_queue, CompletionWaiter* waiter,
+		CreditLink* credits) {
+	ssize_t ret = 0;
+	if (send && (ret = send->post()) < 0)
+		return ret;
+	if (recv && (ret = recv->post()) < 0)
+		return ret;
+	if (credits && (ret = credits->flush()) < 0)
+		return ret;
+
+	for (;;) {
+		bool sending = send && !send->done();
+		bool receiving = recv && !recv->done();
+		if (!sending && !receiving)
+			return 0;
+
+		/* Under credits, a sender that ran out waits on the peer's grants,
+		 * which come in on the receive queue. */
+		bool listening = receiving || (credits && sending);
+
+		/* With only one direction left it is safe to wait on its queue, as
+		 * long as there is something posted on it to wake us up. Otherwise
+		 * poll, which also drives progress for providers that need it. */
+		ssize_t found = 0;
+		if (sending) {
+			bool block = !listening && send->in_flight() > 0;
+			if ((ret = reap(send, transmit_queue, block, waiter)) < 0)
+				return ret;
+			found += ret;
+		}
+		if (listening) {
+			bool block = !sending && recv->in_flight() > 0;
+			ret = credits ?
+				reap_credited(recv, send, recv_queue, block, waiter,
+						*credits) :
+				reap(recv, recv_queue, block, waiter);
+			if (ret < 0)
+				return ret;
+			found += ret;
+		}
+
+		/* Both directions came up empty, so back off before polling them
+		 * again. */
+		if (waiter && sending && listening) {
+			if (found > 0)
+				waiter->reset();
+			else
+				waiter->idle();
+		}
+	}
+}
+
+ssize_t send_chunked(fid_ep* endpoint, fid_cq* transmit_queue,
+		const void* buf, size_t len, void* desc, const transfer_config& config) {
+	ChunkedTransfer send(ChunkedTransfer::direction::SEND, endpoint,
+			const_cast<void*>(buf), len, desc, config);
+	return run_transfers(&send, transmit_queue, nullptr, nullptr);
+}
+
+ssize_t recv_chunked(fid_ep* endpoint, fid_cq* recv_queue, void* buf,
+		size_t len, void* desc, const transfer_config& config) {
+	ChunkedTransfer recv(ChunkedTransfer::direction::RECV, endpoint, buf, len,
+			desc, config);
+	return run_transfers(nullptr, nullptr, &recv, recv_queue);
+}
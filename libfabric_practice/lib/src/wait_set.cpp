@@ -0,0 +1,71 @@
+#include "wait_set.hpp"
+#include "err.hpp"
+
+#include <rdma/fi_errno.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+FdWaitSet::FdWaitSet(fid_fabric* fabric) :
+	fabric(fabric),
+	epoll_fd(epoll_create1(EPOLL_CLOEXEC)) {
+	if (epoll_fd < 0)
+		check_libfabric(-errno, "epoll_create1()");
+}
+
+FdWaitSet::~FdWaitSet() {
+	close(epoll_fd);
+}
+
+/* Add a queue's file descriptor to the epoll instance. */
+int FdWaitSet::add(fid_t queue) {
+	int fd = -1;
+	int ret = fi_control(queue, FI_GETWAIT, &fd);
+	if (ret < 0)
+		return ret;
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.ptr = queue;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+		return -errno;
+
+	queues.push_back(queue);
+	return 0;
+}
+
+/* Take a queue's file descriptor back out. Closing the descriptor would
+ * drop it from the instance too, but only once the provider closes it. */
+void FdWaitSet::remove(fid_t queue) {
+	auto found = std::find(queues.begin(), queues.end(), queue);
+	if (found == queues.end())
+		return;
+
+	int fd = -1;
+	if (fi_control(queue, FI_GETWAIT, &fd) == 0)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+
+	*found = queues.back();
+	queues.pop_back();
+}
+
+/* Check with the provider, then sleep. */
+int FdWaitSet::wait(int timeout_ms) {
+	if (!queues.empty()) {
+		int ret = fi_trywait(fabric, queues.data(),
+				static_cast<int>(queues.size()));
+		if (ret == -FI_EAGAIN)
+			return 0;
+		if (ret < 0)
+			return ret;
+	}
+
+	epoll_event events[WAIT_SET_EVENTS];
+	int woken = epoll_wait(epoll_fd, events, WAIT_SET_EVENTS, timeout_ms);
+	if (woken < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	return woken;
+}
@@ -13,9 +13,393 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include "buffer_pool.hpp"
+#include "frame.hpp"
+#include "recv_ring.hpp"
+#include "progress.hpp"
+#include "completion.hpp"
+#include "credit.hpp"
+#include "metrics.hpp"
+#include "exporter.hpp"
+#include "histogram.hpp"
+#include "transfer.hpp"
+#include "rma.hpp"
+#include "rdm.hpp"
+#include "rpc.hpp"
+#include "wait_set.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+/* The steps a single client connection walks through on the server. Both
+ * sides send their float and their array as one frame each, without waiting
+ * on anything, so the steps only track which of the client's frames is due
+ * next. In RMA mode, the client's array frame is a request for windows, and
+ * a last frame says it is done with them. None of them block the server. */
+enum class conn_state {
+	ACCEPTING,	/* 'fi_accept()' sent, waiting on 'FI_CONNECTED'. */
+	EXCHANGING,	/* Our frames are out, waiting on the client's float. */
+	STREAMING,	/* Waiting on the client's array, and on ours to finish. */
+	SERVING,	/* In RPC mode, answering calls until the client leaves. */
+	CLOSED		/* Done, or the client went away. Ready to be freed. */
+};
+
+/* The frames the server sends every client, in the order they are sent.
+ * Only the clients of a scalable endpoint get a 'WELCOME', and only the ones
+ * whose array we read get a 'RENDEZVOUS_FIN'. */
+enum frame_slot {
+	WELCOME_FRAME,
+	SCALAR_FRAME,
+	ARRAY_FRAME,
+	FIN_FRAME,
+	FRAME_SLOTS
+};
+
+/* The values of the exchange, kept together in one registered slab. Buffers
+ * have to outlive the operations posted with them, so they can't live on
+ * the stack. */
+struct control_block {
+	float send_buffer = 123.45;
+	float recv_buffer = 0.0;
+	size_t send_msg_size = 0;
+	size_t recv_msg_size = 0;
+	rma_offer offer = {};
+	uint32_t rx_index = 0; /* Sent in the 'WELCOME' frame. */
+};
+
+/* A call the client made that hasn't been answered yet. Its response is
+ * already written to the call buffer of its response slot, it just isn't
+ * due yet, or there was no room to post it. */
+struct pending_call {
+	size_t slot = 0;
+	size_t length = 0; /* Of the response, 'rpc_header' included. */
+	std::chrono::steady_clock::time_point due;
+	bool stalled = false; /* Posting the response got '-FI_EAGAIN' before. */
+};
+
+struct connection;
+struct server_state;
+struct scalable_endpoint;
+
+/* What one connection looked like when its loop last took a sample. */
+struct connection_sample {
+	uint64_t id = 0;
+	bool counted = false; /* Whether its endpoint has counters. */
+	op_counts counts;
+};
+
+/* What one event loop keeps track of with metrics on. The loop bumps
+ * 'stats' and pushes latencies as it goes, and the exporter's thread reads
+ * them whenever it likes. The connections are the loop's alone, so a report
+ * asks for a sample of them by bumping 'wanted', and the loop hands one over
+ * on its next pass, under 'sample_lock', then sets 'sampled' to match. The
+ * loop only ever holds the lock for that handover. */
+struct loop_metrics {
+	op_stats stats;
+	LatencyRing latencies;
+
+	std::atomic<uint64_t> wanted{0};
+	std::atomic<uint64_t> sampled{0};
+	std::mutex sample_lock;
+	std::vector<connection_sample> samples;
+	op_counts closed_sample;
+
+	/* The loop's own: what the counters of connections that are gone said
+	 * last. */
+	op_counts closed;
+
+	/* The exporter's own: how far it read the latencies, how many it lost,
+	 * and what it read, one histogram per op. */
+	uint64_t cursor = 0;
+	uint64_t lost = 0;
+	std::vector<Histogram> latency =
+		std::vector<Histogram>(static_cast<size_t>(latency_op::COUNT));
+};
+
+/* Hands the completions on one of a connection's queues to the connection.
+ * The server routes every completion to one of these through its context. */
+class ConnectionHandler : public CompletionHandler {
+public:
+	bool on_completion(const fi_cq_data_entry& entry) override;
+	void on_error(const fi_cq_err_entry& entry) override;
+
+	server_state* state = nullptr;
+	connection* conn = nullptr;
+	bool transmit = false;
+};
+
+/* Everything the server owns for one accepted client. */
+struct connection {
+	/* Tells clients apart in the output, and is the context of every
+	 * operation posted for this connection. */
+	uint64_t id = 0;
+	conn_state state = conn_state::ACCEPTING;
+
+	/* In SRX mode, the token the client was handed when it was accepted,
+	 * and marks every message with. */
+	uint64_t source = 0;
+
+	/* Set if the domain and completion queues below belong to the
+	 * 'shared_resources' instead of this connection. */
+	bool shared = false;
+
+	/* Set if the endpoint below is the shared RDM endpoint, and the client
+	 * is only told apart by its 'address' in the address vector. There is
+	 * no connection to shut down then. */
+	bool rdm = false;
+	fi_addr_t address = FI_ADDR_UNSPEC;
+
+	/* Set if the client writes and reads the arrays through windows we
+	 * open for it, instead of sending them. */
+	bool rma = false;
+
+	/* Arrays at least this big go by rendezvous, or none if it is 0: the
+	 * sender only sends a window on its array, and the receiver reads it
+	 * out of there. 'fin_due' is set while the client still has to say it
+	 * read ours, and 'fin_posted' once the frame buffer for that is up. */
+	size_t rendezvous = 0;
+	bool fin_due = false;
+	bool fin_posted = false;
+
+	/* Set if the client makes calls instead of exchanging arrays. Every
+	 * response goes out of a slot of its own, carved out of one of
+	 * 'response_slabs', and a slot is free again once its send completed.
+	 * Calls that aren't answered yet wait in 'calls'. Calls that came in
+	 * while every slot was taken wait in 'deferred_calls', still in the
+	 * ring, so the ring fills up and the client is held back. */
+	bool rpc = false;
+	std::vector<buffer_slab*> response_slabs;
+	std::vector<buffer_slab> response_slots;
+	std::vector<size_t> free_responses;
+	std::vector<pending_call> calls;
+	std::deque<recv_view> deferred_calls;
+
+	/* The client's provider info, kept around for its limits. */
+	fi_info* info = nullptr;
+
+	fid_domain* domain = nullptr;
+	fid_ep* endpoint = nullptr;
+	fid_cq* recv_queue = nullptr;
+	fid_cq* transmit_queue = nullptr;
+
+	/* Where the completions of each queue end up. A connection with queues
+	 * of its own also reads them through its own dispatchers. */
+	ConnectionHandler transmit_handler;
+	ConnectionHandler recv_handler;
+	std::unique_ptr<CompletionDispatcher> transmit_dispatcher;
+	std::unique_ptr<CompletionDispatcher> recv_dispatcher;
+
+	/* Frames sent but not yet seen on the transmit queue. */
+	size_t pending_send = 0;
+
+	/* Set once the client's array frame is in. Its remainder, if it has
+	 * one, is still tracked by 'recv_transfer', or with a receive ring, by
+	 * how many of its bytes are in and how many are still due. */
+	bool array_received = false;
+	size_t recv_filled = 0;
+	size_t recv_remaining = 0;
+
+	/* Every frame carries the next number, so one going missing or arriving
+	 * out of order gets noticed. */
+	uint32_t send_sequence = 0;
+	uint32_t recv_sequence = 0;
+
+	/* Where the registered buffers come from. That is either the
+	 * connection's own pool, or the shared one. */
+	BufferPool* pool = nullptr;
+	std::unique_ptr<BufferPool> own_pool;
+
+	buffer_slab* control_slab = nullptr;
+	control_block* control = nullptr;
+	buffer_slab* send_frame_slabs[FRAME_SLOTS] = {};
+	buffer_slab* recv_frame_slab = nullptr;
+	buffer_slab* send_arr_slab = nullptr;
+	buffer_slab* recv_arr_slab = nullptr;
+
+	/* The client says how big its array is, and nothing bigger than this is
+	 * allocated for it. */
+	size_t max_array_bytes = 0;
+
+	/* In RMA mode, the arrays are also registered on their own, so the client
+	 * can be handed their keys. */
+	fid_mr* send_arr_mr = nullptr;
+	fid_mr* recv_arr_mr = nullptr;
+
+	/* How the part of an array that doesn't fit in its frame is split up,
+	 * and the transfers moving it. */
+	transfer_config config;
+	std::unique_ptr<ChunkedTransfer> send_transfer;
+	std::unique_ptr<ChunkedTransfer> recv_transfer;
+
+	/* In flow-control mode, the credits of the chunks going both ways, and
+	 * the slab the client's credit updates land in. */
+	std::unique_ptr<CreditLink> credits;
+	buffer_slab* credit_slab = nullptr;
+
+	/* With metrics on, the loop's metrics, the counters of the endpoint's
+	 * operations if the provider has them, and when each operation being
+	 * timed started, or 0 if none is. Responses are timed per slot. */
+	loop_metrics* metrics = nullptr;
+	OpCounters counters;
+	uint64_t frame_started[FRAME_SLOTS] = {};
+	uint64_t send_started = 0;
+	uint64_t recv_started = 0;
+	std::vector<uint64_t> response_started;
+
+	/* In ring mode, everything the client sends lands here instead of in
+	 * 'recv_frame_slab' and 'recv_transfer'. That is either the connection's
+	 * own ring, or in RDM mode, the one every client shares. */
+	RecvRing* ring = nullptr;
+	std::unique_ptr<RecvRing> own_ring;
+};
+
+/* Every live connection, keyed by its id. */
+using connection_table = std::unordered_map<uint64_t,
+	std::unique_ptr<connection>>;
+
+/* In shared mode, every accepted endpoint is opened on this one domain and
+ * bound to this one pair of completion queues, so a single read drains the
+ * work of every client. Each completion is routed back to its connection
+ * through the op context, which holds the connection's id. */
+struct shared_resources {
+	fid_domain* domain = nullptr;
+	fid_cq* recv_queue = nullptr;
+	fid_cq* transmit_queue = nullptr;
+	std::unique_ptr<CompletionDispatcher> transmit_dispatcher;
+	std::unique_ptr<CompletionDispatcher> recv_dispatcher;
+	std::unique_ptr<BufferPool> pool;
+	std::unordered_map<uint64_t, connection*> routes;
+
+	/* In RDM mode there is no listener and no endpoint per client, just the
+	 * one endpoint everything goes through, and the address vector every
+	 * client is in. Whatever any client sends lands in the one ring, and
+	 * the address it came from says whose it is. */
+	fid_ep* endpoint = nullptr;
+	fid_av* av = nullptr;
+	std::unique_ptr<RecvRing> ring;
+	std::unordered_map<fi_addr_t, connection*> peers;
+
+	/* In SRX mode, every connection's endpoint receives through this one
+	 * shared receive context instead of buffers of its own, and 'ring' is
+	 * posted to it. The token a client marks its messages with, in their
+	 * remote CQ data, says whose they are. Tokens are random, so a client
+	 * can't pass its messages off as somebody else's. 'routes' is only for
+	 * op contexts, which we make ourselves. */
+	fid_ep* srx = nullptr;
+	std::unordered_map<uint64_t, connection*> sources;
+
+	/* A worker on a scalable endpoint sends through a transmit context of
+	 * its own, which is 'endpoint' then, and its ring is posted to a receive
+	 * context of its own, which is this one. Its clients send to it by the
+	 * index of that context. */
+	fid_ep* rx_context = nullptr;
+	uint32_t rx_index = 0;
+};
+
+/* Knobs for the server, filled in from the command line. */
+struct server_options {
+	bool shared = false; /* Share one domain and one RX/TX CQ pair. */
+	bool ring = false; /* Receive into a ring of 'FI_MULTI_RECV' buffers. */
+	bool poll = false; /* Busy-poll the completion queues instead of blocking. */
+	bool epoll = false; /* Sleep on every queue at once through 'epoll'. */
+	bool rma = false; /* Let clients write and read the arrays themselves. */
+	bool rdm = false; /* Serve every client through one 'FI_EP_RDM' endpoint. */
+	bool tagged = false; /* Send frames and chunks as tagged streams. */
+	bool credits = false; /* Only send the chunks the client has room for. */
+	bool rpc = false; /* Answer clients' calls instead of exchanging arrays. */
+	bool srx = false; /* Receive from every client through one shared context. */
+	size_t rendezvous = 0; /* Read arrays at least this big, or 0 for none. */
+	size_t workers = 0; /* Worker threads, or 0 to serve on the main thread. */
+	bool pin = false; /* Pin every worker thread to a CPU of its own. */
+	bool metrics = false; /* Count and time operations, and report them. */
+	std::string metrics_path; /* Serve reports on a Unix socket here. */
+	size_t array_len = 50; /* Floats in the array sent to each client. */
+	size_t max_array_len = 16 * 1024 * 1024; /* Floats a client may send. */
+};
+
+/* Everything the event loop hands around while it runs. */
+struct server_state {
+	server_options options;
+	fi_info* info = nullptr;
+	fid_fabric* fabric = nullptr;
+	fid_eq* event_queue = nullptr;
+	connection_table connections;
+
+	/* Where connection requests come in, so one we can't serve can be
+	 * rejected. Over RDM there is none. */
+	fid_pep* listener = nullptr;
+	shared_resources shared;
+
+	/* Which connection each active endpoint belongs to. The events on the
+	 * event queue only point back to the endpoint. */
+	std::unordered_map<fid_t, uint64_t> endpoints;
+	uint64_t next_id = 1;
+
+	/* How far apart the ids this loop hands out are. Every worker starts at
+	 * an id of its own and steps over the others', so ids stay unique across
+	 * the whole server. */
+	uint64_t id_stride = 1;
+
+	/* The CPU the thread running this loop is pinned to, or -1. Completion
+	 * queues opened by it ask for their interrupts to go there too. */
+	int cpu = -1;
+
+	/* On the main thread in scalable mode, the contexts each worker will
+	 * take over. On a worker, the endpoint they belong to, and the clients
+	 * the first worker handed to this one that it hasn't taken in yet. */
+	std::vector<shared_resources> contexts;
+	scalable_endpoint* scalable = nullptr;
+	std::mutex handoff_lock;
+	std::vector<fi_addr_t> handed_over;
+
+	/* With metrics on, what this loop counted and timed. */
+	std::unique_ptr<loop_metrics> metrics;
+
+	/* Backs the event loop off while connections are up but quiet. */
+	CompletionWaiter waiter;
+
+	/* In epoll mode, the event queue and every completion queue this loop
+	 * reads, so it can sleep on all of them at once when a pass finds
+	 * nothing to do. */
+	std::unique_ptr<FdWaitSet> wait_set;
+
+	/* How many completion queue reads it took to get how many completions,
+	 * over every queue the server has read. Empty reads don't count. */
+	uint64_t completion_reads = 0;
+	uint64_t completions = 0;
+};
+
+/* In RDM mode with workers, the one endpoint every client reaches is a
+ * scalable one, with a transmit and a receive context for every worker.
+ * Clients say hello to the first worker's receive context, and it hands
+ * them out to every worker in turn. From then on they send to the receive
+ * context of their own worker, and are answered from its transmit context,
+ * so no two workers ever touch the same context or completion queue. */
+struct scalable_endpoint {
+	std::mutex av_lock; /* Every worker inserts and removes addresses. */
+	std::vector<server_state*> workers;
+	size_t next_worker = 0; /* Only the first worker hands clients out. */
+};
+
+/* A thread serving its share of the clients, with a loop of its own. The
+ * listener hands it connection requests through its event queue, and it
+ * accepts them itself, so every domain, queue and buffer of its connections
+ * is opened, touched and polled by that one thread alone. */
+struct worker {
+	size_t index = 0;
+	server_state state;
+	std::thread thread;
+};
+
 /* Initialize and listen as a libfabric server. */
-int server();
+int server(const server_options& options);
 
 #endif /* NET_HPP */
@@ -1,8 +1,149 @@
 #include "net.hpp"
+
+#include <unistd.h>
+#include <iostream>
 #include <cstdlib>
 
-int main() {
-	server();
+int main(int argc, char* argv[]) {
+	server_options options;
+
+	/* Parse CLI arguments. */
+	int opt = -1;
+	while ((opt = getopt(argc, argv, "srRDTFPEcXV:w:AmM:n:L:")) != -1) {
+		switch (opt) {
+			case 's':
+				options.shared = true;
+
+				break;
+			case 'r':
+				options.ring = true;
+
+				break;
+			case 'R':
+				options.rma = true;
+
+				break;
+			case 'D':
+				options.rdm = true;
+
+				break;
+			case 'T':
+				options.tagged = true;
+
+				break;
+			case 'F':
+				options.credits = true;
+
+				break;
+			case 'P':
+				options.poll = true;
+
+				break;
+			case 'E':
+				options.epoll = true;
+
+				break;
+			case 'c':
+				options.rpc = true;
+
+				break;
+			case 'X':
+				options.srx = true;
+
+				break;
+			case 'V':
+				options.rendezvous = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'w':
+				options.workers = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'A':
+				options.pin = true;
+
+				break;
+			case 'm':
+				options.metrics = true;
+
+				break;
+			case 'M':
+				options.metrics = true;
+				options.metrics_path = optarg;
+
+				break;
+			case 'n':
+				options.array_len = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			case 'L':
+				options.max_array_len = std::strtoull(optarg, nullptr, 10);
+
+				break;
+			default:
+				std::cerr << "Usage: " << argv[0] <<
+					" [-s] [-r] [-R] [-D] [-T] [-F] [-P] [-E] [-c] [-X]"
+					" [-V BYTES]"
+					" [-w WORKERS] [-A] [-m] [-M SOCKET_PATH]"
+					" [-n ARRAY_LEN] [-L MAX_ARRAY_LEN]" <<
+					std::endl;
+
+				return EXIT_FAILURE;
+		}
+	}
+
+	/* Tagged messages never match the untagged buffers of a ring, and RDM
+	 * mode is built on one. */
+	if (options.tagged && (options.ring || options.rdm)) {
+		std::cerr << "[ERROR] -T can't be combined with -r or -D." <<
+			std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* Credit updates are a tagged stream of their own. */
+	if (options.credits && !options.tagged) {
+		std::cerr << "[ERROR] -F needs -T." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* Polled queues have no wait object to sleep on. */
+	if (options.poll && options.epoll) {
+		std::cerr << "[ERROR] -P can't be combined with -E." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* Calls are answered out of a receive ring, over connections only. */
+	if (options.rpc && (options.rma || options.rdm || options.tagged)) {
+		std::cerr << "[ERROR] -c can't be combined with -R, -D or -T." <<
+			std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* RMA mode moves the arrays through windows already, and calls have no
+	 * arrays to move. */
+	if (options.rendezvous > 0 && (options.rma || options.rpc)) {
+		std::cerr << "[ERROR] -V can't be combined with -R or -c." <<
+			std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* A shared receive context takes untagged messages into a ring, and over
+	 * RDM there is only one endpoint to begin with. */
+	if (options.srx && (options.rdm || options.tagged)) {
+		std::cerr << "[ERROR] -X can't be combined with -D or -T." <<
+			std::endl;
+		return EXIT_FAILURE;
+	}
+
+	/* Over RDM, every worker gets a receive context of the one endpoint,
+	 * and clients name theirs in the top bits of the server's address. */
+	if (options.rdm && options.workers > MAX_RX_CONTEXTS) {
+		std::cerr << "[ERROR] -D takes at most " << MAX_RX_CONTEXTS <<
+			" workers." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	server(options);
 
 	return EXIT_SUCCESS;
 }
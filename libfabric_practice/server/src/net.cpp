@@ -1,312 +1,2627 @@
 #include "net.hpp"
 #include "err.hpp"
 #include "debugger.hpp" /* Thank you Riley! :D */
+#include "transfer.hpp"
+#include "frame.hpp"
+#include "typed_frame.hpp"
+#include "recv_ring.hpp"
+#include "completion.hpp"
+#include "rma.hpp"
+#include "rdm.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/random.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+
+/* The maximum number of events that can be queued on the event queue. Every
+ * client costs a 'FI_CONNREQ' and a 'FI_CONNECTED', so this has to be deep
+ * enough to soak up a burst of clients connecting at once. */
+static constexpr size_t EVENT_QUEUE_SIZE = 256;
+
+/* How many events get handled before the established connections are given
+ * a turn again, so a burst of new clients can't starve the ones already
+ * exchanging data. */
+static constexpr size_t EVENTS_PER_PASS = 16;
+
+/* How many completions are pulled off of a completion queue per read. */
+static constexpr size_t COMPLETIONS_PER_READ = 8;
+
+/* The shared completion queues take the completions of every client, so they
+ * are read in much bigger batches and are much deeper. */
+static constexpr size_t SHARED_COMPLETIONS_PER_READ = 64;
+static constexpr size_t SHARED_QUEUE_SIZE = 4096;
+
+/* Every connection needs registered slabs for its values, for each of the
+ * frames it sends, for the frame buffer it receives into, for each
+ * direction of the array, and in flow-control mode, for the credit updates
+ * it receives. Arrays too big for a slab get a registered buffer of their
+ * own from the same pool. Slabs are exactly one frame big. */
+static constexpr size_t SLAB_SIZE = FRAME_SIZE;
+static constexpr size_t SLABS_PER_CONNECTION = FRAME_SLOTS + 5;
+
+/* The shared pool starts out big enough for this many connections, and grows
+ * if more than that show up at once. */
+static constexpr size_t SHARED_POOL_CONNECTIONS = 64;
+
+/* In RDM mode every client's messages land in one ring, so it gets more
+ * buffers than a ring of a single connection's. */
+static constexpr size_t RDM_RING_BUFFERS = 8;
+
+/* The ring of a shared receive context takes the messages of every client,
+ * so it is sized for their load all together. Clients that are idle don't
+ * cost it anything. */
+static constexpr size_t SRX_RING_BUFFERS = 16;
+
+/* The longest a 'SLEEP' call may keep its answer waiting. */
+static constexpr uint64_t RPC_MAX_SLEEP_US = 1000 * 1000;
+
+/* How long a report waits for every loop to hand over a sample of its
+ * connections. A loop sleeps for a second at most, so one that was asleep
+ * still makes it. */
+static constexpr std::chrono::milliseconds METRICS_SAMPLE_TIMEOUT(1500);
+
+/* Set by the signal handler, and checked by the event loop of every thread.
+ * It has to be lock-free to be touched from a signal handler at all. */
+static std::atomic<bool> stop_requested{false};
+static_assert(std::atomic<bool>::is_always_lock_free,
+		"stop_requested is set from a signal handler");
+
+static void request_stop(int) {
+	stop_requested.store(true, std::memory_order_relaxed);
+}
+
+/* Completion queues opened by a pinned loop ask for their interrupts to be
+ * steered to its CPU, so a wake-up lands where the queue is polled. */
+static void steer_interrupts(int cpu, fi_cq_attr& attr) {
+	if (cpu < 0)
+		return;
+
+	attr.flags |= FI_AFFINITY;
+	attr.signaling_vector = cpu;
+}
+
+/* In epoll mode, have the loop sleep on 'queue' as well. Queues opened by
+ * the loop go in as they are opened. Returns 0, or a negative error code. */
+static int watch(server_state& state, fid_t queue) {
+	return state.wait_set ? state.wait_set->add(queue) : 0;
+}
+
+/* Stop sleeping on 'queue', before it is closed. */
+static void unwatch(server_state& state, fid_t queue) {
+	if (state.wait_set)
+		state.wait_set->remove(queue);
+}
+
+/* What the registered buffers are used for. In rendezvous mode, clients'
+ * arrays are read into them too. */
+static uint64_t pool_access(const server_options& options) {
+	uint64_t access = FI_SEND | FI_RECV;
+	if (options.rendezvous > 0)
+		access |= FI_READ;
+	return access;
+}
+
+/* In scalable mode every worker inserts and removes addresses in the one
+ * address vector, so they take turns. Otherwise nobody else touches it. */
+static std::unique_lock<std::mutex> lock_address_vector(server_state& state) {
+	if (!state.scalable)
+		return std::unique_lock<std::mutex>();
+
+	return std::unique_lock<std::mutex>(state.scalable->av_lock);
+}
+
+/* What a completion was for: a whole frame, one chunk of the part of an
+ * array that didn't fit in its frame, the response to a call, one chunk of
+ * an array read out of the client's memory, or a credit update from the
+ * client. Reads complete on the transmit queue, next to the chunks we send,
+ * so they need a kind of their own. */
+enum op_kind : uintptr_t {
+	FRAME_OP = 0,
+	CHUNK_OP = 1,
+	RESPONSE_OP = 2,
+	READ_OP = 3,
+	CREDIT_OP = 4
+};
+
+/* The context handed to every operation posted for a connection. It is the
+ * connection's id rather than its address, so a completion that straggles in
+ * after its connection was freed can't be mistaken for another one. The
+ * lowest bits tell what kind of operation it was, and for a response, which
+ * of the connection's response slots it went out of. */
+static constexpr unsigned OP_KIND_BITS = 3;
+static constexpr unsigned OP_SLOT_BITS = 14;
+static constexpr unsigned OP_ID_SHIFT = OP_KIND_BITS + OP_SLOT_BITS;
+static constexpr size_t MAX_RESPONSE_SLOTS = size_t(1) << OP_SLOT_BITS;
+
+/* A response only takes its frame header and, behind that, the call buffer
+ * it is built in, so a slab is carved into many response slots. A client
+ * gets at most 'MAX_CALLS_IN_FLIGHT' calls taken in at once. The rest stay
+ * where they landed in the ring until a slot frees up. */
+static constexpr size_t RESPONSE_SLOT_SIZE =
+	(2 * (sizeof(frame_header) + RPC_MESSAGE_SIZE) + CACHE_LINE_SIZE - 1) &
+	~(CACHE_LINE_SIZE - 1);
+static constexpr size_t MAX_CALLS_IN_FLIGHT = 256;
+static_assert(MAX_CALLS_IN_FLIGHT + SLAB_SIZE / RESPONSE_SLOT_SIZE <=
+		MAX_RESPONSE_SLOTS, "response slots have to fit in an op context");
+
+static void* op_context(const connection& conn, op_kind kind,
+		size_t slot = 0) {
+	return reinterpret_cast<void*>(
+			static_cast<uintptr_t>(conn.id << OP_ID_SHIFT) |
+			(slot << OP_KIND_BITS) | kind);
+}
+
+static uint64_t context_id(void* context) {
+	return static_cast<uint64_t>(
+			reinterpret_cast<uintptr_t>(context) >> OP_ID_SHIFT);
+}
+
+static op_kind context_kind(void* context) {
+	return static_cast<op_kind>(reinterpret_cast<uintptr_t>(context) &
+			((uintptr_t(1) << OP_KIND_BITS) - 1));
+}
+
+static size_t context_slot(void* context) {
+	return (reinterpret_cast<uintptr_t>(context) >> OP_KIND_BITS) &
+		(MAX_RESPONSE_SLOTS - 1);
+}
+
+/* Where a loop counts what had to wait or went wrong, if anywhere. */
+static op_stats* loop_stats(server_state& state) {
+	return state.metrics ? &state.metrics->stats : nullptr;
+}
+
+/* With metrics on, when an operation being timed starts. Without, nothing is
+ * timed, and the clock isn't even read. */
+static uint64_t start_timing(const connection& conn) {
+	return conn.metrics ? monotonic_ns() : 0;
+}
+
+/* The operation that started at 'started' is done. Stamp how long it took,
+ * once. */
+static void stamp_latency(connection& conn, latency_op op,
+		uint64_t& started) {
+	if (!conn.metrics || started == 0)
+		return;
+
+	conn.metrics->latencies.push(conn.id, op, monotonic_ns() - started);
+	started = 0;
+}
+
+/* The same for the call answered out of response slot 'slot'. */
+static void stamp_response(connection& conn, size_t slot) {
+	if (slot < conn.response_started.size())
+		stamp_latency(conn, latency_op::RESPONSE, conn.response_started[slot]);
+}
+
+/* Find the handler for a completion on one of a connection's own queues.
+ * Everything on them is the connection's, the id is only double-checked. */
+static CompletionHandler* resolve_own(void* context, void* arg) {
+	ConnectionHandler* handler = static_cast<ConnectionHandler*>(arg);
+	return context_id(context) == handler->conn->id ? handler : nullptr;
+}
+
+/* Find the handler for a completion on one of the shared queues, through the
+ * id in its context. Returns nullptr if that connection has already been
+ * released. */
+static connection* route_completion(server_state& state, void* context) {
+	auto found = state.shared.routes.find(context_id(context));
+	return found == state.shared.routes.end() ? nullptr : found->second;
+}
+
+static CompletionHandler* resolve_shared_transmit(void* context, void* arg) {
+	connection* conn = route_completion(*static_cast<server_state*>(arg),
+			context);
+	return conn ? &conn->transmit_handler : nullptr;
+}
+
+static CompletionHandler* resolve_shared_recv(void* context, void* arg) {
+	connection* conn = route_completion(*static_cast<server_state*>(arg),
+			context);
+	return conn ? &conn->recv_handler : nullptr;
+}
+
+/* Add up what a dispatcher read before it goes away. */
+static void account_reads(server_state& state,
+		const CompletionDispatcher* dispatcher) {
+	if (!dispatcher)
+		return;
+
+	state.completion_reads += dispatcher->reads();
+	state.completions += dispatcher->completions();
+}
+
+/* Tell the client we are done with it. Over RDM there is no connection to
+ * shut down, so there is nothing to tell. */
+static int disconnect(connection& conn) {
+	return conn.rdm ? 0 : fi_shutdown(conn.endpoint, 0);
+}
+
+/* A token for a client to mark its messages with in SRX mode. Nothing else
+ * says whose a message is, so it comes from the kernel's random pool, where
+ * no other client can guess it. It is never 0, which marks nothing, and
+ * never one somebody else holds. */
+static uint64_t new_source_token(const server_state& state) {
+	uint64_t token = 0;
+	while (token == 0 || state.shared.sources.count(token)) {
+		ssize_t got = getrandom(&token, sizeof(token), 0);
+		if (got < 0 && errno != EINTR)
+			check_libfabric(-errno, "getrandom(), source token");
+	}
+	return token;
+}
+
+/* Release everything that was opened for a single connection. */
+static void close_connection(server_state& state, connection& conn) {
+	/* Endpoints must be closed before any objects bound to them can be. The
+	 * shared RDM endpoint stays open, the client only leaves the address
+	 * vector. */
+	if (conn.rdm) {
+		state.shared.peers.erase(conn.address);
+		std::unique_lock<std::mutex> lock = lock_address_vector(state);
+		fi_av_remove(state.shared.av, &conn.address, 1, 0);
+	} else if (conn.endpoint) {
+		state.endpoints.erase(&conn.endpoint->fid);
+		check_libfabric(fi_close(&conn.endpoint->fid),
+				"fi_close(), endpoint");
+	}
+
+	/* Calls held back in a shared ring would hold its buffers forever. A
+	 * ring of the connection's own goes away with it. */
+	if (conn.ring && !conn.own_ring) {
+		for (const recv_view& view : conn.deferred_calls) {
+			ssize_t ret = conn.ring->consume(view);
+			if (ret < 0)
+				std::cerr << "[client " << conn.id << "] Reposting the "
+					"ring: " << fi_strerror(-ret) << std::endl;
+		}
+	}
+	conn.deferred_calls.clear();
+
+	/* The counters go with the endpoint they counted, what they said stays
+	 * with the loop. */
+	if (conn.metrics)
+		conn.metrics->closed += conn.counters.read();
+	conn.counters.reset();
+
+	/* With the endpoint gone, nobody can reach the windows anymore either.
+	 * Their regions have to go before the memory under them does. */
+	if (conn.send_arr_mr)
+		check_libfabric(fi_close(&conn.send_arr_mr->fid),
+				"fi_close(), send_arr_mr");
+	if (conn.recv_arr_mr)
+		check_libfabric(fi_close(&conn.recv_arr_mr->fid),
+				"fi_close(), recv_arr_mr");
+	conn.send_arr_mr = nullptr;
+	conn.recv_arr_mr = nullptr;
+
+	/* With the endpoint gone nothing can be using the slabs anymore. A pool
+	 * of the connection's own has to go before its domain does. */
+	if (conn.pool) {
+		conn.pool->release(conn.control_slab);
+		for (buffer_slab*& slab : conn.send_frame_slabs) {
+			conn.pool->release(slab);
+			slab = nullptr;
+		}
+		conn.pool->release(conn.recv_frame_slab);
+		conn.pool->release(conn.send_arr_slab);
+		conn.pool->release(conn.recv_arr_slab);
+		conn.pool->release(conn.credit_slab);
+		for (buffer_slab* slab : conn.response_slabs)
+			conn.pool->release(slab);
+	}
+	conn.response_slabs.clear();
+	conn.response_slots.clear();
+	conn.response_started.clear();
+	conn.free_responses.clear();
+	conn.calls.clear();
+	conn.control_slab = nullptr;
+	conn.control = nullptr;
+	conn.recv_frame_slab = nullptr;
+	conn.send_arr_slab = nullptr;
+	conn.recv_arr_slab = nullptr;
+	conn.credit_slab = nullptr;
+	conn.send_transfer.reset();
+	conn.recv_transfer.reset();
+	conn.credits.reset();
+	conn.ring = nullptr;
+	conn.own_ring.reset();
+	conn.own_pool.reset();
+	conn.pool = nullptr;
+
+	/* The shared domain and completion queues outlive any one connection,
+	 * it just stops receiving its completions. */
+	if (conn.shared) {
+		state.shared.routes.erase(conn.id);
+		if (conn.source != 0)
+			state.shared.sources.erase(conn.source);
+		conn.recv_queue = nullptr;
+		conn.transmit_queue = nullptr;
+		conn.domain = nullptr;
+	}
+
+	/* Objects inside a domain have to be closed before the domain can. */
+	if (conn.recv_queue) {
+		unwatch(state, &conn.recv_queue->fid);
+		check_libfabric(fi_close(&conn.recv_queue->fid),
+				"fi_close(), recv_queue");
+	}
+	if (conn.transmit_queue) {
+		unwatch(state, &conn.transmit_queue->fid);
+		check_libfabric(fi_close(&conn.transmit_queue->fid),
+				"fi_close(), transmit_queue");
+	}
+
+	if (conn.domain)
+		check_libfabric(fi_close(&conn.domain->fid), "fi_close(), domain");
+
+	fi_freeinfo(conn.info);
+	conn.info = nullptr;
+
+	conn.endpoint = nullptr;
+	conn.recv_queue = nullptr;
+	conn.transmit_queue = nullptr;
+	conn.domain = nullptr;
+	conn.state = conn_state::CLOSED;
+}
+
+/* Hand a new connection its control block and the slabs its frames are sent
+ * from. Returns 0, or '-FI_ENOMEM' if the pool can't spare them, and then
+ * the ones it did are still the connection's to give back. */
+static ssize_t acquire_buffers(server_state& state, connection& conn) {
+	conn.control_slab = conn.pool->try_acquire();
+	if (!conn.control_slab)
+		return -FI_ENOMEM;
+	conn.control = new (conn.control_slab->data) control_block;
+	conn.control->send_msg_size = state.options.array_len;
+	conn.max_array_bytes = std::min(state.options.max_array_len,
+			SIZE_MAX / sizeof(float)) * sizeof(float);
+	for (buffer_slab*& slab : conn.send_frame_slabs) {
+		slab = conn.pool->try_acquire();
+		if (!slab)
+			return -FI_ENOMEM;
+	}
+	return 0;
+}
+
+/* Completions are handed to the connection through its handlers. A
+ * connection with queues of its own also reads them through dispatchers of
+ * its own, the shared queues are read by the shared dispatchers instead. */
+static void attach_handlers(server_state& state, connection& conn) {
+	conn.transmit_handler.state = &state;
+	conn.transmit_handler.conn = &conn;
+	conn.transmit_handler.transmit = true;
+	conn.recv_handler.state = &state;
+	conn.recv_handler.conn = &conn;
+	if (conn.shared)
+		return;
+
+	conn.transmit_dispatcher = std::make_unique<CompletionDispatcher>(
+			conn.transmit_queue, COMPLETIONS_PER_READ, resolve_own,
+			&conn.transmit_handler);
+	conn.recv_dispatcher = std::make_unique<CompletionDispatcher>(
+			conn.recv_queue, COMPLETIONS_PER_READ, resolve_own,
+			&conn.recv_handler);
+	conn.transmit_dispatcher->track(loop_stats(state));
+	conn.recv_dispatcher->track(loop_stats(state));
+}
+
+/* Build the endpoint and completion queues for a client that asked to
+ * connect, pre-post its receives and accept it. The connection isn't usable
+ * until 'FI_CONNECTED' shows up for it on the event queue. Returns 0, or a
+ * negative libfabric error code with 'step' saying what failed, and then
+ * whatever was opened is still in 'conn'. */
+static ssize_t open_connection(server_state& state, connection& conn,
+		fi_eq_cm_entry& conn_req, const char*& step) {
+	/* The event loop only ever polls the completion queues, so in poll mode
+	 * they don't need a wait object at all. In epoll mode, it sleeps on
+	 * their file descriptors. */
+	fi_cq_attr completion_queue_attr = cq_attr(state.waiter.mode());
+	steer_interrupts(state.cpu, completion_queue_attr);
+
+	/* Create a domain for the client based off of their provider info, or
+	 * borrow the one everybody shares. */
+	ssize_t ret = 0;
+	if (conn.shared) {
+		conn.domain = state.shared.domain;
+	} else {
+		step = "fi_domain()";
+		ret = fi_domain(state.fabric, conn_req.info, &conn.domain, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* Every send reports a completion unless it says otherwise. Injected
+	 * frames are the exception, see the transmit queue's binding below. */
+	conn_req.info->tx_attr->op_flags |= FI_COMPLETION;
+
+	/* Create an endpoint for the client using their provider info. The
+	 * connection is handed in as the context, so it can be found again. */
+	step = "fi_endpoint()";
+	ret = fi_endpoint(conn.domain, conn_req.info, &conn.endpoint, &conn);
+	if (ret < 0)
+		return ret;
+
+	/* Both sides size their frames and split the arrays the same way, since
+	 * they work it out from the same provider limits. The requestor's info
+	 * is kept for exactly that. */
+	conn.config = make_transfer_config(conn_req.info);
+	conn.config.tagged = state.options.tagged;
+	conn.config.stats = loop_stats(state);
+	conn.metrics = state.metrics.get();
+	conn.info = conn_req.info;
+	conn_req.info = nullptr;
+
+	/* Registered memory for everything this connection sends or receives. */
+	if (conn.shared) {
+		conn.pool = state.shared.pool.get();
+	} else {
+		conn.own_pool = std::make_unique<BufferPool>(conn.domain, SLAB_SIZE,
+				SLABS_PER_CONNECTION, pool_access(state.options));
+		conn.pool = conn.own_pool.get();
+	}
+	step = "acquire_buffers()";
+	ret = acquire_buffers(state, conn);
+	if (ret < 0)
+		return ret;
+
+	/* Whatever the client sends lands either in a ring big enough for its
+	 * largest message, or one at a time in a frame buffer. In SRX mode, it
+	 * lands in the ring every client shares. */
+	if (state.options.srx) {
+		conn.ring = state.shared.ring.get();
+	} else if (state.options.ring) {
+		conn.own_ring = std::make_unique<RecvRing>(*conn.pool,
+				std::max(FRAME_SIZE, conn.config.chunk_size));
+		conn.ring = conn.own_ring.get();
+		step = "fi_setopt(), FI_OPT_MIN_MULTI_RECV";
+		ret = conn.ring->configure(conn.endpoint);
+		if (ret < 0)
+			return ret;
+	} else {
+		conn.recv_frame_slab = conn.pool->try_acquire();
+		if (!conn.recv_frame_slab) {
+			step = "BufferPool::try_acquire(), recv_frame_slab";
+			return -FI_ENOMEM;
+		}
+	}
+
+	/* Open a receiving and tramsission completion queue bound to the
+	 * requestor's domain and endpoint, or use the shared pair. */
+	if (conn.shared) {
+		conn.recv_queue = state.shared.recv_queue;
+		conn.transmit_queue = state.shared.transmit_queue;
+		state.shared.routes.emplace(conn.id, &conn);
+		if (state.options.srx) {
+			conn.source = new_source_token(state);
+			state.shared.sources.emplace(conn.source, &conn);
+		}
+	} else {
+		step = "fi_cq_open(), recv_queue";
+		ret = fi_cq_open(conn.domain, &completion_queue_attr,
+				&conn.recv_queue, nullptr);
+		if (ret == 0) {
+			step = "FdWaitSet::add(), recv_queue";
+			ret = watch(state, &conn.recv_queue->fid);
+		}
+		if (ret == 0) {
+			step = "fi_cq_open(), transmit_queue";
+			ret = fi_cq_open(conn.domain, &completion_queue_attr,
+					&conn.transmit_queue, nullptr);
+		}
+		if (ret == 0) {
+			step = "FdWaitSet::add(), transmit_queue";
+			ret = watch(state, &conn.transmit_queue->fid);
+		}
+		if (ret < 0)
+			return ret;
+	}
+
+	attach_handlers(state, conn);
+
+	step = "bind_queues()";
+	ret = bind_queues(conn.endpoint, conn.recv_queue, conn.transmit_queue);
+	if (ret < 0)
+		return ret;
+	if (state.options.srx) {
+		step = "fi_ep_bind(), srx";
+		ret = fi_ep_bind(conn.endpoint, &state.shared.srx->fid, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* With metrics on, the provider counts every operation the endpoint
+	 * completes. Not every provider can, and the connection does fine
+	 * without. */
+	if (conn.metrics) {
+		ret = conn.counters.bind(conn.domain, conn.endpoint);
+		if (ret < 0)
+			std::cerr << "[client " << conn.id << "] No counters: " <<
+				fi_strerror(-ret) << std::endl;
+	}
+
+	/* Bind the new active endpoint to the event queue and enable it.*/
+	step = "fi_ep_bind(), event_queue";
+	ret = fi_ep_bind(conn.endpoint, &state.event_queue->fid, 0);
+	if (ret < 0)
+		return ret;
+	step = "fi_enable()";
+	ret = fi_enable(conn.endpoint);
+	if (ret < 0)
+		return ret;
+
+	/* This is asynchronous, so post the receive buffers for the client's
+	 * frames up front, so when data is sent, there is a place for it to go.
+	 * The shared ring is posted already. */
+	if (conn.own_ring) {
+		step = "RecvRing::post()";
+		ret = conn.ring->post(conn.endpoint, op_context(conn, FRAME_OP));
+	} else if (conn.recv_frame_slab) {
+		step = "post_frame_recv()";
+		ret = post_frame_recv(conn.endpoint, conn.info, conn.recv_frame_slab,
+				op_context(conn, FRAME_OP), conn.config);
+	}
+	if (ret < 0)
+		return ret;
+
+	/* With flow control, the client's credit updates land in a slab of their
+	 * own, and the receive for them stays up as long as the connection. */
+	if (state.options.credits) {
+		step = "CreditLink::post()";
+		conn.credit_slab = conn.pool->try_acquire();
+		if (!conn.credit_slab)
+			return -FI_ENOMEM;
+		conn.credits = std::make_unique<CreditLink>(conn.endpoint, conn.info,
+				conn.credit_slab, conn.config, op_context(conn, CREDIT_OP));
+		ret = conn.credits->post();
+		if (ret < 0)
+			return ret;
+	}
+
+	/* Send an acceptance response back to the requestor. In SRX mode, it
+	 * carries the token the client marks its messages with. */
+	const bool mark = state.options.srx;
+	step = "fi_accept()";
+	return fi_accept(conn.endpoint, mark ? &conn.source : nullptr,
+			mark ? sizeof(uint64_t) : 0);
+}
+
+/* A client asked to connect. If anything its connection needs can't be had,
+ * only that client is turned away, and everybody else is served on. */
+static void accept_connection(server_state& state,
+		fi_eq_cm_entry& conn_req) {
+	auto conn = std::make_unique<connection>();
+	conn->id = state.next_id;
+	state.next_id += state.id_stride;
+	conn->shared = state.options.shared;
+	conn->rma = state.options.rma;
+	conn->rpc = state.options.rpc;
+	conn->rendezvous = state.options.rendezvous;
+
+	const char* step = "";
+	ssize_t ret = open_connection(state, *conn, conn_req, step);
+	if (ret < 0) {
+		std::cerr << "[client " << conn->id << "] Turned away, " << step <<
+			": " << fi_strerror(-ret) << std::endl;
+
+		/* The request's info is either still in 'conn_req', or the
+		 * connection took it over, and goes with it. */
+		fi_info* request = conn_req.info ? conn_req.info : conn->info;
+		if (state.listener)
+			fi_reject(state.listener, request->handle, nullptr, 0);
+		fi_freeinfo(conn_req.info);
+		conn_req.info = nullptr;
+		close_connection(state, *conn);
+		return;
+	}
+
+	state.endpoints.emplace(&conn->endpoint->fid, conn->id);
+	state.connections.emplace(conn->id, std::move(conn));
+}
+
+/* One of our frames went out of 'slot', and its completion is still due. The
+ * slot is in its op context, so the completion finds when it was posted. */
+static void frame_posted(connection& conn, frame_slot slot) {
+	conn.pending_send++;
+	conn.frame_started[slot] = start_timing(conn);
+}
+
+/* Post one of our frames, and follow it up with the part of its payload that
+ * didn't fit in it, if there is any. Injected frames are done as soon as
+ * they are posted. */
+static ssize_t send_frame(connection& conn, frame_slot slot, frame_type type,
+		const void* payload, size_t length, void* payload_desc) {
+	ssize_t sent_inline = post_frame(conn.endpoint, conn.info,
+			conn.send_frame_slabs[slot], type, conn.send_sequence++, payload,
+			length, payload_desc, op_context(conn, FRAME_OP, slot),
+			conn.config);
+	if (sent_inline < 0)
+		return sent_inline;
+	if (!frame_fits_inject(conn.info, length))
+		frame_posted(conn, slot);
+
+	size_t remainder = length - static_cast<size_t>(sent_inline);
+	if (remainder == 0)
+		return 0;
+
+	conn.send_transfer = std::make_unique<ChunkedTransfer>(
+			ChunkedTransfer::direction::SEND, conn.endpoint,
+			const_cast<char*>(static_cast<const char*>(payload)) + sent_inline,
+			remainder, payload_desc, conn.config, op_context(conn, CHUNK_OP));
+	conn.send_transfer->use_credits(conn.credits.get());
+	conn.send_started = start_timing(conn);
+	return conn.send_transfer->post();
+}
+
+/* Post one of our fixed-size frames. Whether it completes is known before
+ * it is built. */
+template <frame_type Type, typename T>
+static ssize_t send_value_frame(connection& conn, frame_slot slot,
+		const T& value) {
+	ssize_t ret = send_value<Type>(conn.endpoint, conn.send_frame_slabs[slot],
+			conn.send_sequence++, value, op_context(conn, FRAME_OP, slot),
+			conn.config);
+	if (ret < 0)
+		return ret;
+	if constexpr (typed_frame_completes<T>)
+		frame_posted(conn, slot);
+
+	return 0;
+}
+
+/* Our array is big enough to go by rendezvous. Register it on its own, and
+ * only send the client a window on it. The client reads it straight out of
+ * there, and says so once it has, until then the array has to stay put. */
+static ssize_t announce_array(connection& conn, size_t send_bytes) {
+	ssize_t ret = expose_region(conn.domain, conn.send_arr_slab->data,
+			send_bytes, FI_REMOTE_READ, &conn.send_arr_mr);
+	if (ret < 0)
+		return ret;
+
+	conn.fin_due = true;
+	return send_value_frame<frame_type::RENDEZVOUS>(conn, ARRAY_FRAME,
+			describe_region(conn.info, conn.send_arr_mr,
+				conn.send_arr_slab->data, send_bytes));
+}
+
+/* Tell the client we are done reading its array. */
+static ssize_t send_fin(connection& conn) {
+	ssize_t ret = send_typed<frame_type::RENDEZVOUS_FIN>(conn.endpoint,
+			conn.info, conn.send_frame_slabs[FIN_FRAME], conn.send_sequence++,
+			std::span<const char, 0>(), nullptr,
+			op_context(conn, FRAME_OP, FIN_FRAME), conn.config);
+	if (ret < 0)
+		return ret;
+	if constexpr (typed_frame_completes<char, 0>)
+		frame_posted(conn, FIN_FRAME);
+
+	return 0;
+}
+
+/* The client is connected, so send our float and our array, one frame
+ * each. Every frame carries its own length, so there is no need to trade
+ * array sizes first, and nothing here waits on the client. Remember, these
+ * calls are primarily asynchronous. In RMA mode the array stays put until
+ * the client asks for it. */
+static bool start_exchange(connection& conn) {
+	/* In RPC mode there is nothing to send until the client calls. */
+	if (conn.rpc) {
+		conn.state = conn_state::SERVING;
+		return true;
+	}
+
+	control_block& control = *conn.control;
+	size_t send_bytes = control.send_msg_size * sizeof(float);
+	conn.send_arr_slab = conn.pool->acquire(send_bytes);
+	if (!conn.send_arr_slab) {
+		std::cerr << "[client " << conn.id << "] No buffer for an array of " <<
+			send_bytes << " bytes." << std::endl;
+		return false;
+	}
+
+	/* Fill the array in place, so it never has to be copied. */
+	float* send_arr = reinterpret_cast<float*>(conn.send_arr_slab->data);
+	std::fill(send_arr, send_arr + control.send_msg_size, 25.2);
+
+	conn.state = conn_state::EXCHANGING;
+
+	ssize_t ret = send_value_frame<frame_type::SCALAR>(conn, SCALAR_FRAME,
+			control.send_buffer);
+	if (ret == 0 && conn.rendezvous > 0 && send_bytes >= conn.rendezvous)
+		ret = announce_array(conn, send_bytes);
+	else if (ret == 0 && !conn.rma)
+		ret = send_frame(conn, ARRAY_FRAME, frame_type::ARRAY, send_arr,
+				send_bytes, conn.send_arr_slab->desc);
+	if (ret < 0) {
+		std::cerr << "[client " << conn.id << "] Sending frames: " <<
+			fi_strerror(-ret) << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+/* Whether the client's array of 'bytes' is one we take in: a whole number of
+ * floats, and no more than we were told to allow. Its length is whatever the
+ * client says it is, so this has to be asked before anything is allocated
+ * for it. */
+static bool array_fits(const connection& conn, uint64_t bytes) {
+	if (bytes % sizeof(float) == 0 && bytes <= conn.max_array_bytes)
+		return true;
+
+	std::cerr << "[client " << conn.id << "] Array of " << bytes <<
+		" bytes refused, at most " << conn.max_array_bytes << " are." <<
+		std::endl;
+	return false;
+}
+
+/* The client's array frame is in. Copy what came along in the frame into a
+ * buffer big enough for the whole array, and have the rest land right
+ * behind it. With a receive ring the rest lands in the ring, and is copied
+ * over as it shows up. */
+static ssize_t receive_array(connection& conn, const frame_header& header,
+		const char* payload, size_t in_frame) {
+	if (!array_fits(conn, header.length))
+		return -FI_EMSGSIZE;
+
+	control_block& control = *conn.control;
+	control.recv_msg_size = header.length / sizeof(float);
+	std::cout << "[client " << conn.id << "] Array size received: " <<
+		control.recv_msg_size << std::endl;
+
+	conn.recv_arr_slab = conn.pool->acquire(header.length);
+	if (!conn.recv_arr_slab)
+		return -FI_ENOMEM;
+	std::memcpy(conn.recv_arr_slab->data, payload, in_frame);
+	conn.array_received = true;
+
+	size_t remainder = header.length - in_frame;
+	if (remainder == 0)
+		return 0;
+
+	conn.recv_started = start_timing(conn);
+	if (conn.ring) {
+		conn.recv_filled = in_frame;
+		conn.recv_remaining = remainder;
+		return 0;
+	}
+
+	conn.recv_transfer = std::make_unique<ChunkedTransfer>(
+			ChunkedTransfer::direction::RECV, conn.endpoint,
+			conn.recv_arr_slab->data + in_frame, remainder,
+			conn.recv_arr_slab->desc, conn.config, op_context(conn, CHUNK_OP));
+	conn.recv_transfer->use_credits(conn.credits.get());
+	return conn.recv_transfer->post();
+}
+
+/* The client's array is big enough to go by rendezvous, and 'window' is on
+ * it. Read it straight into a buffer of ours, a window of chunks at a time,
+ * with no receives to post and nothing to copy. Once the last read is in,
+ * the client hears so. */
+static ssize_t pull_array(connection& conn, const rma_window& window) {
+	if (!array_fits(conn, window.length))
+		return -FI_EMSGSIZE;
+
+	/* Anything smaller should have come along in frames, and reading it
+	 * costs a registration for nothing. */
+	if (window.length < conn.rendezvous) {
+		std::cerr << "[client " << conn.id << "] Rendezvous for " <<
+			window.length << " bytes refused, it starts at " <<
+			conn.rendezvous << "." << std::endl;
+		return -FI_EMSGSIZE;
+	}
+
+	control_block& control = *conn.control;
+	control.recv_msg_size = window.length / sizeof(float);
+	std::cout << "[client " << conn.id << "] Array size received: " <<
+		control.recv_msg_size << std::endl;
+
+	conn.recv_arr_slab = conn.pool->acquire(window.length);
+	if (!conn.recv_arr_slab)
+		return -FI_ENOMEM;
+	conn.array_received = true;
+	conn.recv_transfer = std::make_unique<ChunkedTransfer>(
+			ChunkedTransfer::direction::READ, conn.endpoint,
+			conn.recv_arr_slab->data, window.length, conn.recv_arr_slab->desc,
+			conn.config, op_context(conn, READ_OP), window);
+	conn.recv_started = start_timing(conn);
+	ssize_t ret = conn.recv_transfer->post();
+	if (ret == 0 && conn.recv_transfer->done())
+		ret = send_fin(conn);
+	return ret;
+}
+
+/* The client wants to write its array rather than send it. Register a
+ * buffer for it to write into and our own array for it to read out of, and
+ * answer with a window on each. Neither array needs us again until the
+ * client's 'RMA_DONE' frame is in. */
+static ssize_t offer_windows(connection& conn, const rma_request& request) {
+	if (!array_fits(conn, request.length))
+		return -FI_EMSGSIZE;
+
+	control_block& control = *conn.control;
+	control.recv_msg_size = request.length / sizeof(float);
+	std::cout << "[client " << conn.id << "] Array size received: " <<
+		control.recv_msg_size << std::endl;
+
+	size_t send_bytes = control.send_msg_size * sizeof(float);
+	conn.recv_arr_slab = conn.pool->acquire(request.length);
+	if (!conn.recv_arr_slab)
+		return -FI_ENOMEM;
+	ssize_t ret = expose_region(conn.domain, conn.recv_arr_slab->data,
+			request.length, FI_REMOTE_WRITE, &conn.recv_arr_mr);
+	if (ret == 0)
+		ret = expose_region(conn.domain, conn.send_arr_slab->data, send_bytes,
+				FI_REMOTE_READ, &conn.send_arr_mr);
+	if (ret < 0)
+		return ret;
+
+	control.offer.read = describe_region(conn.info, conn.send_arr_mr,
+			conn.send_arr_slab->data, send_bytes);
+	control.offer.write = describe_region(conn.info, conn.recv_arr_mr,
+			conn.recv_arr_slab->data, request.length);
+
+	/* The 'RMA_DONE' frame is next, so the frame buffer goes right back up.
+	 * A ring is still posted. */
+	if (!conn.ring) {
+		ret = post_frame_recv(conn.endpoint, conn.info, conn.recv_frame_slab,
+				op_context(conn, FRAME_OP), conn.config);
+		if (ret < 0)
+			return ret;
+	}
+
+	return send_value_frame<frame_type::RMA_WINDOWS>(conn, ARRAY_FRAME,
+			control.offer);
+}
+
+/* Make sure a response slot is free, carving another slab out of the pool
+ * into slots if every one is in use. Returns false if the client has as
+ * many calls in flight as it may, or the pool can't spare a slab. */
+static bool reserve_response_slot(connection& conn) {
+	if (!conn.free_responses.empty())
+		return true;
+	if (conn.response_slots.size() >= MAX_CALLS_IN_FLIGHT)
+		return false;
+
+	buffer_slab* slab = conn.pool->try_acquire();
+	if (!slab)
+		return false;
+
+	conn.response_slabs.push_back(slab);
+	for (size_t offset = 0; offset + RESPONSE_SLOT_SIZE <= slab->size;
+			offset += RESPONSE_SLOT_SIZE) {
+		conn.free_responses.push_back(conn.response_slots.size());
+		conn.response_slots.push_back({ .data = slab->data + offset,
+				.size = RESPONSE_SLOT_SIZE, .desc = slab->desc });
+	}
+	return true;
+}
+
+/* Hand out a response slot. Returns the slot, or -FI_EAGAIN if none can be
+ * had right now. */
+static ssize_t claim_response_slot(connection& conn) {
+	if (!reserve_response_slot(conn))
+		return -FI_EAGAIN;
+
+	size_t slot = conn.free_responses.back();
+	conn.free_responses.pop_back();
+	return static_cast<ssize_t>(slot);
+}
+
+/* Run the handler of a call the client made, 'length' bytes at 'message',
+ * and write its response straight into a response slot. Most handlers are
+ * done right away. A 'SLEEP' is only done once its time is up, so calls
+ * made after it get answered first. Returns 0, or a negative libfabric error
+ * code. */
+static ssize_t take_call(connection& conn, const char* message,
+		size_t length) {
+	ssize_t slot = claim_response_slot(conn);
+	if (slot < 0)
+		return slot;
+	if (conn.metrics) {
+		conn.response_started.resize(conn.response_slots.size());
+		conn.response_started[static_cast<size_t>(slot)] = monotonic_ns();
+	}
+
+	rpc_header request;
+	std::memcpy(&request, message, sizeof(rpc_header));
+	const char* args = message + sizeof(rpc_header);
+	const size_t args_len = length - sizeof(rpc_header);
+
+	char* response = call_buffer(&conn.response_slots[slot]);
+	char* result = response + sizeof(rpc_header);
+	size_t result_len = 0;
+
+	pending_call call;
+	call.slot = static_cast<size_t>(slot);
+	call.due = std::chrono::steady_clock::now();
+
+	rpc_header answer = request;
+	answer.status = 0;
+	switch (static_cast<rpc_method>(request.method)) {
+		case rpc_method::ECHO:
+			std::memcpy(result, args, args_len);
+			result_len = args_len;
+			break;
+		case rpc_method::SUM: {
+			if (args_len % sizeof(float) != 0) {
+				answer.status = -FI_EINVAL;
+				break;
+			}
+			float sum = 0;
+			for (size_t offset = 0; offset < args_len;
+					offset += sizeof(float)) {
+				float value;
+				std::memcpy(&value, args + offset, sizeof(float));
+				sum += value;
+			}
+			std::memcpy(result, &sum, sizeof(float));
+			result_len = sizeof(float);
+			break;
+		}
+		case rpc_method::SLEEP: {
+			uint64_t micros = 0;
+			if (args_len != sizeof(uint64_t)) {
+				answer.status = -FI_EINVAL;
+				break;
+			}
+			std::memcpy(&micros, args, sizeof(uint64_t));
+			call.due += std::chrono::microseconds(
+					std::min(micros, RPC_MAX_SLEEP_US));
+			break;
+		}
+		default:
+			answer.status = -FI_ENOSYS;
+			break;
+	}
+
+	std::memcpy(response, &answer, sizeof(rpc_header));
+	call.length = sizeof(rpc_header) + result_len;
+	conn.calls.push_back(call);
+	return 0;
+}
+
+/* Send the response of every call whose handler is done. Calls that finish
+ * early overtake the ones that don't, so responses go out in whatever order
+ * they are ready in. Returns how many went out, or a negative libfabric
+ * error code. */
+static ssize_t answer_calls(connection& conn) {
+	const auto now = std::chrono::steady_clock::now();
+	ssize_t answered = 0;
+	for (size_t i = 0; i < conn.calls.size();) {
+		const pending_call call = conn.calls[i];
+		if (call.due > now) {
+			i++;
+			continue;
+		}
+
+		buffer_slab* slab = &conn.response_slots[call.slot];
+		ssize_t ret = post_frame(conn.endpoint, conn.info, slab,
+				frame_type::RPC_RESPONSE, conn.send_sequence, call_buffer(slab),
+				call.length, slab->desc,
+				op_context(conn, RESPONSE_OP, call.slot), conn.config);
+		if (ret == -FI_EAGAIN) {
+			/* The rest go out on a later pass. */
+			if (conn.config.stats)
+				op_stats::bump(conn.config.stats->eagain);
+			conn.calls[i].stalled = true;
+			break;
+		}
+		if (ret < 0)
+			return ret;
+		if (call.stalled && conn.config.stats)
+			op_stats::bump(conn.config.stats->retries);
+
+		/* An injected response is out already, so its slot is free. */
+		conn.send_sequence++;
+		if (frame_fits_inject(conn.info, call.length)) {
+			conn.free_responses.push_back(call.slot);
+			stamp_response(conn, call.slot);
+		}
+
+		conn.calls[i] = conn.calls.back();
+		conn.calls.pop_back();
+		answered++;
+	}
+
+	return answered;
+}
+
+/* One of the client's frames landed as 'message'. The float comes first,
+ * then the array, or in RMA mode the request for windows and then word that
+ * they were used. Returns false if the frame wasn't what the client should
+ * have sent next. */
+static bool handle_frame(connection& conn, const recv_view& message) {
+	frame_view frame;
+	if (!read_frame(message, frame)) {
+		std::cerr << "[client " << conn.id << "] Frame of " << message.len <<
+			" bytes is too short." << std::endl;
+		return false;
+	}
+
+	const frame_header& header = frame.header;
+	const size_t in_frame = frame.in_frame;
+	if (header.sequence != conn.recv_sequence++) {
+		std::cerr << "[client " << conn.id << "] Expected frame " <<
+			conn.recv_sequence - 1 << ", got " << header.sequence << "." <<
+			std::endl;
+		return false;
+	}
+
+	ssize_t ret = 0;
+	rma_request request = {};
+	rma_window window = {};
+	if (conn.state == conn_state::EXCHANGING &&
+			header.type == static_cast<uint16_t>(frame_type::SCALAR) &&
+			read_value(frame, conn.control->recv_buffer)) {
+		std::cout << std::endl << "[client " << conn.id <<
+			"] Data received: " << conn.control->recv_buffer << std::endl;
+
+		/* The array frame is next, so the frame buffer goes right back up.
+		 * A ring is still posted. */
+		conn.state = conn_state::STREAMING;
+		if (!conn.ring)
+			ret = post_frame_recv(conn.endpoint, conn.info,
+					conn.recv_frame_slab, op_context(conn, FRAME_OP),
+					conn.config);
+	} else if (!conn.rma && conn.state == conn_state::STREAMING &&
+			!conn.array_received &&
+			header.type == static_cast<uint16_t>(frame_type::ARRAY)) {
+		ret = receive_array(conn, header, frame.payload, in_frame);
+	} else if (conn.rendezvous > 0 && conn.state == conn_state::STREAMING &&
+			!conn.array_received &&
+			header.type == static_cast<uint16_t>(frame_type::RENDEZVOUS) &&
+			read_value(frame, window)) {
+		ret = pull_array(conn, window);
+	} else if (conn.fin_due && conn.array_received &&
+			header.type == static_cast<uint16_t>(frame_type::RENDEZVOUS_FIN)) {
+		/* The client has read our array, so it can let go of it. */
+		conn.fin_due = false;
+	} else if (conn.rma && conn.state == conn_state::STREAMING &&
+			!conn.recv_arr_mr &&
+			header.type == static_cast<uint16_t>(frame_type::RMA_REQUEST) &&
+			read_value(frame, request)) {
+		ret = offer_windows(conn, request);
+	} else if (conn.recv_arr_mr && !conn.array_received &&
+			header.type == static_cast<uint16_t>(frame_type::RMA_DONE)) {
+		/* The client's writes only completed once they were in, so the
+		 * array already is. */
+		conn.array_received = true;
+	} else if (conn.state == conn_state::SERVING &&
+			header.type == static_cast<uint16_t>(frame_type::RPC_REQUEST) &&
+			in_frame == header.length && in_frame >= sizeof(rpc_header) &&
+			in_frame <= RPC_MESSAGE_SIZE) {
+		ret = take_call(conn, frame.payload, in_frame);
+	} else {
+		std::cerr << "[client " << conn.id << "] Unexpected frame of type " <<
+			header.type << "." << std::endl;
+		return false;
+	}
+
+	if (ret < 0) {
+		std::cerr << "[client " << conn.id << "] Answering a frame: " <<
+			fi_strerror(-ret) << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+/* Take in a message from the connection's receive ring, and give its room
+ * back to the ring. Until the array frame is in, every message is a frame.
+ * After that, they are the chunks of the array's remainder, in order, and
+ * are copied to where they belong, and once those are in, it is frames
+ * again. Returns false if the connection has to go. */
+static bool take_ring_message(connection& conn, const recv_view& view) {
+	bool ok = true;
+	if (!conn.array_received || conn.recv_remaining == 0) {
+		ok = handle_frame(conn, view);
+	} else if (view.len <= conn.recv_remaining) {
+		std::memcpy(conn.recv_arr_slab->data + conn.recv_filled, view.data,
+				view.len);
+		conn.recv_filled += view.len;
+		conn.recv_remaining -= view.len;
+		if (conn.recv_remaining == 0)
+			stamp_latency(conn, latency_op::ARRAY_RECV, conn.recv_started);
+	} else {
+		std::cerr << "[client " << conn.id << "] Unexpected message of " <<
+			view.len << " bytes." << std::endl;
+		ok = false;
+	}
+
+	ssize_t ret = conn.ring->consume(view);
+	if (ret < 0) {
+		std::cerr << "[client " << conn.id << "] Reposting the ring: " <<
+			fi_strerror(-ret) << std::endl;
+		return false;
+	}
+
+	return ok;
+}
+
+/* A message landed in the connection's receive ring. A call nobody has a
+ * response slot for yet is left in the ring, unconsumed, and so is every
+ * call after it, so they are still taken in the order they came. Once the
+ * ring runs out of room the client's sends stall, which holds it back.
+ * Returns false if the connection has to go. */
+static bool handle_ring_message(connection& conn, const recv_view& view) {
+	if (conn.state == conn_state::SERVING &&
+			(!conn.deferred_calls.empty() || !reserve_response_slot(conn))) {
+		conn.deferred_calls.push_back(view);
+		return true;
+	}
+
+	return take_ring_message(conn, view);
+}
+
+/* Take in the calls that were left in the ring, as long as there are
+ * response slots for them. Returns how many were taken in, or -1 if the
+ * connection has to go. */
+static ssize_t take_deferred_calls(connection& conn) {
+	ssize_t taken = 0;
+	while (!conn.deferred_calls.empty() && reserve_response_slot(conn)) {
+		const recv_view view = conn.deferred_calls.front();
+		conn.deferred_calls.pop_front();
+		if (!take_ring_message(conn, view))
+			return -1;
+		taken++;
+	}
+
+	return taken;
+}
+
+/* Something the client sent has landed, either in the connection's ring or
+ * in its frame buffer. Returns false if the connection has to go. */
+static bool receive_message(connection& conn, const fi_cq_data_entry& entry) {
+	recv_view view;
+	if (!conn.ring) {
+		view.data = conn.recv_frame_slab->data;
+		view.len = entry.len;
+		view.flags = entry.flags;
+		view.cq_data = entry.data;
+		return handle_frame(conn, view);
+	}
+
+	ssize_t ret = conn.ring->handle(entry, view);
+	if (ret < 0) {
+		std::cerr << "[client " << conn.id << "] Reposting the ring: " <<
+			fi_strerror(-ret) << std::endl;
+		return false;
+	}
+
+	return ret == 0 || handle_ring_message(conn, view);
+}
+
+/* Everything has been exchanged, so print the array and release the
+ * connection to the client. */
+static void finish_exchange(server_state& state, connection& conn) {
+	const float* recv_arr = reinterpret_cast<float*>(conn.recv_arr_slab->data);
+	std::cout << "[client " << conn.id << "] Array: ";
+	for (size_t i = 0; i < conn.control->recv_msg_size; i++)
+		std::cout << recv_arr[i] << " ";
+	std::cout << std::endl;
+
+	check_libfabric(disconnect(conn), "fi_shutdown(), endpoint");
+	close_connection(state, conn);
+}
+
+/* Answer whatever calls of a connection in RPC mode are done, then take in
+ * the ones left in the ring for as many slots as are free. Returns how many
+ * calls were answered or taken in. */
+static size_t serve_calls(server_state& state, connection& conn) {
+	ssize_t answered = answer_calls(conn);
+	if (answered < 0) {
+		std::cerr << "[client " << conn.id << "] Answering calls: " <<
+			fi_strerror(-answered) << std::endl;
+		close_connection(state, conn);
+		return 1; /* Closing it counts as progress too. */
+	}
+
+	ssize_t taken = take_deferred_calls(conn);
+	if (taken < 0) {
+		disconnect(conn);
+		close_connection(state, conn);
+		return 1;
+	}
+
+	return static_cast<size_t>(answered + taken);
+}
+
+/* Finish the exchange once the client's array is fully in, and everything we
+ * sent has completed. In RPC mode, answer the calls that are done instead. */
+static void advance_connection(server_state& state, connection& conn) {
+	if (conn.state == conn_state::SERVING) {
+		serve_calls(state, conn);
+		return;
+	}
+
+	if (conn.state != conn_state::STREAMING || !conn.array_received)
+		return;
+	if (conn.recv_transfer && !conn.recv_transfer->done())
+		return;
+	if (conn.recv_remaining > 0)
+		return;
+
+	/* The client's array is all in. If ours went by rendezvous, the client's
+	 * word that it read it is still due, and nothing else is, so the frame
+	 * buffer can go back up for it. A ring is still posted. */
+	if (conn.fin_due) {
+		if (conn.ring || conn.fin_posted)
+			return;
+
+		ssize_t ret = post_frame_recv(conn.endpoint, conn.info,
+				conn.recv_frame_slab, op_context(conn, FRAME_OP), conn.config);
+		if (ret < 0) {
+			std::cerr << "[client " << conn.id <<
+				"] Posting a frame buffer: " << fi_strerror(-ret) << std::endl;
+			close_connection(state, conn);
+			return;
+		}
+		conn.fin_posted = true;
+		return;
+	}
+
+	if (conn.pending_send > 0)
+		return;
+	if (conn.send_transfer && !conn.send_transfer->done())
+		return;
+
+	finish_exchange(state, conn);
+}
+
+/* Credit one completed operation to a connection, and move it along. */
+static void credit_completion(server_state& state, connection& conn,
+		bool transmit, const fi_cq_data_entry& entry) {
+	op_kind kind = context_kind(entry.op_context);
+	ssize_t ret = 0;
+	if (kind == CHUNK_OP) {
+		/* Every chunk that completes makes room to post another one. */
+		ChunkedTransfer* transfer = transmit ?
+			conn.send_transfer.get() : conn.recv_transfer.get();
+		if (transfer)
+			ret = transfer->complete(1);
+		if (transfer && transfer->done())
+			stamp_latency(conn, transmit ? latency_op::ARRAY_SEND :
+					latency_op::ARRAY_RECV,
+					transmit ? conn.send_started : conn.recv_started);
+
+		/* A chunk of the client's may carry credits for ours. */
+		if (ret == 0 && !transmit && conn.credits) {
+			conn.credits->take_piggyback(entry.flags, entry.data);
+			if (conn.send_transfer)
+				ret = conn.send_transfer->post();
+		}
+	} else if (kind == CREDIT_OP) {
+		/* The client posted more receives for our chunks. */
+		if (conn.credits)
+			ret = conn.credits->take_update();
+		if (ret == 0 && conn.send_transfer)
+			ret = conn.send_transfer->post();
+	} else if (kind == READ_OP) {
+		/* The same goes for reads, and once the last one is in, the client
+		 * can let go of its array. */
+		if (conn.recv_transfer) {
+			ret = conn.recv_transfer->complete(1);
+			if (ret == 0 && conn.recv_transfer->done()) {
+				stamp_latency(conn, latency_op::ARRAY_READ, conn.recv_started);
+				ret = send_fin(conn);
+			}
+		}
+	} else if (kind == RESPONSE_OP) {
+		/* The response is out, so its slot can take the next one. */
+		conn.free_responses.push_back(context_slot(entry.op_context));
+		stamp_response(conn, context_slot(entry.op_context));
+	} else if (transmit) {
+		conn.pending_send -= std::min<size_t>(conn.pending_send, 1);
+		const size_t slot = context_slot(entry.op_context);
+		if (slot < FRAME_SLOTS)
+			stamp_latency(conn, latency_op::FRAME, conn.frame_started[slot]);
+	} else if (!receive_message(conn, entry)) {
+		disconnect(conn);
+		close_connection(state, conn);
+		return;
+	}
+
+	/* Whatever we granted along the way goes out, unless one of our chunks
+	 * took it along already. */
+	if (ret == 0 && conn.credits)
+		ret = conn.credits->flush();
+
+	if (ret < 0) {
+		std::cerr << "[client " << conn.id << "] Posting the array: " <<
+			fi_strerror(-ret) << std::endl;
+		close_connection(state, conn);
+		return;
+	}
+
+	advance_connection(state, conn);
+}
+
+/* A completion on one of the connection's queues. On a queue of its own,
+ * the rest of the batch is the connection's too, so it stops once the
+ * connection is closed, since the queue is gone by then. */
+bool ConnectionHandler::on_completion(const fi_cq_data_entry& entry) {
+	if (conn->state == conn_state::CLOSED)
+		return conn->shared;
+
+	credit_completion(*state, *conn, transmit, entry);
+	return conn->shared || conn->state != conn_state::CLOSED;
+}
+
+/* One of the connection's operations failed, so only it has to go. */
+void ConnectionHandler::on_error(const fi_cq_err_entry&) {
+	if (conn->state != conn_state::CLOSED)
+		close_connection(*state, *conn);
+}
+
+/* Give a single connection with its own completion queues a turn: reap its
+ * completions, and move it along if it is ready. Returns how many
+ * completions it had. */
+static size_t progress_connection(server_state& state, connection& conn) {
+	if (conn.state == conn_state::ACCEPTING ||
+			conn.state == conn_state::CLOSED)
+		return 0;
+
+	ssize_t sent = conn.transmit_dispatcher->poll();
+	ssize_t received = 0;
+	if (sent >= 0 && conn.state != conn_state::CLOSED)
+		received = conn.recv_dispatcher->poll();
+	if (sent < 0 || received < 0) {
+		std::cerr << "[client " << conn.id << "] fi_cq_read(): " <<
+			fi_strerror(-(sent < 0 ? sent : received)) << std::endl;
+		close_connection(state, conn);
+		return 1; /* Closing it counts as progress too. */
+	}
+
+	return static_cast<size_t>(sent + received);
+}
+
+/* Drain one of the shared completion queues in a single batch. Every
+ * completion is handed to the connection it came from. Returns how many
+ * completions there were. */
+static size_t drain_shared_queue(CompletionDispatcher& dispatcher) {
+	ssize_t read = dispatcher.poll();
+	if (read < 0) {
+		std::cerr << "fi_cq_read(), shared: " << fi_strerror(-read) <<
+			std::endl;
+		return 0;
+	}
+
+	return static_cast<size_t>(read);
+}
+
+/* Handle a single event read off of the event queue. */
+static void handle_event(server_state& state, uint32_t event_type,
+		fi_eq_cm_entry& entry) {
+	if (event_type == FI_CONNREQ) {
+		accept_connection(state, entry);
+		return;
+	}
+
+	/* A straggling event for a connection already released has no entry. */
+	auto endpoint = state.endpoints.find(entry.fid);
+	if (endpoint == state.endpoints.end())
+		return;
+	auto found = state.connections.find(endpoint->second);
+	if (found == state.connections.end())
+		return;
+
+	connection& conn = *found->second;
+	if (event_type == FI_CONNECTED) {
+		std::cout << "[client " << conn.id << "] Connected." << std::endl;
+		if (!start_exchange(conn)) {
+			disconnect(conn);
+			close_connection(state, conn);
+		}
+	} else if (event_type == FI_SHUTDOWN) {
+		std::cout << "[client " << conn.id << "] Disconnected." << std::endl;
+		close_connection(state, conn);
+	}
+}
+
+/* An error showed up on the event queue in place of an event. A connection
+ * request that failed points at the listener, and there is nothing of ours
+ * to release for it, the entry carries no info. Anything else went wrong on
+ * one of our endpoints, a handshake that never finished or a connection
+ * that broke. No 'FI_CONNECTED' or 'FI_SHUTDOWN' is coming for it then, so
+ * its connection is released right here. */
+static void handle_event_error(server_state& state,
+		const fi_eq_err_entry& error) {
+	auto endpoint = state.endpoints.find(error.fid);
+	if (endpoint == state.endpoints.end())
+		return;
+	auto found = state.connections.find(endpoint->second);
+	if (found == state.connections.end())
+		return;
+
+	connection& conn = *found->second;
+	if (conn.state == conn_state::CLOSED)
+		return;
+
+	std::cerr << "[client " << conn.id << "] Connection failed." << std::endl;
+	close_connection(state, conn);
+}
+
+/* Tell a client of a scalable endpoint which receive context is ours. Like
+ * its 'HELLO', this is outside of the sequence, and it goes out ahead of our
+ * float, so the client knows where to send to before it sends anything. */
+static ssize_t send_welcome(server_state& state, connection& conn) {
+	conn.control->rx_index = state.shared.rx_index;
+	ssize_t ret = send_value<frame_type::WELCOME>(conn.endpoint,
+			conn.send_frame_slabs[WELCOME_FRAME], 0, conn.control->rx_index,
+			op_context(conn, FRAME_OP, WELCOME_FRAME), conn.config);
+	if (ret < 0)
+		return ret;
+	if constexpr (typed_frame_completes<uint32_t>)
+		frame_posted(conn, WELCOME_FRAME);
+
+	return 0;
+}
+
+/* Set up a connection for a client that said hello to the shared RDM
+ * endpoint. Everything but its buffers is shared, and there is nothing to
+ * accept, so the exchange starts right away. */
+static void accept_peer(server_state& state, fi_addr_t address) {
+	auto conn = std::make_unique<connection>();
+	conn->id = state.next_id;
+	state.next_id += state.id_stride;
+	conn->shared = true;
+	conn->rdm = true;
+	conn->rma = state.options.rma;
+	conn->rendezvous = state.options.rendezvous;
+	conn->address = address;
+
+	/* Every client is reached through the same endpoint, so they all share
+	 * its limits too. */
+	conn->info = fi_dupinfo(state.info);
+	conn->domain = state.shared.domain;
+	conn->endpoint = state.shared.endpoint;
+	conn->recv_queue = state.shared.recv_queue;
+	conn->transmit_queue = state.shared.transmit_queue;
+	conn->pool = state.shared.pool.get();
+	conn->ring = state.shared.ring.get();
+	if (acquire_buffers(state, *conn) < 0) {
+		std::cerr << "[client " << conn->id << "] Turned away, no buffers." <<
+			std::endl;
+		close_connection(state, *conn);
+		return;
+	}
+
+	conn->config = make_transfer_config(conn->info);
+	conn->config.dest_addr = address;
+	conn->config.stats = loop_stats(state);
+	conn->metrics = state.metrics.get();
+	attach_handlers(state, *conn);
+
+	state.shared.routes.emplace(conn->id, conn.get());
+	state.shared.peers.emplace(address, conn.get());
+
+	connection& peer = *conn;
+	state.connections.emplace(conn->id, std::move(conn));
+	std::cout << "[client " << peer.id << "] Said hello." << std::endl;
+	if (state.scalable && send_welcome(state, peer) < 0) {
+		std::cerr << "[client " << peer.id << "] Sending the welcome failed." <<
+			std::endl;
+		close_connection(state, peer);
+		return;
+	}
+	if (!start_exchange(peer))
+		close_connection(state, peer);
+}
+
+/* Hellos to a scalable endpoint all land on the first worker, which hands
+ * the clients out to every worker in turn, itself included. The worker takes
+ * its client in on its own thread, and answers from its own contexts. */
+static void hand_over_peer(server_state& state, fi_addr_t address) {
+	scalable_endpoint& scalable = *state.scalable;
+	server_state& target = *scalable.workers[scalable.next_worker++ %
+		scalable.workers.size()];
+
+	std::lock_guard<std::mutex> lock(target.handoff_lock);
+	target.handed_over.push_back(address);
+}
+
+/* Take in the clients the first worker handed to this one. Returns how many
+ * there were. */
+static size_t adopt_peers(server_state& state) {
+	std::vector<fi_addr_t> addresses;
+	{
+		std::lock_guard<std::mutex> lock(state.handoff_lock);
+		addresses.swap(state.handed_over);
+	}
+
+	for (fi_addr_t address : addresses)
+		accept_peer(state, address);
+	return addresses.size();
+}
+
+/* A message from an address that isn't in the address vector yet. The only
+ * thing a stranger may send is a 'HELLO' frame, with its endpoint name in
+ * it, so it can be inserted and answered. */
+static void greet_peer(server_state& state, const recv_view& view) {
+	fi_addr_t address = FI_ADDR_NOTAVAIL;
+	ssize_t ret = -FI_EINVAL;
+	frame_view frame;
+	if (read_frame(view, frame) &&
+			frame.header.type == static_cast<uint16_t>(frame_type::HELLO) &&
+			frame.in_frame == frame.header.length) {
+		std::unique_lock<std::mutex> lock = lock_address_vector(state);
+		ret = insert_address(state.shared.av, frame.payload, frame.in_frame,
+				&address);
+	}
+
+	ssize_t consumed = state.shared.ring->consume(view);
+	if (consumed < 0)
+		std::cerr << "Reposting the shared ring: " <<
+			fi_strerror(-consumed) << std::endl;
+
+	if (ret < 0) {
+		std::cerr << "Dropping a message from an unknown peer: " <<
+			fi_strerror(-ret) << std::endl;
+		return;
+	}
+
+	if (state.shared.peers.count(address)) {
+		std::cerr << "A peer said hello twice." << std::endl;
+		return;
+	}
+
+	if (state.scalable)
+		hand_over_peer(state, address);
+	else
+		accept_peer(state, address);
+}
+
+/* Drain the receive queue of the shared RDM endpoint in a single batch.
+ * Everything lands in the shared ring, so the dispatcher's op contexts don't
+ * say whose a message is. The address it came from does. Returns how many
+ * completions there were. */
+static size_t drain_rdm_queue(server_state& state) {
+	fi_cq_data_entry entries[SHARED_COMPLETIONS_PER_READ];
+	fi_addr_t sources[SHARED_COMPLETIONS_PER_READ];
+	ssize_t read = fi_cq_readfrom(state.shared.recv_queue, entries,
+			SHARED_COMPLETIONS_PER_READ, sources);
+	if (read == -FI_EAGAIN)
+		return 0;
+	if (read == -FI_EAVAIL) {
+		fi_cq_err_entry error_entry = check_cq_error(state.shared.recv_queue);
+		if (state.metrics)
+			state.metrics->stats.count_error(error_entry.err);
+		return 1;
+	}
+	if (read < 0) {
+		std::cerr << "fi_cq_readfrom(), shared: " << fi_strerror(-read) <<
+			std::endl;
+		return 0;
+	}
+	if (state.metrics)
+		op_stats::raise(state.metrics->stats.cq_depth_max,
+				static_cast<uint64_t>(read));
+
+	state.completion_reads++;
+	state.completions += static_cast<uint64_t>(read);
+	for (ssize_t i = 0; i < read; i++) {
+		recv_view view;
+		ssize_t ret = state.shared.ring->handle(entries[i], view);
+		if (ret < 0) {
+			std::cerr << "Reposting the shared ring: " << fi_strerror(-ret) <<
+				std::endl;
+			continue;
+		}
+		if (ret == 0)
+			continue;
+
+		auto found = state.shared.peers.find(sources[i]);
+		if (found == state.shared.peers.end()) {
+			greet_peer(state, view);
+			continue;
+		}
+
+		connection& conn = *found->second;
+		if (!handle_ring_message(conn, view))
+			close_connection(state, conn);
+		else
+			advance_connection(state, conn);
+	}
+
+	return static_cast<size_t>(read);
+}
+
+/* Drain the receive queue of the shared receive context in a single batch.
+ * Everything lands in the one ring posted to it, so the op contexts don't
+ * say whose a message is. The id its client marked it with does. Returns
+ * how many completions there were. */
+static size_t drain_srx_queue(server_state& state) {
+	fi_cq_data_entry entries[SHARED_COMPLETIONS_PER_READ];
+	ssize_t read = fi_cq_read(state.shared.recv_queue, entries,
+			SHARED_COMPLETIONS_PER_READ);
+	if (read == -FI_EAGAIN)
+		return 0;
+	if (read == -FI_EAVAIL) {
+		fi_cq_err_entry error_entry = check_cq_error(state.shared.recv_queue);
+		if (state.metrics)
+			state.metrics->stats.count_error(error_entry.err);
+		return 1;
+	}
+	if (read < 0) {
+		std::cerr << "fi_cq_read(), srx: " << fi_strerror(-read) << std::endl;
+		return 0;
+	}
+	if (state.metrics)
+		op_stats::raise(state.metrics->stats.cq_depth_max,
+				static_cast<uint64_t>(read));
+
+	state.completion_reads++;
+	state.completions += static_cast<uint64_t>(read);
+	for (ssize_t i = 0; i < read; i++) {
+		recv_view view;
+		ssize_t ret = state.shared.ring->handle(entries[i], view);
+		if (ret < 0) {
+			std::cerr << "Reposting the shared ring: " << fi_strerror(-ret) <<
+				std::endl;
+			continue;
+		}
+		if (ret == 0)
+			continue;
+
+		connection* conn = nullptr;
+		if (view.flags & FI_REMOTE_CQ_DATA) {
+			auto found = state.shared.sources.find(view.cq_data);
+			if (found != state.shared.sources.end())
+				conn = found->second;
+		}
+
+		/* The token is no frame header, so the frame is read without it. */
+		view.flags &= ~FI_REMOTE_CQ_DATA;
+		view.cq_data = 0;
+
+		if (!conn || conn->state == conn_state::CLOSED) {
+			ssize_t consumed = state.shared.ring->consume(view);
+			if (consumed < 0)
+				std::cerr << "Reposting the shared ring: " <<
+					fi_strerror(-consumed) << std::endl;
+			continue;
+		}
+
+		if (!handle_ring_message(*conn, view)) {
+			disconnect(*conn);
+			close_connection(state, *conn);
+		} else {
+			advance_connection(state, *conn);
+		}
+	}
+
+	return static_cast<size_t>(read);
+}
+
+/* Open the domain and the pair of completion queues that every connection
+ * shares in shared mode. */
+static void open_shared_resources(server_state& state) {
+	fi_cq_attr completion_queue_attr = cq_attr(state.waiter.mode(),
+			SHARED_QUEUE_SIZE);
+	steer_interrupts(state.cpu, completion_queue_attr);
+
+	/* The listener's info describes the same domain the connection requests
+	 * will come in on. */
+	check_libfabric(fi_domain(state.fabric, state.info, &state.shared.domain,
+				0), "fi_domain(), shared");
+	check_libfabric(fi_cq_open(state.shared.domain, &completion_queue_attr,
+				&state.shared.recv_queue, nullptr),
+			"fi_cq_open(), shared recv_queue");
+	check_libfabric(fi_cq_open(state.shared.domain, &completion_queue_attr,
+				&state.shared.transmit_queue, nullptr),
+			"fi_cq_open(), shared transmit_queue");
+	check_libfabric(watch(state, &state.shared.recv_queue->fid),
+			"FdWaitSet::add()");
+	check_libfabric(watch(state, &state.shared.transmit_queue->fid),
+			"FdWaitSet::add()");
+
+	/* Every completion on the shared queues finds its way to the connection
+	 * it belongs to through the id in its context. */
+	state.shared.transmit_dispatcher = std::make_unique<CompletionDispatcher>(
+			state.shared.transmit_queue, SHARED_COMPLETIONS_PER_READ,
+			resolve_shared_transmit, &state);
+	if (!state.options.rdm && !state.options.srx)
+		state.shared.recv_dispatcher = std::make_unique<CompletionDispatcher>(
+				state.shared.recv_queue, SHARED_COMPLETIONS_PER_READ,
+				resolve_shared_recv, &state);
+	state.shared.transmit_dispatcher->track(loop_stats(state));
+	if (state.shared.recv_dispatcher)
+		state.shared.recv_dispatcher->track(loop_stats(state));
+
+	state.shared.pool = std::make_unique<BufferPool>(state.shared.domain,
+			SLAB_SIZE, SLABS_PER_CONNECTION * SHARED_POOL_CONNECTIONS,
+			pool_access(state.options));
+
+	/* Every connection's endpoint is bound to the shared receive context as
+	 * it is accepted. Its ring goes up once, here, for all of them. */
+	if (state.options.srx) {
+		check_libfabric(fi_srx_context(state.shared.domain,
+					state.info->rx_attr, &state.shared.srx, nullptr),
+				"fi_srx_context()");
+		transfer_config config = make_transfer_config(state.info);
+		state.shared.ring = std::make_unique<RecvRing>(*state.shared.pool,
+				std::max(FRAME_SIZE, config.chunk_size), SRX_RING_BUFFERS);
+		check_libfabric(state.shared.ring->configure(state.shared.srx),
+				"fi_setopt(), FI_OPT_MIN_MULTI_RECV");
+		check_libfabric(state.shared.ring->post(state.shared.srx, nullptr),
+				"RecvRing::post()");
+	}
+}
+
+/* Open the one endpoint every client is served through in RDM mode, on the
+ * shared domain and queues, with the address vector the clients go in and a
+ * ring for whatever any of them sends. */
+static void open_rdm_endpoint(server_state& state) {
+	state.info->tx_attr->op_flags |= FI_COMPLETION;
+	check_libfabric(fi_endpoint(state.shared.domain, state.info,
+				&state.shared.endpoint, nullptr), "fi_endpoint(), rdm");
+
+	check_libfabric(bind_queues(state.shared.endpoint,
+				state.shared.recv_queue, state.shared.transmit_queue),
+			"bind_queues(), shared");
+	check_libfabric(open_address_vector(state.shared.domain,
+				state.shared.endpoint, &state.shared.av),
+			"open_address_vector()");
+
+	/* Clients' messages are interleaved in the ring, so it is sized for the
+	 * largest message of any of them. */
+	transfer_config config = make_transfer_config(state.info);
+	state.shared.ring = std::make_unique<RecvRing>(*state.shared.pool,
+			std::max(FRAME_SIZE, config.chunk_size), RDM_RING_BUFFERS);
+	check_libfabric(state.shared.ring->configure(state.shared.endpoint),
+			"fi_setopt(), FI_OPT_MIN_MULTI_RECV");
+
+	check_libfabric(fi_enable(state.shared.endpoint), "fi_enable(), rdm");
+	check_libfabric(state.shared.ring->post(state.shared.endpoint, nullptr),
+			"RecvRing::post()");
+}
+
+/* Close the shared objects. Every connection must be closed already. */
+static void close_shared_resources(server_state& state) {
+	account_reads(state, state.shared.transmit_dispatcher.get());
+	account_reads(state, state.shared.recv_dispatcher.get());
+	state.shared.transmit_dispatcher.reset();
+	state.shared.recv_dispatcher.reset();
+
+	/* The RDM endpoint goes first, then the ring it was writing into, and
+	 * the address vector it was bound to. A worker on a scalable endpoint
+	 * only closes its own contexts. The endpoint, its address vector and its
+	 * domain are closed once every worker is done with them. */
+	if (state.shared.endpoint)
+		check_libfabric(fi_close(&state.shared.endpoint->fid),
+				"fi_close(), rdm endpoint");
+	state.shared.endpoint = nullptr;
+	if (state.shared.rx_context)
+		check_libfabric(fi_close(&state.shared.rx_context->fid),
+				"fi_close(), rx_context");
+	state.shared.rx_context = nullptr;
+	if (state.shared.srx)
+		check_libfabric(fi_close(&state.shared.srx->fid), "fi_close(), srx");
+	state.shared.srx = nullptr;
+	state.shared.ring.reset();
+	if (state.shared.av && !state.scalable)
+		check_libfabric(fi_close(&state.shared.av->fid), "fi_close(), av");
+	state.shared.av = nullptr;
+
+	state.shared.pool.reset();
+	unwatch(state, &state.shared.recv_queue->fid);
+	unwatch(state, &state.shared.transmit_queue->fid);
+	check_libfabric(fi_close(&state.shared.recv_queue->fid),
+			"fi_close(), shared recv_queue");
+	check_libfabric(fi_close(&state.shared.transmit_queue->fid),
+			"fi_close(), shared transmit_queue");
+	if (!state.scalable)
+		check_libfabric(fi_close(&state.shared.domain->fid),
+				"fi_close(), shared domain");
+	state.shared.domain = nullptr;
+}
+
+/* The CPU the 'index'th worker is pinned to: the 'index'th one this process
+ * may run on, wrapping around if there are more workers than CPUs. Returns
+ * -1 if that can't be found out. */
+static int worker_cpu(size_t index) {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0)
+		return -1;
+
+	size_t count = static_cast<size_t>(CPU_COUNT(&allowed));
+	if (count == 0)
+		return -1;
+
+	size_t skip = index % count;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		if (skip-- == 0)
+			return cpu;
+	}
+
+	return -1;
+}
+
+/* Open a pair of contexts on the scalable endpoint for the 'index'th worker,
+ * each bound to a completion queue of the worker's own, along with a pool
+ * and a ring for it. The worker takes them over when it starts. */
+static shared_resources open_worker_contexts(server_state& state,
+		size_t index) {
+	fi_cq_attr completion_queue_attr = cq_attr(state.waiter.mode(),
+			SHARED_QUEUE_SIZE);
+	steer_interrupts(state.options.pin ? worker_cpu(index) : -1,
+			completion_queue_attr);
+
+	shared_resources contexts;
+	contexts.domain = state.shared.domain;
+	contexts.av = state.shared.av;
+	contexts.rx_index = static_cast<uint32_t>(index);
+	check_libfabric(fi_cq_open(contexts.domain, &completion_queue_attr,
+				&contexts.recv_queue, nullptr),
+			"fi_cq_open(), worker recv_queue");
+	check_libfabric(fi_cq_open(contexts.domain, &completion_queue_attr,
+				&contexts.transmit_queue, nullptr),
+			"fi_cq_open(), worker transmit_queue");
+
+	int context = static_cast<int>(index);
+	check_libfabric(fi_tx_context(state.shared.endpoint, context, nullptr,
+				&contexts.endpoint, nullptr), "fi_tx_context()");
+	check_libfabric(fi_rx_context(state.shared.endpoint, context, nullptr,
+				&contexts.rx_context, nullptr), "fi_rx_context()");
+	check_libfabric(fi_ep_bind(contexts.endpoint,
+				&contexts.transmit_queue->fid,
+				FI_TRANSMIT | FI_SELECTIVE_COMPLETION),
+			"fi_ep_bind(), worker transmit_queue");
+	check_libfabric(fi_ep_bind(contexts.rx_context,
+				&contexts.recv_queue->fid, FI_RECV),
+			"fi_ep_bind(), worker recv_queue");
+
+	contexts.pool = std::make_unique<BufferPool>(contexts.domain, SLAB_SIZE,
+			SLABS_PER_CONNECTION * SHARED_POOL_CONNECTIONS,
+			pool_access(state.options));
+	transfer_config config = make_transfer_config(state.info);
+	contexts.ring = std::make_unique<RecvRing>(*contexts.pool,
+			std::max(FRAME_SIZE, config.chunk_size), RDM_RING_BUFFERS);
+	check_libfabric(contexts.ring->configure(contexts.rx_context),
+			"fi_setopt(), FI_OPT_MIN_MULTI_RECV");
+
+	check_libfabric(fi_enable(contexts.endpoint), "fi_enable(), tx_context");
+	check_libfabric(fi_enable(contexts.rx_context),
+			"fi_enable(), rx_context");
+	check_libfabric(contexts.ring->post(contexts.rx_context, nullptr),
+			"RecvRing::post()");
+	return contexts;
+}
+
+/* Open the scalable endpoint of RDM mode with workers, with a pair of
+ * contexts for every worker. All of it is opened here, on the main thread,
+ * before any worker runs: the domain is shared by every worker, and only
+ * its contexts are safe to use from a thread each without taking turns. */
+static void open_scalable_endpoint(server_state& state) {
+	const size_t workers = state.options.workers;
+	state.info->tx_attr->op_flags |= FI_COMPLETION;
+	state.info->ep_attr->tx_ctx_cnt = workers;
+	state.info->ep_attr->rx_ctx_cnt = workers;
+
+	check_libfabric(fi_domain(state.fabric, state.info, &state.shared.domain,
+				0), "fi_domain(), scalable");
+	check_libfabric(fi_scalable_ep(state.shared.domain, state.info,
+				&state.shared.endpoint, nullptr), "fi_scalable_ep()");
+	check_libfabric(open_address_vector(state.shared.domain,
+				state.shared.endpoint, &state.shared.av, 0, true),
+			"open_address_vector()");
+
+	for (size_t i = 0; i < workers; i++)
+		state.contexts.push_back(open_worker_contexts(state, i));
+	check_libfabric(fi_enable(state.shared.endpoint),
+			"fi_enable(), scalable");
+}
+
+/* Close the scalable endpoint once every worker closed its contexts. */
+static void close_scalable_endpoint(server_state& state) {
+	check_libfabric(fi_close(&state.shared.endpoint->fid),
+			"fi_close(), scalable endpoint");
+	check_libfabric(fi_close(&state.shared.av->fid), "fi_close(), av");
+	check_libfabric(fi_close(&state.shared.domain->fid),
+			"fi_close(), scalable domain");
+	state.shared.endpoint = nullptr;
+	state.shared.av = nullptr;
+	state.shared.domain = nullptr;
+}
+
+/* How long the loop may sleep on its wait set: until the first call being
+ * held back is due, and never longer than a second, to notice a stop
+ * request. Calls whose time is up but couldn't be posted wait at least a
+ * millisecond, their transmit queue wakes the loop up sooner anyway. */
+static int wait_timeout(const server_state& state) {
+	using std::chrono::milliseconds;
+	const auto now = std::chrono::steady_clock::now();
+	milliseconds timeout(1000);
+	for (const auto& [key, conn] : state.connections) {
+		if (conn->state != conn_state::SERVING)
+			continue;
+
+		for (const pending_call& call : conn->calls) {
+			milliseconds left = std::chrono::ceil<milliseconds>(call.due - now);
+			timeout = std::min(timeout, std::max(left, milliseconds(1)));
+		}
+	}
+
+	return static_cast<int>(timeout.count());
+}
+
+/* A report wants a sample of this loop's connections, so hand one over.
+ * Reading the counters is a call into the provider, so it is only done when
+ * asked. */
+static void sample_connections(server_state& state) {
+	loop_metrics& metrics = *state.metrics;
+	const uint64_t wanted = metrics.wanted.load(std::memory_order_acquire);
+	if (wanted == metrics.sampled.load(std::memory_order_relaxed))
+		return;
+
+	std::vector<connection_sample> samples;
+	samples.reserve(state.connections.size());
+	for (const auto& [id, conn] : state.connections) {
+		if (conn->state == conn_state::CLOSED)
+			continue;
+
+		connection_sample sample;
+		sample.id = id;
+		sample.counted = conn->counters.bound();
+		sample.counts = conn->counters.read();
+		samples.push_back(sample);
+	}
+
+	std::lock_guard<std::mutex> lock(metrics.sample_lock);
+	metrics.samples = std::move(samples);
+	metrics.closed_sample = metrics.closed;
+	metrics.sampled.store(wanted, std::memory_order_release);
+}
+
+/* Add what an endpoint's counters said to a report. */
+static void report_counts(MetricsReport& report, const std::string& loop,
+		const std::string& client, const op_counts& counts) {
+	report.add("fabric_server_ops_total",
+			{{"loop", loop}, {"client", client}, {"direction", "transmit"}},
+			static_cast<double>(counts.transmits));
+	report.add("fabric_server_ops_total",
+			{{"loop", loop}, {"client", client}, {"direction", "receive"}},
+			static_cast<double>(counts.receives));
+	report.add("fabric_server_op_errors_total",
+			{{"loop", loop}, {"client", client}, {"direction", "transmit"}},
+			static_cast<double>(counts.transmit_errors));
+	report.add("fabric_server_op_errors_total",
+			{{"loop", loop}, {"client", client}, {"direction", "receive"}},
+			static_cast<double>(counts.receive_errors));
+}
+
+/* Put a report together out of what every loop counted, timed and sampled.
+ * Runs on the exporter's thread. A loop that doesn't hand over a sample in
+ * time, because it is on its way out, is reported with the last one it
+ * did. */
+static MetricsReport collect_metrics(const std::vector<server_state*>& loops) {
+	for (server_state* loop : loops)
+		loop->metrics->wanted.fetch_add(1, std::memory_order_release);
+
+	const auto deadline = std::chrono::steady_clock::now() +
+		METRICS_SAMPLE_TIMEOUT;
+	for (server_state* loop : loops) {
+		const loop_metrics& metrics = *loop->metrics;
+		while (metrics.sampled.load(std::memory_order_acquire) !=
+				metrics.wanted.load(std::memory_order_relaxed) &&
+				std::chrono::steady_clock::now() < deadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	MetricsReport report;
+	report.describe("fabric_server_eagain_total", "counter",
+			"Posts the provider had no room for.");
+	report.describe("fabric_server_retries_total", "counter",
+			"Posts that made it after one didn't.");
+	report.describe("fabric_server_credit_stalls_total", "counter",
+			"Posts held back for lack of credits.");
+	report.describe("fabric_server_cq_errors_total", "counter",
+			"Error completions.");
+	report.describe("fabric_server_rnr_total", "counter",
+			"Error completions of a receiver that wasn't ready.");
+	report.describe("fabric_server_cq_depth_max", "gauge",
+			"Most completions one read found waiting.");
+	report.describe("fabric_server_connections", "gauge",
+			"Connections being served.");
+	report.describe("fabric_server_ops_total", "counter",
+			"Operations the provider counted.");
+	report.describe("fabric_server_op_errors_total", "counter",
+			"Failed operations the provider counted.");
+	report.describe("fabric_server_latency_ns", "summary",
+			"Time from posting an operation to its completion.");
+	report.describe("fabric_server_latency_lost_total", "counter",
+			"Latency stamps written over before they were read.");
+
+	static constexpr std::pair<double, const char*> quantiles[] = {
+		{50.0, "0.5"}, {99.0, "0.99"}, {99.9, "0.999"}
+	};
+
+	std::vector<latency_stamp> stamps;
+	for (size_t i = 0; i < loops.size(); i++) {
+		loop_metrics& metrics = *loops[i]->metrics;
+		const std::string loop = std::to_string(i);
+		const MetricsReport::labels by_loop = {{"loop", loop}};
+
+		const op_stats& stats = metrics.stats;
+		const auto value = [](const std::atomic<uint64_t>& counter) {
+			return static_cast<double>(
+					counter.load(std::memory_order_relaxed));
+		};
+		report.add("fabric_server_eagain_total", by_loop, value(stats.eagain));
+		report.add("fabric_server_retries_total", by_loop,
+				value(stats.retries));
+		report.add("fabric_server_credit_stalls_total", by_loop,
+				value(stats.credit_stalls));
+		report.add("fabric_server_cq_errors_total", by_loop,
+				value(stats.cq_errors));
+		report.add("fabric_server_rnr_total", by_loop, value(stats.rnr));
+		report.add("fabric_server_cq_depth_max", by_loop,
+				value(stats.cq_depth_max));
+
+		/* The histograms keep everything read so far, so the summaries
+		 * cover the whole run. */
+		stamps.clear();
+		metrics.lost += metrics.latencies.drain(metrics.cursor, stamps);
+		for (const latency_stamp& stamp : stamps)
+			if (stamp.op < latency_op::COUNT)
+				metrics.latency[static_cast<size_t>(stamp.op)].record(
+						stamp.nanos);
+		report.add("fabric_server_latency_lost_total", by_loop,
+				static_cast<double>(metrics.lost));
+
+		for (size_t op = 0; op < metrics.latency.size(); op++) {
+			const Histogram& histogram = metrics.latency[op];
+			if (histogram.count() == 0)
+				continue;
+
+			const std::string name =
+				latency_op_name(static_cast<latency_op>(op));
+			for (const auto& [percent, quantile] : quantiles)
+				report.add("fabric_server_latency_ns",
+						{{"loop", loop}, {"op", name}, {"quantile", quantile}},
+						static_cast<double>(histogram.percentile(percent)));
+			report.add("fabric_server_latency_ns",
+					{{"loop", loop}, {"op", name}},
+					histogram.mean() * static_cast<double>(histogram.count()),
+					"_sum");
+			report.add("fabric_server_latency_ns",
+					{{"loop", loop}, {"op", name}},
+					static_cast<double>(histogram.count()), "_count");
+		}
+
+		std::lock_guard<std::mutex> lock(metrics.sample_lock);
+		report.add("fabric_server_connections", by_loop,
+				static_cast<double>(metrics.samples.size()));
+		report_counts(report, loop, "closed", metrics.closed_sample);
+		for (const connection_sample& sample : metrics.samples)
+			if (sample.counted)
+				report_counts(report, loop, std::to_string(sample.id),
+						sample.counts);
+	}
+
+	return report;
+}
+
+/* With metrics on, start reporting what 'loops' count. This has to happen
+ * before any of them gets a thread. */
+static std::unique_ptr<MetricsExporter> start_exporter(
+		const server_options& options, std::vector<server_state*> loops) {
+	if (!options.metrics)
+		return nullptr;
+
+	return std::make_unique<MetricsExporter>(
+			[loops]() { return collect_metrics(loops); },
+			options.metrics_path);
+}
+
+/* Serve clients until we are told to stop: handle what shows up on the
+ * event queue, and give every connection a turn. Without workers this is the
+ * main thread's loop, and connection requests come straight from the
+ * listener. A worker runs one of its own, and gets them handed over. */
+static void run_event_loop(server_state& state) {
+	while (!stop_requested) {
+		if (state.metrics)
+			sample_connections(state);
+
+		/* A struct. for reporting connection management events in an event
+		 * queue. When a remote peer calls "fi_connect()", the peer that uses
+		 * 'fi_listen()' will receive a connection request in the form of
+		 * 'fi_eq_cm_entry'. 'info' contains a pointer to the client's
+		 * endpoint info., of which we can use to establish this connection.
+		 * 'FI_CONNECTED' and 'FI_SHUTDOWN' fill in the 'fid' only. */
+		fi_eq_cm_entry entry = {};
+		uint32_t event_type;
+
+		/* With nobody connected there is nothing else to do, so block on the
+		 * event queue. The timeout is only there to notice a stop request.
+		 * Over RDM, clients show up on the receive queue instead. In epoll
+		 * mode, the event queue is slept on with everything else below. */
+		bool idle = state.connections.empty() && !state.options.rdm &&
+			!state.wait_set;
+		size_t work = 0;
+		for (size_t handled = 0; handled < EVENTS_PER_PASS; handled++) {
+			ssize_t return_code = idle ?
+				fi_eq_sread(state.event_queue, &event_type, &entry,
+						sizeof(fi_eq_cm_entry), 1000, 0) :
+				fi_eq_read(state.event_queue, &event_type, &entry,
+						sizeof(fi_eq_cm_entry), 0);
+			if (return_code == -FI_EAGAIN || return_code == -FI_ETIMEDOUT)
+				break;
+
+			if (return_code < 0) {
+				if (-FI_EAVAIL == return_code) {
+					fi_eq_err_entry error = check_eq_error(state.event_queue);
+					handle_event_error(state, error);
+					work++;
+				} else {
+					std::fprintf(stderr, "fi_eq_read(): %s\n",
+							fi_strerror(-return_code));
+				}
+				break;
+			}
+
+			handle_event(state, event_type, entry);
+			idle = false;
+			work++;
+		}
+
+		/* Give every established connection a turn. With shared queues, one
+		 * read of each covers every connection at once. */
+		if (state.options.shared) {
+			work += drain_shared_queue(*state.shared.transmit_dispatcher);
+			if (state.scalable)
+				work += adopt_peers(state);
+			if (state.options.rdm)
+				work += drain_rdm_queue(state);
+			else if (state.options.srx)
+				work += drain_srx_queue(state);
+			else
+				work += drain_shared_queue(*state.shared.recv_dispatcher);
+		}
+
+		/* Free any connections that finished. */
+		for (auto it = state.connections.begin();
+				it != state.connections.end();) {
+			if (!state.options.shared)
+				work += progress_connection(state, *it->second);
+
+			/* Calls that sat out their time get answered, and calls left in
+			 * the ring taken in, even if nothing else happened on the
+			 * connection. */
+			if (it->second->state == conn_state::SERVING &&
+					(!it->second->calls.empty() ||
+					!it->second->deferred_calls.empty()))
+				work += serve_calls(state, *it->second);
+
+			if (it->second->state == conn_state::CLOSED) {
+				account_reads(state, it->second->transmit_dispatcher.get());
+				account_reads(state, it->second->recv_dispatcher.get());
+				it = state.connections.erase(it);
+			} else
+				it++;
+		}
+
+		/* In epoll mode, a pass that found nothing to do sleeps until any
+		 * queue of the loop has something. Otherwise, once anybody is
+		 * connected nothing above blocks, so it backs off before the next
+		 * one, and quiet connections don't keep a core spinning. Over RDM,
+		 * the event queue never blocks, so that goes for every pass. */
+		if (state.wait_set) {
+			int woken = work > 0 ? 0 :
+				state.wait_set->wait(wait_timeout(state));
+			if (woken < 0)
+				std::cerr << "FdWaitSet::wait(): " << fi_strerror(-woken) <<
+					std::endl;
+		} else if (!state.connections.empty() || state.options.rdm) {
+			if (work > 0)
+				state.waiter.reset();
+			else
+				state.waiter.idle();
+		}
+	}
+}
+
+/* Release whoever is still connected, and whatever they shared. */
+static void release_connections(server_state& state) {
+	for (auto& [key, conn] : state.connections) {
+		if (conn->state != conn_state::CLOSED) {
+			if (conn->state != conn_state::ACCEPTING)
+				disconnect(*conn);
+			close_connection(state, *conn);
+		}
+		account_reads(state, conn->transmit_dispatcher.get());
+		account_reads(state, conn->recv_dispatcher.get());
+	}
+	state.connections.clear();
+
+	if (state.options.shared)
+		close_shared_resources(state);
+}
+
+/* The body of a worker thread. It pins itself before it opens anything, so
+ * the memory of its queues and pools is first touched on its own NUMA node,
+ * and stays there. */
+static void run_worker(worker& self) {
+	server_state& state = self.state;
+	if (state.cpu >= 0) {
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		CPU_SET(state.cpu, &mask);
+		int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+				&mask);
+		if (ret != 0) {
+			std::cerr << "[worker " << self.index <<
+				"] pthread_setaffinity_np(): " << std::strerror(ret) <<
+				std::endl;
+			state.cpu = -1;
+		}
+	}
+
+	if (state.options.shared && !state.scalable)
+		open_shared_resources(state);
+
+	run_event_loop(state);
+	release_connections(state);
+}
+
+/* The listener's loop when there are workers. Every connection request is
+ * handed to the next worker in turn, as it is, 'info' and all, by writing it
+ * to that worker's event queue. The worker reads it like any other event,
+ * and a worker blocked on its queue wakes right up. */
+static void hand_out_requests(server_state& state, fid_pep* passive_endpoint,
+		std::vector<std::unique_ptr<worker>>& workers) {
+	size_t next = 0;
+	while (!stop_requested) {
+		fi_eq_cm_entry entry = {};
+		uint32_t event_type;
+
+		/* The timeout is only there to notice a stop request. */
+		ssize_t return_code = fi_eq_sread(state.event_queue, &event_type,
+				&entry, sizeof(fi_eq_cm_entry), 1000, 0);
+		if (return_code == -FI_EAGAIN || return_code == -FI_ETIMEDOUT)
+			continue;
+
+		if (return_code < 0) {
+			if (-FI_EAVAIL == return_code) {
+				check_eq_error(state.event_queue);
+			} else {
+				std::fprintf(stderr, "fi_eq_sread(): %s\n",
+						fi_strerror(-return_code));
+			}
+			continue;
+		}
+
+		if (event_type != FI_CONNREQ)
+			continue;
+
+		worker& target = *workers[next++ % workers.size()];
+		return_code = fi_eq_write(target.state.event_queue, FI_CONNREQ,
+				&entry, sizeof(fi_eq_cm_entry), 0);
+		if (return_code < 0) {
+			std::cerr << "fi_eq_write(), worker " << target.index << ": " <<
+				fi_strerror(-return_code) << std::endl;
+			fi_reject(passive_endpoint, entry.info->handle, nullptr, 0);
+			fi_freeinfo(entry.info);
+		}
+	}
+}
+
+/* Start the workers, hand them connection requests until we are told to
+ * stop, and wait for them to wrap up. Each worker gets an event queue of its
+ * own, which its connections' endpoints are bound to as well, and in shared
+ * mode, a domain and a pair of completion queues of its own. */
+static void run_workers(server_state& state, fid_pep* passive_endpoint) {
+	/* The listener writes the requests to the workers' queues. */
+	fi_eq_attr event_queue_attr = {
+		.size = EVENT_QUEUE_SIZE,
+		.flags = FI_WRITE,
+		.wait_obj = state.options.epoll ? FI_WAIT_FD : FI_WAIT_UNSPEC
+	};
+
+	scalable_endpoint scalable;
+	std::vector<std::unique_ptr<worker>> workers;
+	for (size_t i = 0; i < state.options.workers; i++) {
+		auto self = std::make_unique<worker>();
+		self->index = i;
+		self->state.options = state.options;
+		self->state.info = state.info;
+		self->state.fabric = state.fabric;
+		self->state.listener = passive_endpoint;
+		self->state.next_id = i + 1;
+		self->state.id_stride = state.options.workers;
+		self->state.waiter = CompletionWaiter(state.waiter.mode());
+		self->state.cpu = state.options.pin ? worker_cpu(i) : -1;
+		if (state.options.metrics)
+			self->state.metrics = std::make_unique<loop_metrics>();
+		check_libfabric(fi_eq_open(state.fabric, &event_queue_attr,
+					&self->state.event_queue, 0), "fi_eq_open(), worker");
+
+		/* Every worker sleeps on its own queues alone. */
+		if (state.options.epoll) {
+			self->state.wait_set = std::make_unique<FdWaitSet>(state.fabric);
+			check_libfabric(watch(self->state, &self->state.event_queue->fid),
+					"FdWaitSet::add()");
+		}
+
+		/* On a scalable endpoint, the worker takes over its contexts, and
+		 * reads its transmit queue like a shared one of its own. */
+		if (!state.contexts.empty()) {
+			server_state& mine = self->state;
+			mine.shared = std::move(state.contexts[i]);
+			mine.shared.transmit_dispatcher =
+				std::make_unique<CompletionDispatcher>(
+						mine.shared.transmit_queue, SHARED_COMPLETIONS_PER_READ,
+						resolve_shared_transmit, &mine);
+			mine.shared.transmit_dispatcher->track(loop_stats(mine));
+			mine.scalable = &scalable;
+			scalable.workers.push_back(&mine);
+			check_libfabric(watch(mine, &mine.shared.recv_queue->fid),
+					"FdWaitSet::add()");
+			check_libfabric(watch(mine, &mine.shared.transmit_queue->fid),
+					"FdWaitSet::add()");
+		}
+		workers.push_back(std::move(self));
+	}
+	state.contexts.clear();
+
+	/* Every worker's loop is reported, the listener has none. */
+	std::vector<server_state*> loops;
+	for (auto& self : workers)
+		loops.push_back(&self->state);
+	std::unique_ptr<MetricsExporter> exporter = start_exporter(state.options,
+			loops);
+
+	for (auto& self : workers)
+		self->thread = std::thread(run_worker, std::ref(*self));
+
+	hand_out_requests(state, passive_endpoint, workers);
+
+	for (auto& self : workers) {
+		self->thread.join();
+		if (state.options.poll) {
+			std::cout << "[worker " << self->index << "]" << std::endl;
+			self->state.waiter.report(std::cout);
+		}
+
+		state.completion_reads += self->state.completion_reads;
+		state.completions += self->state.completions;
+		self->state.wait_set.reset();
+		check_libfabric(fi_close(&self->state.event_queue->fid),
+				"fi_close(), worker event_queue");
+	}
+	exporter.reset();
+}
 
 /* Initialize and listen as a libfabric server. */
-int server() {
+int server(const server_options& options) {
+	server_state state;
+	state.options = options;
+
+	/* Over RDM, every client goes through the one endpoint, so everything
+	 * is shared. */
+	if (state.options.rdm)
+		state.options.shared = true;
+
+	/* Calls come in back to back, more than one frame buffer can take, so in
+	 * RPC mode they land in a ring. */
+	if (state.options.rpc)
+		state.options.ring = true;
+
+	/* A shared receive context lives on the shared domain, and what it
+	 * receives lands in the one ring posted to it. */
+	if (state.options.srx) {
+		state.options.shared = true;
+		state.options.ring = true;
+	}
+	state.waiter = CompletionWaiter(options.poll ? wait_mode::POLL :
+			options.epoll ? wait_mode::EPOLL : wait_mode::BLOCK);
+
+	/* Without workers, the main thread's loop is the one that counts. */
+	if (state.options.metrics && state.options.workers == 0)
+		state.metrics = std::make_unique<loop_metrics>();
 
 	/* Create a structure that holds the libfabric config. that
 	 * is being requested. This structure will be used to request
 	 * an actual structure to begin making the network. */
 	fi_info* hints = fi_allocinfo();
 
-	/* Request the ability to use the send/recv form of message passing. */
+	/* Request the ability to use the send/recv form of message passing. A
+	 * receive ring needs multi-receive buffers on top of that. */
 	hints->caps = FI_SEND | FI_RECV;
+	if (state.options.ring || state.options.rdm)
+		hints->caps |= FI_MSG | FI_MULTI_RECV;
+
+	/* In tagged mode, frames and the chunks of arrays are separate streams
+	 * of tagged messages instead. */
+	if (state.options.tagged)
+		hints->caps |= FI_TAGGED;
 
-	/* Request a connection-oriented endpoint (TCP). */
-	hints->ep_attr->type = FI_EP_MSG;
+	/* Every endpoint shares its receive context in SRX mode. */
+	if (state.options.srx)
+		hints->ep_attr->rx_ctx_cnt = FI_SHARED_CONTEXT;
+
+	/* Over RDM, what tells clients apart is the address their messages came
+	 * from. Their messages are copied out of the ring in the order they
+	 * land, so each client's must land in the order they were sent. */
+	if (state.options.rdm) {
+		hints->caps |= FI_SOURCE;
+		hints->tx_attr->msg_order = FI_ORDER_SAS;
+		hints->rx_attr->msg_order = FI_ORDER_SAS;
+	}
+
+	/* In RMA mode clients write and read our memory on top of that. In
+	 * rendezvous mode, clients and the server read each other's arrays. */
+	if (state.options.rma)
+		hints->caps |= FI_RMA | FI_REMOTE_READ | FI_REMOTE_WRITE;
+	if (state.options.rendezvous > 0)
+		hints->caps |= FI_RMA | FI_READ | FI_REMOTE_READ;
+
+	/* Request a connection-oriented endpoint (TCP), or a reliable
+	 * connectionless one in RDM mode. */
+	hints->ep_attr->type = state.options.rdm ? FI_EP_RDM : FI_EP_MSG;
+
+	/* Let libfabric know we register our own buffers, so providers that need
+	 * local registration ('FI_MR_LOCAL') can be picked too. */
+	hints->domain_attr->mr_mode = FI_MR_LOCAL | FI_MR_ALLOCATED |
+		FI_MR_PROV_KEY | FI_MR_VIRT_ADDR;
+
+	/* Small typed frames are injected without asking the provider first. */
+	hints->tx_attr->inject_size = TYPED_INJECT_SIZE;
+
+	/* With workers, every domain and everything in it is only ever touched
+	 * by the one worker that opened it, so the provider can skip locking.
+	 * Over RDM, the workers share one domain and one scalable endpoint, and
+	 * each of them only touches contexts and queues of its own. */
+	if (state.options.workers > 0 && state.options.rdm) {
+		hints->domain_attr->threading = FI_THREAD_FID;
+		hints->ep_attr->tx_ctx_cnt = state.options.workers;
+		hints->ep_attr->rx_ctx_cnt = state.options.workers;
+	} else if (state.options.workers > 0) {
+		hints->domain_attr->threading = FI_THREAD_DOMAIN;
+	}
 
 	/* Use the hinting structure to capture the real configuration
 	 * for the network. */
-	fi_info* info = nullptr;
 	check_libfabric(fi_getinfo(FI_VERSION(1, 15), 0, 0, 0,
-				hints, &info), "fi_getinfo()");
+				hints, &state.info), "fi_getinfo()");
 
 	/* Now that there is an actual config. from libfabric,
 	 * free the 'hints' info struct. */
 	fi_freeinfo(hints);
 
+	/* Clients mark their messages with their id in remote CQ data. */
+	if (state.options.srx &&
+			state.info->domain_attr->cq_data_size < sizeof(uint64_t)) {
+		std::cerr << "SRX mode needs 64 bits of remote CQ data, the " <<
+			"provider has " << state.info->domain_attr->cq_data_size <<
+			" bytes." << std::endl;
+		fi_freeinfo(state.info);
+		return 1;
+	}
+
 	/* Use the info gathered to create a libfabric network using the
 	 * available providers available to the OS. This represents
 	 * a collection of resources such as domains, event queues,
 	 * completion queues, endpoints, etc. */
-	fid_fabric* fabric;
-	check_libfabric(fi_fabric(info->fabric_attr, &fabric, nullptr),
-			"fi_fabric()");
+	check_libfabric(fi_fabric(state.info->fabric_attr, &state.fabric,
+				nullptr), "fi_fabric()");
 
 	/* Set event queue attributes. An event queue stores the
 	 * asynchronous events made on the network. The wait setting is
 	 * a mechanism that holds multiple waitable objects such as event queues,
 	 * completion queues, counters, etc. */
 	fi_eq_attr event_queue_attr = {
-		.size = 10, /* The maximum number of events that can be queued. */
+		.size = EVENT_QUEUE_SIZE,
 		.wait_obj = FI_WAIT_UNSPEC /* Use whatever wait obj. deemed needed. */
 	};
 
+	/* In epoll mode, the loop sleeps on the event queue's file descriptor
+	 * along with those of the completion queues. */
+	if (state.options.epoll)
+		event_queue_attr.wait_obj = FI_WAIT_FD;
+
 	/* Create the event queue using the settings structure. */
-	fid_eq* event_queue = nullptr;
-	check_libfabric(fi_eq_open(fabric, &event_queue_attr, &event_queue, 0),
-			"fi_eq_open()");
-
-	/* Configure attributes of the completion queue. */
-	fi_cq_attr completion_queue_attr = {
-		.flags = 0,
-
-		/* When completing operations, like 'fi_send' for instance, you
-		 * might poll the CQ to get a completion entry. This option ensures
-		 * that the returned info is the context pointer. */
-		.format = FI_CQ_FORMAT_CONTEXT,
-		.wait_obj = FI_WAIT_UNSPEC,
-		.signaling_vector = 0,
-		.wait_cond = FI_CQ_COND_NONE, /* No condition needs to be met. */
-		.wait_set = 0
-	};
+	check_libfabric(fi_eq_open(state.fabric, &event_queue_attr,
+				&state.event_queue, 0), "fi_eq_open()");
+
+	/* Without workers, the main thread's loop is the one that sleeps. */
+	if (state.options.epoll && state.options.workers == 0) {
+		state.wait_set = std::make_unique<FdWaitSet>(state.fabric);
+		check_libfabric(watch(state, &state.event_queue->fid),
+				"FdWaitSet::add()");
+	}
+
+	/* Workers open shared resources of their own. */
+	if (state.options.shared && state.options.workers == 0)
+		open_shared_resources(state);
 
 	/* Create a passive endpoint for the server. It will be used for listening
-	 * for incoming connections. */
+	 * for incoming connections. Over RDM there is nothing to listen for,
+	 * clients just send to the one endpoint. */
 	fid_pep* passive_endpoint = nullptr;
-	check_libfabric(fi_passive_ep(fabric, info, &passive_endpoint, nullptr),
-			"fi_passive_ep()");
+	fid_t named = nullptr;
+	if (state.options.rdm && state.options.workers > 0) {
+		open_scalable_endpoint(state);
+		named = &state.shared.endpoint->fid;
+	} else if (state.options.rdm) {
+		open_rdm_endpoint(state);
+		named = &state.shared.endpoint->fid;
+	} else {
+		check_libfabric(fi_passive_ep(state.fabric, state.info,
+					&passive_endpoint, nullptr), "fi_passive_ep()");
 
-	/* Bind the passive endpoint to the event queue. */
-	check_libfabric(fi_pep_bind(passive_endpoint, &event_queue->fid, 0),
-			"fi_pep_bind()");
+		/* Bind the passive endpoint to the event queue. */
+		check_libfabric(fi_pep_bind(passive_endpoint,
+					&state.event_queue->fid, 0), "fi_pep_bind()");
 
-	/* Listen on the passive endpoint. */
-	check_libfabric(fi_listen(passive_endpoint), "fi_listen()");
+		/* Listen on the passive endpoint. */
+		check_libfabric(fi_listen(passive_endpoint), "fi_listen()");
+		state.listener = passive_endpoint;
+		named = &passive_endpoint->fid;
+	}
 
-	/* Obtain the address information of the passive endpoint. */
+	/* Obtain the address information of the endpoint clients reach. */
 	sockaddr_in addr = {};
 	size_t addr_length = sizeof(sockaddr_in);
-	check_libfabric(fi_getname(&passive_endpoint->fid, &addr, &addr_length),
-			"fi_getname()");
+	check_libfabric(fi_getname(named, &addr, &addr_length), "fi_getname()");
 
 	Debugger debug;
-	debug.print_info(info);
+	debug.print_info(state.info);
 
 	std::cout << "Server address: " << inet_ntoa(addr.sin_addr) << ":" <<
 		ntohs(addr.sin_port) << std::endl;
 
-	/* A struct. for reporting connection management events in an event queue.
-	 * When a remote peer calls "fi_connect()", the peer that uses
-	 * 'fi_listen()' will receive a connection request in the form of
-	 * 'fi_eq_cm_entry'. 'conn_req' contains a pointer to the client's
-	 * endpoint info., of which we can use to establish this connection. */
-	fi_eq_cm_entry conn_req = {};
-	uint32_t event_type;
-	do {
-		/* Read from the event queue (synchronous (blocking)). */
-		int return_code = fi_eq_sread(event_queue, &event_type, &conn_req,
-				sizeof(fi_eq_cm_entry), -1, 0);
-		if (return_code < 0) {
-			if (-FI_EAVAIL == return_code) {
-				check_eq_error(event_queue);
-			} else {
-				std::fprintf(stderr, "fi_eq_sread(), FI_CONNREQ: %s\n",
-						fi_strerror(-return_code));
-			}
-		}
-	} while (event_type != FI_CONNREQ);
-
-	/* Create a domain for the client based off of their provider info. */
-	fid_domain* domain = nullptr;
-	check_libfabric(fi_domain(fabric, conn_req.info, &domain, 0),
-			"fi_domain()");
-
-	/* Create an endpoint for the client using their provider info. */
-	fid_ep* endpoint = nullptr;
-	check_libfabric(fi_endpoint(domain, conn_req.info, &endpoint, 0),
-			"fi_endpoint()");
-
-	/* Open a receiving and tramsission completion queue bound to the 
-	 * requestor's domain and endpoint. */
-	fid_cq* recv_queue = nullptr;
-	check_libfabric(fi_cq_open(domain, &completion_queue_attr,
-				&recv_queue, nullptr), "fi_cq_open(), recv_queue");
-	check_libfabric(fi_ep_bind(endpoint, &recv_queue->fid, FI_RECV),
-			"fi_ep_bind(), recv_queue");
-
-	fid_cq* transmit_queue = nullptr;
-	check_libfabric(fi_cq_open(domain, &completion_queue_attr,
-				&transmit_queue, nullptr), "fi_cq_open(), transmit_queue");
-	check_libfabric(fi_ep_bind(endpoint, &transmit_queue->fid, FI_TRANSMIT),
-			"fi_ep_bind(), transmit_queue");
-
-	/* Bind the new active endpoint to the event queue and enable it.*/
-	check_libfabric(fi_ep_bind(endpoint, &event_queue->fid, 0),
-			"fi_ep_bind(), event_queue");
-	check_libfabric(fi_enable(endpoint), "fi_enable()");
-
-	/* This is asynchronous, so post a receive buffer so when data is sent,
-	 * there is a place for it to go. */
-	float recv_buffer = 0.0;
-	check_libfabric(fi_recv(endpoint, &recv_buffer, sizeof(float), 0, 0, 0),
-			"fi_recv()");
-
-	/* Send an acceptance response back to the requestor. */
-	check_libfabric(fi_accept(endpoint, 0, 0), "fi_accept");
-
-	/* Use the actice endpoint (the connection requestor) to post an
-	 * 'FI_CONNECTED' event into the event queue. */
-	fi_eq_entry conn = {};
-	do {
-		int return_code = fi_eq_sread(event_queue, &event_type, &conn,
-				sizeof(fi_eq_entry), 500, 0);
-		if (return_code < 0) {
-			if (-FI_EAVAIL == return_code) {
-				check_eq_error(event_queue);
-			} else {
-				std::fprintf(stderr, "fi_eq_sread(), FI_CONNECTED: %s\n",
-						fi_strerror(-return_code));
-			}
-		}
-	} while (event_type != FI_CONNECTED);
-
-	/* Send a floating point number. Remember, these calls are primarily
-	 * asynchronous. */
-	float send_buffer = 123.45;
-	check_libfabric(fi_send(endpoint, &send_buffer, sizeof(float), 0, 0, 0),
-			"fi_send(), float");
-
-	/* We read the transmission completion queue, and it will let us know when
-	 * the message has been transmitted. This essentially turns an asynchronous
-	 * call and makes it synchronous. */
-	fi_cq_data_entry transmit_cq_entry = {};
-	int read = -1;
-	do {
-		read = fi_cq_sread(transmit_queue, &transmit_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	/* We read the receiving completion queue, and it will let us know when
-	 * a message has been received. We have posted a receive buffer already. */
-	fi_cq_data_entry recv_cq_entry = {};
-	do {
-		read = fi_cq_sread(recv_queue, &recv_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	std::cout << std::endl << "Data received: " << recv_buffer << std::endl;
-
-	/* A little more practice. First, we are gonna send the size of our array,
-	 * then receive the size of the clients array. Then, we are gonna send the 
-	 * array itself, and vice versa for the client. */	
-	size_t send_msg_size = 50;
-	check_libfabric(fi_send(endpoint, &send_msg_size, sizeof(size_t), 0, 0, 0),
-			"fi_send(), array_size");
-	do {
-		read = fi_cq_sread(transmit_queue, &transmit_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	size_t recv_msg_size = 0;
-	check_libfabric(fi_recv(endpoint, &recv_msg_size, sizeof(size_t), 0, 0, 0),
-			"fi_recv(), array_size");
-	do {
-		read = fi_cq_sread(recv_queue, &recv_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	std::cout << std::endl << "Array size received: " << recv_msg_size << 
-		std::endl;
-
-	std::vector<float> send_arr_buf(50);
-	std::fill(send_arr_buf.begin(), send_arr_buf.end(), 25.2);
-
-	/* Arrays can't always be sent in one go, so we are going to keep sending
-	 * it until it is all sent, indicating by tracking the remaining amount. */
-	ssize_t total_buf_size = send_arr_buf.size() * sizeof(float);
-	size_t remaining_send = total_buf_size;
-	ssize_t sent = 0;
-	ssize_t total_sent = 0;
-	char* current_buf = reinterpret_cast<char*>(send_arr_buf.data());
-	while (total_sent < total_buf_size) {
-		/* So, fi_send() will return zero if the whole buffer was able to be
-		 * sent. If it was a partial send though, it will return the amount of
-		 * bytes sent. So we want to advance the buffer by the amount of bytes
-		 * sent so we can track what to send next. A char* data type is the
-		 * smallest one we can use, as it has just a size of 1 byte. We will
-		 * use this to track our buffer. */
-		sent = fi_send(endpoint, current_buf, remaining_send, 0, 0, 0);
-
-		if (sent > 0) {
-			total_sent += sent;
-			remaining_send -= sent;
-			current_buf += sent;
-		} else if (sent == 0) {
-			total_sent += remaining_send;
-			remaining_send = 0;
-		} else if (sent == -FI_EAGAIN) {
-			/* We will check the value 'read' after the loop finished. */
-			read = fi_cq_sread(transmit_queue, &transmit_cq_entry, 1, 0, -1);
-		} else if (sent < 0) {
-			break;
-		}
-	}
-
-	std::cout << "ebug" << std::endl;
+	/* Keep serving clients until we are told to stop. */
+	std::signal(SIGINT, request_stop);
+	std::signal(SIGTERM, request_stop);
 
-	/* Poll one last time to make sure the sending is complete. */
-	do {
-		read = fi_cq_sread(transmit_queue, &transmit_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	const size_t expected_buf_size = recv_msg_size;
-	const size_t expected_buf_bytes = expected_buf_size * sizeof(float);
-	std::vector<float> recv_arr_buf(recv_msg_size);
-
-	current_buf = reinterpret_cast<char*>(recv_arr_buf.data());
-	size_t remaining_recv = expected_buf_bytes;
-	size_t recv = 0;
-	size_t total_recv = 0;
-	while (total_recv < expected_buf_bytes) {
-		recv = fi_recv(endpoint, current_buf, remaining_recv, 0, 0, 0);
-
-		if (recv > 0) {
-			total_recv += recv;
-			remaining_recv -= recv;
-			current_buf += recv;
-		} else if (recv == -FI_EAGAIN) {
-			read = fi_cq_sread(recv_queue, &recv_cq_entry, 1, 0, -1);
-		} else if (recv < 0) {
-			break;
-		}
+	if (state.options.workers > 0) {
+		run_workers(state, passive_endpoint);
+	} else {
+		std::unique_ptr<MetricsExporter> exporter =
+			start_exporter(state.options, {&state});
+		run_event_loop(state);
+		exporter.reset();
+		if (state.options.poll)
+			state.waiter.report(std::cout);
+		release_connections(state);
 	}
-	
-	/* Poll one last time to make sure the recv is complete. */
-	do {
-		read = fi_cq_sread(recv_queue, &recv_cq_entry, 1, 0, -1);
-	} while (read == -FI_EAGAIN);
-
-	std::cout << "Array: ";
-	for (auto i : recv_arr_buf)
-		std::cout << i << " ";
-	std::cout << std::endl;
 
-	/* Now that we are done, release the conn. to the client. */
-	check_libfabric(fi_shutdown(endpoint, 0),
-			"fi_shutdown(), endpoint");
+	if (state.options.rdm && state.options.workers > 0)
+		close_scalable_endpoint(state);
 
 	/* Close the passive endpoint. */
-	check_libfabric(fi_close(&passive_endpoint->fid),
-			"fi_close(), passive_endpoint");
+	if (passive_endpoint)
+		check_libfabric(fi_close(&passive_endpoint->fid),
+				"fi_close(), passive_endpoint");
 
-	/* Endpoints must be closed before any objects bound to them can be. */
-	check_libfabric(fi_close(&endpoint->fid),
-			"fi_close(), endpoint");
+	std::cout << "Completion queue reads: " << state.completion_reads <<
+		", completions: " << state.completions << std::endl;
 
-	/* Objects inside a domain have to be closed before the domain can. */
-	check_libfabric(fi_close(&recv_queue->fid), "fi_close(), recv_queue");
-	check_libfabric(fi_close(&transmit_queue->fid),
-			"fi_close(), transmit_queue");
-
-	/* The domain and the event queue must be closed. The passive endpoint
-	 * is closed by it's own server-side. */
-	check_libfabric(fi_close(&domain->fid), "fi_close(), domain");
-	check_libfabric(fi_close(&event_queue->fid),
+	/* The event queue must be closed. The passive endpoint is closed by
+	 * it's own server-side. */
+	state.wait_set.reset();
+	check_libfabric(fi_close(&state.event_queue->fid),
 			"fi_close(), event_queue");
 
 	/* Now close the fabric network. */
-	check_libfabric(fi_close(&fabric->fid), "fi_close(), fabric");
+	check_libfabric(fi_close(&state.fabric->fid), "fi_close(), fabric");
 
 	/* Free the fabric info structure last. */
-	fi_freeinfo(info);
+	fi_freeinfo(state.info);
 
 	return 0;
 }
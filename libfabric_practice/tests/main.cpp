@@ -0,0 +1,203 @@
+#include "rpc.hpp"
+#include "metrics.hpp"
+#include "histogram.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+/* Unit tests for the pieces of lib that don't need a fabric: the table of
+ * calls in flight, the latency ring and the histogram. Each suite is run on
+ * its own, by name, so 'ctest' tells them apart. */
+
+static int failures = 0;
+
+/* Count a failed check and say where it was, but keep going, so one run
+ * shows everything that is wrong. */
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": " << \
+				#condition << std::endl; \
+			failures++; \
+		} \
+	} while (0)
+
+/* Ids map to the slot 'id & mask', and a slot still held makes the id
+ * that lands on it fail, without giving the older call up. */
+static void test_in_flight_table() {
+	int calls[4] = {};
+	InFlightTable table(2);
+	CHECK(table.capacity() == 2);
+
+	const uint64_t first = table.insert(&calls[0]);
+	const uint64_t second = table.insert(&calls[1]);
+	CHECK(first != 0);
+	CHECK(second != 0);
+	CHECK(first != second);
+	CHECK(table.in_flight() == 2);
+
+	/* Both slots are held, so the next ids collide. */
+	CHECK(table.insert(&calls[2]) == 0);
+	CHECK(table.insert(&calls[2]) == 0);
+	CHECK(table.in_flight() == 2);
+
+	/* Calls come back by their own ids, in any order. */
+	CHECK(table.remove(second) == &calls[1]);
+	CHECK(table.remove(first) == &calls[0]);
+	CHECK(table.in_flight() == 0);
+
+	/* An id that was answered already, one that was never handed out and
+	 * the markers for a free or claimed slot find nothing. */
+	CHECK(table.remove(first) == nullptr);
+	CHECK(table.remove(second + 100) == nullptr);
+	CHECK(table.remove(0) == nullptr);
+	CHECK(table.remove(~0ULL) == nullptr);
+
+	/* A slot that was given back is taken by a newer id, and the older id
+	 * that used to map to it still finds nothing. */
+	const uint64_t third = table.insert(&calls[3]);
+	CHECK(third != 0);
+	CHECK(table.remove(first) == nullptr);
+	CHECK(table.remove(second) == nullptr);
+	CHECK(table.remove(third) == &calls[3]);
+
+	/* Capacities are rounded up to a power of two. */
+	CHECK(InFlightTable(5).capacity() == 8);
+	CHECK(InFlightTable(0).capacity() == 1);
+}
+
+/* Stamps come back in order, and the ones written over before a drain are
+ * counted as lost. */
+static void test_latency_ring() {
+	auto ring = std::make_unique<LatencyRing>();
+	uint64_t cursor = 0;
+	std::vector<latency_stamp> stamps;
+
+	CHECK(ring->drain(cursor, stamps) == 0);
+	CHECK(stamps.empty());
+
+	ring->push(7, latency_op::RESPONSE, 100);
+	ring->push(8, latency_op::FRAME, 200);
+	CHECK(ring->drain(cursor, stamps) == 0);
+	CHECK(stamps.size() == 2);
+	CHECK(cursor == 2);
+	CHECK(stamps[0].connection == 7);
+	CHECK(stamps[0].op == latency_op::RESPONSE);
+	CHECK(stamps[0].nanos == 100);
+	CHECK(stamps[1].connection == 8);
+	CHECK(stamps[1].op == latency_op::FRAME);
+
+	/* Nothing new, nothing lost. */
+	stamps.clear();
+	CHECK(ring->drain(cursor, stamps) == 0);
+	CHECK(stamps.empty());
+
+	/* Going around the ring more than once writes over the oldest stamps.
+	 * Only the newest ring's worth is left. */
+	const uint64_t overrun = 10;
+	for (uint64_t i = 0; i < LATENCY_RING_SIZE + overrun; i++)
+		ring->push(1, latency_op::ARRAY_SEND, i);
+	CHECK(ring->drain(cursor, stamps) == overrun);
+	CHECK(stamps.size() == LATENCY_RING_SIZE);
+	CHECK(stamps.front().nanos == overrun);
+	CHECK(stamps.back().nanos == LATENCY_RING_SIZE + overrun - 1);
+	CHECK(cursor == 2 + LATENCY_RING_SIZE + overrun);
+
+	/* Filling it exactly loses nothing. */
+	stamps.clear();
+	for (uint64_t i = 0; i < LATENCY_RING_SIZE; i++)
+		ring->push(2, latency_op::ARRAY_RECV, i);
+	CHECK(ring->drain(cursor, stamps) == 0);
+	CHECK(stamps.size() == LATENCY_RING_SIZE);
+}
+
+/* Small values are exact, bigger ones land in buckets whose width doubles
+ * with every power of two, and percentiles report a bucket's top value,
+ * never more than the biggest one recorded. */
+static void test_histogram() {
+	Histogram empty;
+	CHECK(empty.count() == 0);
+	CHECK(empty.min() == 0);
+	CHECK(empty.percentile(50) == 0);
+
+	/* With 8 bits, everything under 256 has a bucket of its own. */
+	Histogram exact;
+	for (uint64_t value = 1; value <= 100; value++)
+		exact.record(value);
+	CHECK(exact.count() == 100);
+	CHECK(exact.min() == 1);
+	CHECK(exact.max() == 100);
+	CHECK(exact.percentile(0) == 1);
+	CHECK(exact.percentile(1) == 1);
+	CHECK(exact.percentile(50) == 50);
+	CHECK(exact.percentile(50.5) == 51);
+	CHECK(exact.percentile(99) == 99);
+	CHECK(exact.percentile(100) == 100);
+	CHECK(exact.percentile(200) == 100);
+	CHECK(exact.mean() == 50.5);
+
+	/* 256 and 257 share a bucket, and 258 starts the next one. */
+	Histogram pairs;
+	pairs.record(256);
+	pairs.record(300);
+	CHECK(pairs.percentile(50) == 257);
+	CHECK(pairs.percentile(100) == 300);
+
+	Histogram edge;
+	edge.record(255);
+	edge.record(258);
+	CHECK(edge.percentile(50) == 255);
+	CHECK(edge.percentile(100) == 258);
+
+	/* Right below a power of two, and right at it. */
+	Histogram octave;
+	octave.record(511);
+	octave.record(512);
+	octave.record(1000);
+	CHECK(octave.percentile(33) == 511);
+	CHECK(octave.percentile(66) == 515);
+	CHECK(octave.percentile(100) == 1000);
+
+	/* The top bucket ends at the biggest value there is. */
+	Histogram top;
+	top.record(UINT64_MAX);
+	CHECK(top.percentile(100) == UINT64_MAX);
+	CHECK(top.max() == UINT64_MAX);
+
+	top.reset();
+	CHECK(top.count() == 0);
+	CHECK(top.percentile(100) == 0);
+}
+
+int main(int argc, char* argv[]) {
+	const char* suite = argc > 1 ? argv[1] : "all";
+	const bool all = std::strcmp(suite, "all") == 0;
+	bool ran = false;
+
+	if (all || std::strcmp(suite, "in_flight_table") == 0) {
+		test_in_flight_table();
+		ran = true;
+	}
+	if (all || std::strcmp(suite, "latency_ring") == 0) {
+		test_latency_ring();
+		ran = true;
+	}
+	if (all || std::strcmp(suite, "histogram") == 0) {
+		test_histogram();
+		ran = true;
+	}
+
+	if (!ran) {
+		std::cerr << "No suite named " << suite << "." << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (failures > 0) {
+		std::cerr << failures << " checks failed." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}